@@ -132,14 +132,18 @@ n2:addShape(banner)
 local KSIZE = 4
 local sink = 0.4
 
--- load kart textures
-if lib3d.texture then
-    KART_ANGLES = 96
-    kart_texture = {}
-    for i = 0,KART_ANGLES-1 do
-        local f = "assets/kart/img-"..tostring(i)..".png.u"
-        kart_texture[i] = lib3d.texture.new(f, true)
-    end
+-- all karts share one imposter. Its texture is a sprite sheet of views from
+-- 64 directions around the kart, and the library picks one for each kart as it draws.
+kartImposter = lib3d.imposter.new()
+kartImposter:setPosition(lib3d.point.new(0, 0, 0))
+kartImposter:setRectangle(-KSIZE /2, -KSIZE * (1-sink), KSIZE /2, KSIZE * sink)
+kartImposter:setZOffsets(0, 0, -4, -4) -- helps imposter appear above the floor
+if kartImposter.setTexture then
+    kartImposter:setTexture(lib3d.texture.new("assets/kart/sheet.png.u", true))
+    
+    -- (the kart faces +y in its node; the first frame is the view from behind it.)
+    kartImposter:setFrames(8, 8, 64, 1)
+    kartImposter:setOrientation(lib3d.point.new(0, 0, 1), lib3d.point.new(0, -1, 0))
 end
 
 local function randelt(a)
@@ -210,15 +214,7 @@ function makeKart(is_player) return {
     preferred_t = 0.5,
     add = function(self)
         self.kartNode = n:addChildNode()
-        
-        self.kartshape = lib3d.imposter.new()
-        self.kartshape:setPosition(lib3d.point.new(0, 0, 0))
-        self.kartshape:setRectangle(-KSIZE /2, -KSIZE * (1-sink), KSIZE /2, KSIZE * sink)
-        self.kartshape:setZOffsets(0, 0, -4, -4) -- helps imposter appear above the floor
-        if self.kartshape.setTexture then
-            self.kartshape:setTexture(lib3d.texture.new("assets/kart/img-0.png.u", true))
-        end
-        self.kartNode:addImposter(self.kartshape)
+        self.kartNode:addImposter(kartImposter)
     end,
     remove = function(self)
         if self.kartNode then
@@ -360,15 +356,6 @@ function makeKart(is_player) return {
             self.pos.z + radius * attack)
         scene:setCameraTarget(self.pos.x, self.pos.y, self.pos.z + 4)
         scene:setCameraUp(0, 0, 1)
-    end,
-    setImage = function(self, scene)
-        -- set texture
-        local fv = lib3d.point.new(scene:getCameraTarget()) - lib3d.point.new(scene:getCameraOrigin())
-        if self.kartshape.setTexture then
-            local cam_reltheta = atan2(fv.y, fv.x) - atan2(self.f.y, self.f.x)
-            local kart_frame = math.floor(-cam_reltheta * KART_ANGLES / 2 / math.pi + 0.5) % KART_ANGLES
-            self.kartshape:setTexture(kart_texture[kart_frame])
-        end
     end
 }
 end
@@ -418,10 +405,6 @@ function playdate.update()
         kart:setShoulderCamera(scene)
     end
     
-    kart:setImage(scene)
-    for _, npckart in ipairs(npckarts) do
-        npckart:setImage(scene)
-    end
 	
     scene:prefetchZBuff();
 	if not lib3d.renderer.getInterlaceEnabled then -- [sic]
@@ -0,0 +1,76 @@
+#!/bin/sh
+#
+#  configs.sh
+#  mini3d-plus benchmarks
+#
+#  Builds bench/frames.c on the host once for each of the mini3d.h configurations below,
+#  runs it with that configuration's runtime options, and prints the results as one JSON array (see frames.c for what's measured).
+#
+#  Usage (from the repository root):
+#      bench/configs.sh [frames.c options...] > results.json
+#
+#  Each configuration is built in host/build-bench/<name>. Add lines to CONFIGS to measure
+#  other options; the first word is the name, -D options are passed to the compiler and the
+#  rest (such as --interlace or --zbits 16) to frames.c.
+#
+
+set -e
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+JOBS=$(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 4)
+
+CONFIGS="
+default
+zbuffer -DENABLE_Z_BUFFER=1
+zbuffer-16 -DENABLE_Z_BUFFER=1 --zbits 16
+zbuffer-32 -DENABLE_Z_BUFFER=1 --zbits 32
+zbuffer-parity -DENABLE_Z_BUFFER=1 -DZ_BUFFER_FRAME_PARITY=1
+zbuffer-fog -DENABLE_Z_BUFFER=1 -DENABLE_DISTANCE_FOG=1
+sbuffer --sbuffer
+order-table-64 --order-table 64
+order-table-256 --order-table 256
+sbuffer-order-table --sbuffer --order-table 256
+ordering-table -DENABLE_ORDERING_TABLE=1 -DSORT_3D_FACES_BY_Z=0
+no-bsp -DENABLE_BSP=0
+affine -DTEXTURE_PERSPECTIVE_MAPPING=0
+perspective -DTEXTURE_PERSPECTIVE_MAPPING=1
+perspective-ratio -DTEXTURE_PERSPECTIVE_MAPPING=2 -DTEXTURE_PROJECTIVE_RATIO_THRESHOLD=0.85f
+perspective-area -DTEXTURE_PERSPECTIVE_MAPPING=3
+perspective-split -DTEXTURE_PERSPECTIVE_MAPPING_SPLIT=1
+precompute-projection -DPRECOMPUTE_PROJECTION=1
+no-scanlining -DENABLE_POLYGON_SCANLINING=0
+render-distance -DENABLE_RENDER_DISTANCE_MAX=1
+interlace -DENABLE_INTERLACE=1 --interlace
+interlace-textures -DENABLE_INTERLACE=2 --interlace
+"
+
+first=1
+echo "["
+
+echo "$CONFIGS" | while read -r name args; do
+	[ -z "$name" ] && continue
+
+	defs=""
+	run=""
+
+	for a in $args; do
+		case "$a" in
+			-D*) defs="$defs $a" ;;
+			*) run="$run $a" ;;
+		esac
+	done
+
+	build="$ROOT/host/build-bench/$name"
+
+	if ! make -s -j"$JOBS" -C "$ROOT/host" BUILD="$build" DEFS="$defs" "$build/bench_frames" >&2; then
+		echo "configs.sh: $name doesn't build; skipped" >&2
+		continue
+	fi
+
+	[ $first = 1 ] || echo ","
+	first=0
+
+	(cd "$ROOT" && "$build/bench_frames" --label "$name" $run "$@")
+done
+
+echo "]"
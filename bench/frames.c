@@ -0,0 +1,267 @@
+//
+//  frames.c
+//  mini3d-plus benchmarks
+//
+//  Renders the demo scenes (scenes.c) headlessly, with the camera and objects moving along a
+//  fixed path, and reports how long each frame took.
+//  The output is JSON, with the mini3d.h configuration it was built with, so results from
+//  different builds can be compared; bench/configs.sh builds and runs a set of them.
+//
+//  A frame is timed the way scene:draw() in luaglue.c does it: the frame buffer is cleared
+//  and Scene3D_draw() is called. Timings are from the host, so only the relative numbers
+//  mean anything for the device.
+//
+//  Build and run (from the repository root):
+//      make -C host && host/build/bench_frames
+//
+//  Options:
+//      --frames N      frames timed per scene (default 300)
+//      --warmup N      frames drawn before timing starts (default 20)
+//      --scene NAME    only this scene (may be repeated)
+//      --interlace     turn on interlacing, if the build has ENABLE_INTERLACE
+//      --sbuffer       draw with the S-buffer (Scene3D_setUsesSBuffer), if the build has ENABLE_S_BUFFER
+//      --order-table N use a scene ordering table of N buckets instead of sorting, if the build
+//                      has ENABLE_SCENE_ORDERING_TABLE
+//      --zbits N       draw with an N-bit z buffer (8, 16 or 32), if the build has ENABLE_Z_BUFFER
+//      --assets DIR    where track.json etc. are (default Source/assets)
+//      --label TEXT    copied into the output, to tell runs apart
+//      --dump PREFIX   write each scene's last frame to PREFIX<scene>.pbm
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "pd_host.h"
+#include "mini3d.h"
+#include "render.h"
+#include "scenes.h"
+
+static uint8_t frame[LCD_ROWS * LCD_ROWSIZE];
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int compareDouble(const void* a, const void* b)
+{
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+static void printConfig(void)
+{
+	#define CONFIG(x) { #x, (int)(x) }
+	static const struct { const char* name; int value; } config[] = {
+		CONFIG(ENABLE_Z_BUFFER),
+		CONFIG(ENABLE_S_BUFFER),
+		CONFIG(ENABLE_ORDERING_TABLE),
+		CONFIG(ENABLE_SCENE_ORDERING_TABLE),
+		CONFIG(ENABLE_BSP),
+		CONFIG(ENABLE_LOD),
+		CONFIG(FACE_RADIX_SORT),
+		CONFIG(FACE_SORT_COHERENT),
+		CONFIG(ENABLE_CUSTOM_PATTERNS),
+		CONFIG(ENABLE_TEXTURES),
+		CONFIG(ENABLE_SHAPE_IMPOSTERS),
+		CONFIG(ENABLE_TEXTURES_MASK),
+		CONFIG(ENABLE_TEXTURES_GREYSCALE),
+		CONFIG(ENABLE_TEXTURES_LIGHTING),
+		CONFIG(TEXTURES_ALWAYS_SQUARE),
+		CONFIG(TEXTURE_PERSPECTIVE_MAPPING),
+		CONFIG(TEXTURE_PERSPECTIVE_MAPPING_SPLIT),
+		CONFIG(PRECOMPUTE_PROJECTION),
+		CONFIG(ENABLE_POLYGON_SCANLINING),
+		CONFIG(FACE_CLIPPING),
+		CONFIG(GUARD_BAND_CLIPPING),
+		CONFIG(ENABLE_FRUSTUM_CULLING),
+		CONFIG(ENABLE_EARLY_BACKFACE_CULLING),
+		CONFIG(ENABLE_RENDER_DISTANCE_MAX),
+		CONFIG(ENABLE_INTERLACE),
+		CONFIG(INTERLACE_INTERVAL),
+		CONFIG(Z_BUFFER_FRAME_PARITY),
+		CONFIG(Z_BUFFER_LAZY_CLEAR),
+		CONFIG(ENABLE_DISTANCE_FOG),
+		CONFIG(ENABLE_ZRENDERSKIP),
+	};
+	#undef CONFIG
+
+	printf("  \"config\": {");
+
+	for ( size_t i = 0; i < sizeof(config) / sizeof(config[0]); ++i )
+		printf("%s\n    \"%s\": %d", i ? "," : "", config[i].name, config[i].value);
+
+	printf("\n  },\n");
+}
+
+int main(int argc, char** argv)
+{
+	int frames = 300;
+	int warmup = 20;
+	int interlace = 0;
+	int sbuffer = 0;
+	int orderTable = 0;
+	int zbits = 0;
+	const char* label = "";
+	const char* dump = NULL;
+	int* selected = calloc(benchSceneCount, sizeof(int));
+	int anySelected = 0;
+
+	for ( int i = 1; i < argc; ++i )
+	{
+		if ( strcmp(argv[i], "--frames") == 0 && i + 1 < argc )
+			frames = atoi(argv[++i]);
+		else if ( strcmp(argv[i], "--warmup") == 0 && i + 1 < argc )
+			warmup = atoi(argv[++i]);
+		else if ( strcmp(argv[i], "--interlace") == 0 )
+			interlace = 1;
+		else if ( strcmp(argv[i], "--sbuffer") == 0 )
+			sbuffer = 1;
+		else if ( strcmp(argv[i], "--order-table") == 0 && i + 1 < argc )
+			orderTable = atoi(argv[++i]);
+		else if ( strcmp(argv[i], "--zbits") == 0 && i + 1 < argc )
+			zbits = atoi(argv[++i]);
+		else if ( strcmp(argv[i], "--assets") == 0 && i + 1 < argc )
+			benchAssetDir = argv[++i];
+		else if ( strcmp(argv[i], "--label") == 0 && i + 1 < argc )
+			label = argv[++i];
+		else if ( strcmp(argv[i], "--dump") == 0 && i + 1 < argc )
+			dump = argv[++i];
+		else if ( strcmp(argv[i], "--scene") == 0 && i + 1 < argc )
+		{
+			const char* name = argv[++i];
+			int s = 0;
+
+			while ( s < benchSceneCount && strcmp(benchScenes[s].name, name) != 0 )
+				++s;
+
+			if ( s == benchSceneCount )
+			{
+				fprintf(stderr, "no scene called %s\n", name);
+				return 1;
+			}
+
+			selected[s] = anySelected = 1;
+		}
+		else
+		{
+			fprintf(stderr, "usage: %s [--frames N] [--warmup N] [--scene NAME]... [--interlace] [--sbuffer] [--order-table N] [--zbits N] [--assets DIR] [--label TEXT] [--dump PREFIX]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if ( frames < 1 )
+		frames = 1;
+
+	pdhost_init();
+
+	#if ENABLE_INTERLACE
+	setInterlaceEnabled(interlace);
+	#else
+	if ( interlace )
+		fprintf(stderr, "built without ENABLE_INTERLACE; --interlace ignored\n");
+	interlace = 0;
+	#endif
+
+	#if !ENABLE_S_BUFFER
+	if ( sbuffer )
+		fprintf(stderr, "built without ENABLE_S_BUFFER; --sbuffer ignored\n");
+	sbuffer = 0;
+	#endif
+
+	#if !ENABLE_SCENE_ORDERING_TABLE
+	if ( orderTable )
+		fprintf(stderr, "built without ENABLE_SCENE_ORDERING_TABLE; --order-table ignored\n");
+	orderTable = 0;
+	#endif
+
+	#if ENABLE_Z_BUFFER
+	if ( zbits == 0 )
+		zbits = getZBufferDefaultFormat();
+
+	if ( !setZBufferFormat(zbits) )
+	{
+		fprintf(stderr, "no %d-bit z buffer in this build\n", zbits);
+		return 1;
+	}
+	#else
+	if ( zbits )
+		fprintf(stderr, "built without ENABLE_Z_BUFFER; --zbits ignored\n");
+	zbits = 0;
+	#endif
+
+	double* times = malloc(frames * sizeof(double));
+
+	printf("{\n  \"label\": \"%s\",\n", label);
+	printConfig();
+	printf("  \"interlace\": %d,\n  \"sbuffer\": %d,\n  \"order_table\": %d,\n  \"zbits\": %d,\n",
+		interlace, sbuffer, orderTable, zbits);
+	printf("  \"frames\": %d,\n  \"scenes\": {", frames);
+
+	int first = 1;
+
+	for ( int s = 0; s < benchSceneCount; ++s )
+	{
+		if ( anySelected && !selected[s] )
+			continue;
+
+		BenchScene b = { .name = benchScenes[s].name };
+		Scene3D_init(&b.scene);
+		benchScenes[s].init(&b);
+
+		#if ENABLE_S_BUFFER
+		Scene3D_setUsesSBuffer(&b.scene, sbuffer);
+		#endif
+		#if ENABLE_SCENE_ORDERING_TABLE
+		Scene3D_setOrderTableSize(&b.scene, orderTable);
+		#endif
+		#if ENABLE_Z_BUFFER
+		Scene3D_setZBufferFormat(&b.scene, zbits);
+		#endif
+
+		for ( int i = 0; i < warmup + frames; ++i )
+		{
+			b.update(&b, i);
+
+			double t0 = now();
+			benchDrawFrame(&b.scene, frame, LCD_ROWSIZE);
+			double t = now() - t0;
+
+			if ( i >= warmup )
+				times[i - warmup] = t * 1000;
+		}
+
+		if ( dump != NULL )
+		{
+			char path[512];
+			snprintf(path, sizeof(path), "%s%s.pbm", dump, b.name);
+
+			if ( pdhost_writePBM(path, frame, LCD_ROWSIZE, LCD_COLUMNS, LCD_ROWS) != 0 )
+				perror(path);
+		}
+
+		double total = 0;
+
+		for ( int i = 0; i < frames; ++i )
+			total += times[i];
+
+		qsort(times, frames, sizeof(double), compareDouble);
+
+		printf("%s\n    \"%s\": { \"min_ms\": %.4f, \"median_ms\": %.4f, \"p99_ms\": %.4f, \"max_ms\": %.4f, \"mean_ms\": %.4f }",
+			first ? "" : ",", b.name, times[0], times[frames / 2], times[(int)ceil(frames * 0.99) - 1], times[frames - 1], total / frames);
+
+		first = 0;
+		Scene3D_deinit(&b.scene);
+	}
+
+	printf("\n  }\n}\n");
+
+	free(times);
+	free(selected);
+	return 0;
+}
@@ -0,0 +1,729 @@
+//
+//  kernels.c
+//  mini3d-plus benchmarks
+//
+//  Times each of the span kernels render.c builds from render_range.inc, one at a time, by
+//  drawing triangles and quads through the public fill functions with the options that select
+//  that kernel: fillTriangle/fillQuad (flat, with or without the S-buffer), the _zbuf variants
+//  (once for each z buffer format), and the _t and _zt variants with a plain, masked (a),
+//  lit (g) or greyscale (l) texture, with and without perspective mapping (p). Kernel names
+//  follow render.c's, e.g. fillTriangle_z16tagp; "s" marks S-buffered draws.
+//
+//  Each kernel draws primitives of a range of sizes, and the time per primitive is fitted to
+//  setup + pixels * per-pixel cost, giving "setup_ns" and "ns_per_pixel". Pixels are counted
+//  once per size by drawing the same primitives flat. Every primitive is drawn in front of
+//  the ones before it, and S-buffered draws reset the S-buffer for each primitive, so only
+//  --overdraw layers are ever hidden. The output is JSON, like frames.c.
+//  Timings are from the host, so only the relative numbers mean anything for the device.
+//
+//  With TEXTURE_PERSPECTIVE_MAPPING 2 or 3 the renderer itself decides which triangles are
+//  drawn projectively, so the p kernels measure that decision as well.
+//
+//  Build and run (from the repository root):
+//      make -C host && host/build/bench_kernels
+//
+//  Options:
+//      --sizes A,B,...  bounding box sizes in pixels (default 2,4,8,16,32,64,128,224)
+//      --aspect R       width / height of the bounding box (default 1)
+//      --texture N      texture width and height (default 64)
+//      --overdraw N     draw each primitive N times, nearer each time (default 1)
+//      --scanline       draw textures on alternate rows only (ENABLE_POLYGON_SCANLINING)
+//      --kernel TEXT    only kernels whose names contain TEXT (may be repeated)
+//      --min-ms N       shortest timed run per measurement (default 5)
+//      --label TEXT     copied into the output, to tell runs apart
+//      --list           print the kernel names this build has, and exit
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "pd_host.h"
+#include "mini3d.h"
+#include "render.h"
+#include "texture.h"
+
+static uint8_t frame[LCD_ROWS * LCD_ROWSIZE];
+
+// primitives drawn per pass, spread over the screen
+#define BATCH 64
+
+#define MAX_SIZES 32
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+enum
+{
+	kDepthNone,
+	kDepthSBuffer,
+	kDepthZBuffer,
+};
+
+enum
+{
+	kTexMask = 1,		// a: texture has a mask
+	kTexLit = 2,		// g: lit, or greyscale
+	kTexGrey = 4,		// l: greyscale texture
+	kTexProjective = 8,	// p: perspective mapping
+};
+
+typedef struct
+{
+	char name[32];
+	int quad;
+	int depth;
+	int zbits;
+	int textured;
+	int tex;
+} Kernel;
+
+typedef struct
+{
+	int quad;
+	int width;
+	int height;
+	int layers;
+	float lighting;
+	float lightingWeight;
+	int projective;
+#if ENABLE_TEXTURES
+	Texture* texture;
+#endif
+#if ENABLE_POLYGON_SCANLINING
+	ScanlineFill scanline;
+#endif
+} Batch;
+
+// textures
+
+#if ENABLE_TEXTURES
+
+static int texSize = 64;
+
+// checkerboard, with a quarter of it masked out if mask is set.
+static Texture* newBitmapTexture(int mask)
+{
+	LCDBitmap* bitmap = pd->graphics->newBitmap(texSize, texSize, mask ? kColorClear : kColorBlack);
+	int rowbytes;
+	uint8_t* maskdata;
+	uint8_t* data;
+	pd->graphics->getBitmapData(bitmap, NULL, NULL, &rowbytes, &maskdata, &data);
+
+	for ( int y = 0; y < texSize; ++y )
+	{
+		for ( int x = 0; x < texSize; ++x )
+		{
+			if ( ((x / 4) ^ (y / 4)) & 1 )
+				data[y * rowbytes + x / 8] |= 0x80 >> (x % 8);
+
+			if ( mask && (((x / 8) & 1) | ((y / 8) & 1)) )
+				maskdata[y * rowbytes + x / 8] |= 0x80 >> (x % 8);
+		}
+	}
+
+	return Texture_fromLCDBitmap(bitmap);
+}
+
+#if ENABLE_TEXTURES_GREYSCALE
+// a gradient, laid out the way Texture_loadFromPath() builds greyscale textures.
+static Texture* newGreyTexture(int mask)
+{
+	void* v = m3d_malloc(sizeof(uint32_t) + sizeof(GreyBitmap) + texSize * texSize);
+	*(uint32_t*)v = 1;
+	GreyBitmap* g = v + sizeof(uint32_t);
+	uint8_t* data = (uint8_t*)(g + 1);
+
+	g->width = texSize;
+	g->height = texSize;
+	g->transparency = mask;
+
+	for ( int y = 0; y < texSize; ++y )
+	{
+		for ( int x = 0; x < texSize; ++x )
+		{
+			uint8_t t = (x + y) * LIGHTING_PATTERN_COUNT / (2 * texSize);
+
+			if ( !mask || ((x / 8) & 1) | ((y / 8) & 1) )
+				t |= 0x80;
+
+			data[y * texSize + x] = t;
+		}
+	}
+
+	return (void*)((uintptr_t)g | 1);
+}
+#endif
+
+// indexed by kTexMask | kTexGrey
+static Texture* textures[8];
+
+static Texture* kernelTexture(const Kernel* k)
+{
+	int i = k->tex & (kTexMask | kTexGrey);
+
+	if ( textures[i] == NULL )
+	{
+		#if ENABLE_TEXTURES_GREYSCALE
+		if ( i & kTexGrey )
+			textures[i] = newGreyTexture(i & kTexMask);
+		else
+		#endif
+			textures[i] = newBitmapTexture(i & kTexMask);
+	}
+
+	return textures[i];
+}
+
+static void freeTextures(void)
+{
+	for ( int i = 0; i < 8; ++i )
+	{
+		if ( textures[i] != NULL )
+			Texture_unref(textures[i]);
+
+		textures[i] = NULL;
+	}
+}
+
+#endif
+
+// kernels
+
+static Kernel kernels[256];
+static int kernelCount = 0;
+
+static void addKernel(int quad, int depth, int zbits, int textured, int tex)
+{
+	Kernel* k = &kernels[kernelCount++];
+	char suffix[16] = "";
+
+	if ( depth == kDepthSBuffer )
+		strcat(suffix, "s");
+	else if ( depth == kDepthZBuffer )
+		sprintf(suffix, "z%d", zbits);
+
+	if ( textured )
+	{
+		// same order as render_range.inc's symbols
+		strcat(suffix, "t");
+		if ( tex & kTexMask ) strcat(suffix, "a");
+		if ( tex & kTexLit ) strcat(suffix, "g");
+		if ( tex & kTexProjective ) strcat(suffix, "p");
+		if ( tex & kTexGrey ) strcat(suffix, "l");
+	}
+
+	snprintf(k->name, sizeof(k->name), "%s%s%s", quad ? "fillQuad" : "fillTriangle", suffix[0] ? "_" : "", suffix);
+	k->quad = quad;
+	k->depth = depth;
+	k->zbits = zbits;
+	k->textured = textured;
+	k->tex = tex;
+}
+
+static void addTexturedKernels(int quad, int depth, int zbits)
+{
+#if ENABLE_TEXTURES
+	for ( int tex = 0; tex < 16; ++tex )
+	{
+		#if !ENABLE_TEXTURES_MASK
+		if ( tex & kTexMask ) continue;
+		#endif
+		#if !ENABLE_TEXTURES_GREYSCALE
+		if ( tex & (kTexLit | kTexGrey) ) continue;
+		#endif
+		#if !TEXTURE_PERSPECTIVE_MAPPING
+		if ( tex & kTexProjective ) continue;
+		#endif
+
+		// greyscale textures always take the lit path
+		if ( (tex & kTexGrey) && !(tex & kTexLit) )
+			continue;
+
+		addKernel(quad, depth, zbits, 1, tex);
+	}
+#endif
+}
+
+static void listKernels(void)
+{
+	for ( int quad = 0; quad < 2; ++quad )
+	{
+		addKernel(quad, kDepthNone, 0, 0, 0);
+		addTexturedKernels(quad, kDepthNone, 0);
+
+		#if ENABLE_S_BUFFER
+		addKernel(quad, kDepthSBuffer, 0, 0, 0);
+		addTexturedKernels(quad, kDepthSBuffer, 0);
+		#endif
+
+		#if ENABLE_Z_BUFFER
+		for ( int zbits = 8; zbits <= 32; zbits *= 2 )
+		{
+			if ( !setZBufferFormat(zbits) )
+				continue;
+
+			addKernel(quad, kDepthZBuffer, zbits, 0, 0);
+			addTexturedKernels(quad, kDepthZBuffer, zbits);
+		}
+
+		setZBufferFormat(getZBufferDefaultFormat());
+		#endif
+	}
+}
+
+// drawing
+
+static uint8_t black[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+
+// how far the back of a primitive is behind its front
+#define PRIMITIVE_DEPTH 2
+
+// the i'th primitive of a pass, at depth z
+static void primitivePoints(const Batch* b, int i, float z, Point3D* p)
+{
+	// spread over the screen without lining up with the 8-pixel rows
+	float x = VIEWPORT_LEFT + (i * 97) % MAX(1, VIEWPORT_WIDTH - b->width - 1);
+	float y = VIEWPORT_TOP + (i * 53) % MAX(1, VIEWPORT_HEIGHT - b->height - 1);
+	float w = b->width;
+	float h = b->height;
+
+	if ( b->quad )
+	{
+		p[0] = Point3DMake(x + 0.1f * w, y, z);
+		p[1] = Point3DMake(x + w, y + 0.1f * h, z + PRIMITIVE_DEPTH / 2);
+		p[2] = Point3DMake(x + 0.9f * w, y + h, z + PRIMITIVE_DEPTH);
+		p[3] = Point3DMake(x, y + 0.9f * h, z + PRIMITIVE_DEPTH / 2);
+	}
+	else
+	{
+		p[0] = Point3DMake(x + 0.2f * w, y, z);
+		p[1] = Point3DMake(x + w, y + 0.6f * h, z + PRIMITIVE_DEPTH / 2);
+		p[2] = Point3DMake(x, y + h, z + PRIMITIVE_DEPTH);
+	}
+}
+
+static void drawPrimitive(const Kernel* k, Batch* b, Point3D* p)
+{
+#if ENABLE_TEXTURES
+	static const Point2D t[4] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 } };
+
+	if ( k->textured )
+	{
+		#define TEXTURE_ARGS(...) b->texture, __VA_ARGS__ \
+			OPT_PATTERN OPT_SCANLINE OPT_LIGHTING OPT_PROJECTIVE
+
+		#if ENABLE_CUSTOM_PATTERNS
+			#define OPT_PATTERN , &patterns
+		#else
+			#define OPT_PATTERN
+		#endif
+		#if ENABLE_POLYGON_SCANLINING
+			#define OPT_SCANLINE , &b->scanline
+		#else
+			#define OPT_SCANLINE
+		#endif
+		#if ENABLE_TEXTURES_GREYSCALE
+			#define OPT_LIGHTING , b->lighting, b->lightingWeight
+		#else
+			#define OPT_LIGHTING
+		#endif
+		#if TEXTURE_PERSPECTIVE_MAPPING
+			#define OPT_PROJECTIVE , b->projective
+		#else
+			#define OPT_PROJECTIVE
+		#endif
+
+		#if ENABLE_Z_BUFFER
+		if ( k->depth == kDepthZBuffer )
+		{
+			if ( b->quad )
+				fillQuad_zt(frame, LCD_ROWSIZE, &p[0], &p[1], &p[2], &p[3], TEXTURE_ARGS(t[0], t[1], t[2], t[3]));
+			else
+				fillTriangle_zt(frame, LCD_ROWSIZE, &p[0], &p[1], &p[2], TEXTURE_ARGS(t[0], t[1], t[2]));
+
+			return;
+		}
+		#endif
+
+		if ( b->quad )
+			fillQuad_t(frame, LCD_ROWSIZE, &p[0], &p[1], &p[2], &p[3], TEXTURE_ARGS(t[0], t[1], t[2], t[3]));
+		else
+			fillTriangle_t(frame, LCD_ROWSIZE, &p[0], &p[1], &p[2], TEXTURE_ARGS(t[0], t[1], t[2]));
+
+		#undef TEXTURE_ARGS
+		#undef OPT_PATTERN
+		#undef OPT_SCANLINE
+		#undef OPT_LIGHTING
+		#undef OPT_PROJECTIVE
+		return;
+	}
+#endif
+
+#if ENABLE_Z_BUFFER
+	if ( k->depth == kDepthZBuffer )
+	{
+		if ( b->quad )
+			fillQuad_zbuf(frame, LCD_ROWSIZE, &p[0], &p[1], &p[2], &p[3], black);
+		else
+			fillTriangle_zbuf(frame, LCD_ROWSIZE, &p[0], &p[1], &p[2], black);
+
+		return;
+	}
+#endif
+
+	if ( b->quad )
+		fillQuad(frame, LCD_ROWSIZE, &p[0], &p[1], &p[2], &p[3], black);
+	else
+		fillTriangle(frame, LCD_ROWSIZE, &p[0], &p[1], &p[2], black);
+}
+
+static void resetBuffers(const Kernel* k)
+{
+	#if ENABLE_Z_BUFFER
+	if ( k->depth == kDepthZBuffer )
+		resetZBuffer();
+	#endif
+
+	#if ENABLE_S_BUFFER
+	if ( k->depth == kDepthSBuffer )
+		resetSBuffer();
+	#endif
+}
+
+// draws `passes` passes of BATCH primitives (times the layers) and returns the time the drawing took.
+static double drawPasses(const Kernel* k, Batch* b, int passes)
+{
+	Point3D p[4];
+	double total = 0;
+
+	for ( int n = 0; n < passes; ++n )
+	{
+		resetBuffers(k);
+
+		double t0 = now();
+
+		for ( int i = 0; i < BATCH; ++i )
+		{
+			// (only a primitive's own layers hide each other in the S-buffer.)
+			#if ENABLE_S_BUFFER
+			if ( k->depth == kDepthSBuffer )
+				resetSBuffer();
+			#endif
+
+			for ( int layer = 0; layer < b->layers; ++layer )
+			{
+				// each primitive is wholly in front of the ones before it, so the z test always passes
+				int n = i * b->layers + layer;
+				primitivePoints(b, i, 2 + PRIMITIVE_DEPTH * (BATCH * b->layers - n), p);
+				drawPrimitive(k, b, p);
+			}
+		}
+
+		total += now() - t0;
+	}
+
+	return total;
+}
+
+// pixels covered by one primitive of the batch, found by filling each of them flat on white.
+static double pixelsPerPrimitive(Batch* b)
+{
+	Kernel flat = { .quad = b->quad, .depth = kDepthNone };
+	long count = 0;
+
+	#if ENABLE_S_BUFFER
+	setSBufferEnabled(0);
+	#endif
+
+	for ( int i = 0; i < BATCH; ++i )
+	{
+		Point3D p[4];
+		memset(frame, 0xff, sizeof(frame));
+		primitivePoints(b, i, 2, p);
+		drawPrimitive(&flat, b, p);
+
+		for ( size_t j = 0; j < sizeof(frame); ++j )
+			count += 8 - __builtin_popcount(frame[j]);
+	}
+
+	return (double)count / BATCH;
+}
+
+static double minTime = 0.005;
+
+// nanoseconds per primitive drawn
+static double timeKernel(const Kernel* k, Batch* b)
+{
+	#if ENABLE_Z_BUFFER
+	if ( k->depth == kDepthZBuffer )
+		setZBufferFormat(k->zbits);
+	#endif
+
+	#if ENABLE_S_BUFFER
+	setSBufferEnabled(k->depth == kDepthSBuffer);
+	#endif
+
+	int passes = 1;
+
+	while ( drawPasses(k, b, passes) < minTime && passes < (1 << 20) )
+		passes *= 2;
+
+	double best = drawPasses(k, b, passes);
+
+	for ( int i = 0; i < 2; ++i )
+	{
+		double t = drawPasses(k, b, passes);
+
+		if ( t < best )
+			best = t;
+	}
+
+	return best * 1e9 / ((double)passes * BATCH * b->layers);
+}
+
+static void printConfig(void)
+{
+	#define CONFIG(x) { #x, (int)(x) }
+	static const struct { const char* name; int value; } config[] = {
+		CONFIG(ENABLE_Z_BUFFER),
+		CONFIG(ENABLE_S_BUFFER),
+		CONFIG(ENABLE_CUSTOM_PATTERNS),
+		CONFIG(ENABLE_TEXTURES),
+		CONFIG(ENABLE_TEXTURES_MASK),
+		CONFIG(ENABLE_TEXTURES_GREYSCALE),
+		CONFIG(ENABLE_TEXTURES_LIGHTING),
+		CONFIG(TEXTURES_ALWAYS_SQUARE),
+		CONFIG(TEXTURE_PERSPECTIVE_MAPPING),
+		CONFIG(TEXTURE_PERSPECTIVE_MAPPING_SPLIT),
+		CONFIG(PRECOMPUTE_PROJECTION),
+		CONFIG(ENABLE_POLYGON_SCANLINING),
+		CONFIG(ENABLE_INTERLACE),
+		CONFIG(Z_BUFFER_FRAME_PARITY),
+		CONFIG(Z_BUFFER_LAZY_CLEAR),
+		CONFIG(ENABLE_DISTANCE_FOG),
+		CONFIG(ENABLE_ZRENDERSKIP),
+	};
+	#undef CONFIG
+
+	printf("  \"config\": {");
+
+	for ( size_t i = 0; i < sizeof(config) / sizeof(config[0]); ++i )
+		printf("%s\n    \"%s\": %d", i ? "," : "", config[i].name, config[i].value);
+
+	printf("\n  },\n");
+}
+
+static int parseSizes(const char* s, int* sizes)
+{
+	int n = 0;
+
+	while ( *s != '\0' && n < MAX_SIZES )
+	{
+		char* end;
+		long v = strtol(s, &end, 10);
+
+		if ( end == s || v < 1 )
+			return 0;
+
+		sizes[n++] = v;
+		s = (*end == ',') ? end + 1 : end;
+	}
+
+	return n;
+}
+
+int main(int argc, char** argv)
+{
+	int sizes[MAX_SIZES] = { 2, 4, 8, 16, 32, 64, 128, 224 };
+	int sizeCount = 8;
+	float aspect = 1;
+	int overdraw = 1;
+	int scanline = 0;
+	int list = 0;
+	const char* label = "";
+	const char* filters[16];
+	int filterCount = 0;
+
+	for ( int i = 1; i < argc; ++i )
+	{
+		if ( strcmp(argv[i], "--sizes") == 0 && i + 1 < argc )
+		{
+			if ( (sizeCount = parseSizes(argv[++i], sizes)) == 0 )
+			{
+				fprintf(stderr, "bad --sizes list: %s\n", argv[i]);
+				return 1;
+			}
+		}
+		else if ( strcmp(argv[i], "--aspect") == 0 && i + 1 < argc )
+			aspect = atof(argv[++i]);
+		else if ( strcmp(argv[i], "--texture") == 0 && i + 1 < argc )
+		{
+			#if ENABLE_TEXTURES
+			texSize = atoi(argv[i + 1]);
+			#endif
+			++i;
+		}
+		else if ( strcmp(argv[i], "--overdraw") == 0 && i + 1 < argc )
+			overdraw = atoi(argv[++i]);
+		else if ( strcmp(argv[i], "--scanline") == 0 )
+			scanline = 1;
+		else if ( strcmp(argv[i], "--kernel") == 0 && i + 1 < argc && filterCount < 16 )
+			filters[filterCount++] = argv[++i];
+		else if ( strcmp(argv[i], "--min-ms") == 0 && i + 1 < argc )
+			minTime = atof(argv[++i]) / 1000;
+		else if ( strcmp(argv[i], "--label") == 0 && i + 1 < argc )
+			label = argv[++i];
+		else if ( strcmp(argv[i], "--list") == 0 )
+			list = 1;
+		else
+		{
+			fprintf(stderr, "usage: %s [--sizes A,B,...] [--aspect R] [--texture N] [--overdraw N] [--scanline] [--kernel TEXT]... [--min-ms N] [--label TEXT] [--list]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if ( aspect <= 0 )
+		aspect = 1;
+
+	if ( overdraw < 1 )
+		overdraw = 1;
+
+	#if ENABLE_TEXTURES
+	if ( texSize < 8 )
+		texSize = 8;
+	#endif
+
+	pdhost_init();
+	resetZScale(1);
+
+	#if ENABLE_POLYGON_SCANLINING
+	if ( scanline )
+		fprintf(stderr, "drawing textures on even rows only\n");
+	#else
+	if ( scanline )
+		fprintf(stderr, "built without ENABLE_POLYGON_SCANLINING; --scanline ignored\n");
+	scanline = 0;
+	#endif
+
+	listKernels();
+
+	if ( list )
+	{
+		for ( int i = 0; i < kernelCount; ++i )
+			printf("%s\n", kernels[i].name);
+
+		return 0;
+	}
+
+	printf("{\n  \"label\": \"%s\",\n", label);
+	printConfig();
+	printf("  \"aspect\": %g,\n  \"texture\": %d,\n  \"overdraw\": %d,\n  \"scanline\": %d,\n  \"kernels\": {",
+		aspect,
+		#if ENABLE_TEXTURES
+		texSize,
+		#else
+		0,
+		#endif
+		overdraw, scanline);
+
+	double pixels[2][MAX_SIZES];
+	int first = 1;
+
+	for ( int quad = 0; quad < 2; ++quad )
+	{
+		for ( int s = 0; s < sizeCount; ++s )
+		{
+			Batch b = {
+				.quad = quad,
+				.width = MIN(VIEWPORT_WIDTH - 2, MAX(1, (int)(sizes[s] * sqrtf(aspect)))),
+				.height = MIN(VIEWPORT_HEIGHT - 2, MAX(1, (int)(sizes[s] / sqrtf(aspect)))),
+				.layers = 1,
+			};
+
+			pixels[quad][s] = pixelsPerPrimitive(&b);
+		}
+	}
+
+	for ( int k = 0; k < kernelCount; ++k )
+	{
+		Kernel* kernel = &kernels[k];
+		int selected = (filterCount == 0);
+
+		for ( int f = 0; f < filterCount; ++f )
+			selected |= (strstr(kernel->name, filters[f]) != NULL);
+
+		if ( !selected )
+			continue;
+
+		double ns[MAX_SIZES];
+
+		for ( int s = 0; s < sizeCount; ++s )
+		{
+			Batch b = {
+				.quad = kernel->quad,
+				.width = MIN(VIEWPORT_WIDTH - 2, MAX(1, (int)(sizes[s] * sqrtf(aspect)))),
+				.height = MIN(VIEWPORT_HEIGHT - 2, MAX(1, (int)(sizes[s] / sqrtf(aspect)))),
+				.layers = overdraw,
+				.lighting = 0.5f,
+				.lightingWeight = (kernel->tex & kTexLit) && !(kernel->tex & kTexGrey) ? 0.5f : 0,
+				.projective = (kernel->tex & kTexProjective) != 0,
+			};
+
+			#if ENABLE_TEXTURES
+			if ( kernel->textured )
+				b.texture = kernelTexture(kernel);
+			#endif
+
+			#if ENABLE_POLYGON_SCANLINING
+			b.scanline.select = scanline ? kScanlineEven : kScanlineAll;
+			b.scanline.fill = 0xAAAAAAAA;
+			#endif
+
+			ns[s] = timeKernel(kernel, &b);
+		}
+
+		// least squares fit of ns = setup + pixels * perPixel, weighted by 1/ns^2 so that the
+		// small sizes decide the setup cost and the large ones the per-pixel cost
+		double sw = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+
+		for ( int s = 0; s < sizeCount; ++s )
+		{
+			double x = pixels[kernel->quad][s];
+			double w = 1 / (ns[s] * ns[s]);
+			sw += w;
+			sx += w * x;
+			sy += w * ns[s];
+			sxx += w * x * x;
+			sxy += w * x * ns[s];
+		}
+
+		double d = sw * sxx - sx * sx;
+		double perPixel = (d != 0) ? (sw * sxy - sx * sy) / d : 0;
+		double setup = (sy - perPixel * sx) / sw;
+
+		printf("%s\n    \"%s\": {\n      \"setup_ns\": %.2f, \"ns_per_pixel\": %.3f,\n      \"sizes\": [",
+			first ? "" : ",", kernel->name, setup, perPixel);
+
+		for ( int s = 0; s < sizeCount; ++s )
+			printf("%s\n        { \"size\": %d, \"pixels\": %.1f, \"ns\": %.1f }", s ? "," : "", sizes[s], pixels[kernel->quad][s], ns[s]);
+
+		printf("\n      ]\n    }");
+		fflush(stdout);
+		first = 0;
+	}
+
+	printf("\n  }\n}\n");
+
+	#if ENABLE_TEXTURES
+	freeTextures();
+	#endif
+
+	return 0;
+}
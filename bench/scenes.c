@@ -0,0 +1,789 @@
+//
+//  scenes.c
+//  mini3d-plus benchmarks
+//
+//  The demo scenes from Source/*.lua (kart, knot, icosahedra, ztest), built in C for the host
+//  programs. See scenes.h.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "scenes.h"
+#include "shape.h"
+#include "render.h"
+#include "imposter.h"
+#include "pattern.h"
+
+const char* benchAssetDir = "Source/assets";
+
+// lib3d.matrix.newRotation()
+static Matrix3D rotation(float angle, float x, float y, float z)
+{
+	float c = cosf(angle * (float)M_PI / 180);
+	float s = sinf(angle * (float)M_PI / 180);
+	float d = 1 / sqrtf(x * x + y * y + z * z);
+
+	x *= d;
+	y *= d;
+	z *= d;
+
+	return Matrix3DMake(
+		c + x * x * (1-c), x * y * (1-c) - z * s, x * z * (1-c) + y * s,
+		y * x * (1-c) + z * s, c + y * y * (1-c), y * z * (1-c) - x * s,
+		z * x * (1-c) - y * s, z * y * (1-c) + x * s, c + z * z * (1-c),
+		0
+	);
+}
+
+static Shape3D* newShape(void)
+{
+	Shape3D* shape = m3d_malloc(sizeof(Shape3D));
+	Shape3D_init(shape);
+	return shape;
+}
+
+// scene:setWireframeMode() / setWireframeColor() / setFilled()
+static void setWireframe(Scene3DNode* node, int mode, int white, int filled)
+{
+	RenderStyle style = filled ? kRenderFilled : 0;
+
+	if ( mode > 0 )
+		style |= kRenderWireframe | ((mode == 2) ? kRenderWireframeBack : 0);
+
+	if ( white )
+		style |= kRenderWireframeWhite;
+
+	Scene3DNode_setRenderStyle(node, style);
+}
+
+// the camera looks at the origin from origin turned about the y axis, once every 600 frames.
+// (the Lua demos leave "up" as the z axis, which is the way they look; y is used here instead.)
+static void orbitCamera(Scene3D* scene, Point3D origin, int frame)
+{
+	float a = frame * 2 * (float)M_PI / 600;
+	Point3D p = Point3DMake(origin.x * cosf(a) + origin.z * sinf(a), origin.y, origin.z * cosf(a) - origin.x * sinf(a));
+	Scene3D_setCamera(scene, p, Point3DMake(0, 0, 0), 1, Vector3DMake(0, 1, 0));
+}
+
+// icosahedra.lua
+
+static Matrix3D icoRot;
+
+static void icosahedraUpdate(BenchScene* b, int frame)
+{
+	Scene3DNode_addTransform(Scene3D_getRootNode(&b->scene), &icoRot);
+	orbitCamera(&b->scene, Point3DMake(0, 0, -4), frame);
+}
+
+static void icosahedraInit(BenchScene* b)
+{
+	float p = (sqrtf(5) - 1) / 2;
+
+	Point3D x1 = Point3DMake(0, -p, 1), x2 = Point3DMake(0, p, 1), x3 = Point3DMake(0, p, -1), x4 = Point3DMake(0, -p, -1);
+	Point3D y1 = Point3DMake(1, 0, p), y2 = Point3DMake(1, 0, -p), y3 = Point3DMake(-1, 0, -p), y4 = Point3DMake(-1, 0, p);
+	Point3D z1 = Point3DMake(-p, 1, 0), z2 = Point3DMake(p, 1, 0), z3 = Point3DMake(p, -1, 0), z4 = Point3DMake(-p, -1, 0);
+
+	Point3D* faces[20][3] = {
+		{ &z1, &y3, &y4 }, { &z1, &x3, &y3 }, { &z1, &z2, &x3 }, { &z1, &x2, &z2 }, { &z1, &y4, &x2 },
+		{ &y4, &y3, &z4 }, { &z4, &y3, &x4 }, { &y3, &x3, &x4 }, { &x4, &x3, &y2 }, { &x3, &z2, &y2 },
+		{ &y2, &z2, &y1 }, { &z2, &x2, &y1 }, { &y1, &x2, &x1 }, { &x2, &y4, &x1 }, { &x1, &y4, &z4 },
+		{ &z3, &y2, &y1 }, { &z3, &y1, &x1 }, { &z3, &x1, &z4 }, { &z3, &z4, &x4 }, { &z3, &x4, &y2 }
+	};
+
+	Shape3D* shape = newShape();
+
+	for ( int i = 0; i < 20; ++i )
+		Shape3D_addFace(shape, faces[i][0], faces[i][1], faces[i][2], NULL, 0);
+
+	Shape3D_setClosed(shape, 1);
+
+	Scene3D* scene = &b->scene;
+	Scene3D_setGlobalLight(scene, Vector3DMake(0.2f, 0.8f, 0.4f));
+
+	Scene3DNode* n = Scene3D_getRootNode(scene);
+
+	static const struct { float x, y, z, bias; int mode, white, filled; } copies[6] = {
+		{ 2, 0, 0, 0, 0, 0, 1 },
+		{ -2, 0, 0, 0.8f, 0, 0, 1 },
+		{ 0, 2, 0, 0, 2, 1, 0 },
+		{ 0, -2, 0, 0, 1, 1, 0 },
+		{ 0, 0, 2, 0.8f, 2, 0, 1 },
+		{ 0, 0, -2, -0.8f, 1, 1, 1 },
+	};
+
+	for ( int i = 0; i < 6; ++i )
+	{
+		Scene3DNode* child = Scene3DNode_newChild(n);
+		Scene3DNode_addShapeWithOffset(child, shape, Vector3DMake(copies[i].x, copies[i].y, copies[i].z));
+		Scene3DNode_setColorBias(child, copies[i].bias);
+		setWireframe(child, copies[i].mode, copies[i].white, copies[i].filled);
+	}
+
+	// rot2, then rot1
+	icoRot = Matrix3D_multiply(rotation(3, 0, 1, 0), rotation(5, 0, 0, 1));
+	b->update = icosahedraUpdate;
+}
+
+// knot.lua
+
+static void knotCurve(float t, float* p)
+{
+	t *= 2 * (float)M_PI;
+	p[0] = (sinf(t) + 2 * sinf(2 * t)) / 3;
+	p[1] = (cosf(t) - 2 * cosf(2 * t)) / 3;
+	p[2] = sinf(3 * t) / 2;
+}
+
+static void torusCurve(float t, float* p)
+{
+	t *= 2 * (float)M_PI;
+	p[0] = sinf(t);
+	p[1] = cosf(t);
+	p[2] = 0;
+}
+
+static float checkerColor(int i, int j)
+{
+	// (j is 1-based in the Lua version)
+	return (i + j + 1) % 2 - 0.5f;
+}
+
+#define TUBE_MAX_SPOKES 16
+
+// makeShape() from knot.lua
+static Shape3D* newTube(void (*f)(float t, float* p), int steps, int spokes, float thickness, float (*color)(int i, int j), int quad)
+{
+	Shape3D* shape = newShape();
+	Point3D first[TUBE_MAX_SPOKES], prev[TUBE_MAX_SPOKES], ring[TUBE_MAX_SPOKES];
+
+	for ( int step = 0; step <= steps; ++step )
+	{
+		if ( step < steps )
+		{
+			float t = (float)step / steps;
+			float c[3], m[3], p[3];
+			f(t, c);
+			f(t - 0.01f, m);
+			f(t + 0.01f, p);
+
+			float vx = p[0] - m[0], vy = p[1] - m[1], vz = p[2] - m[2];
+			float s = sqrtf(vx * vx + vy * vy + vz * vz);
+			vx /= s;
+			vy /= s;
+			vz /= s;
+
+			float r = sqrtf(vx * vx + vy * vy);
+
+			for ( int i = 0; i < spokes; ++i )
+			{
+				float st = 2 * (float)M_PI * (i + (quad ? 0 : (step % 2) / 2.0f)) / spokes;
+				ring[i] = Point3DMake(
+					c[0] - thickness * (sinf(st) * vy + cosf(st) * vx * vz) / r,
+					c[1] + thickness * (sinf(st) * vx - cosf(st) * vy * vz) / r,
+					c[2] + thickness * cosf(st) * r
+				);
+			}
+		}
+		else
+			memcpy(ring, first, sizeof(ring));
+
+		if ( step == 0 )
+			memcpy(first, ring, sizeof(ring));
+		else
+		{
+			int s = step - 1;
+
+			for ( int i = 0; i < spokes; ++i )
+			{
+				int j = (i + 1) % spokes;
+
+				if ( quad )
+					Shape3D_addFace(shape, &prev[i], &ring[i], &ring[j], &prev[j], color ? color(s, i) : 0);
+				else
+				{
+					float c1 = color ? color(2 * s, i) : 0;
+					float c2 = color ? color(2 * s + 1, i) : 0;
+
+					if ( s % 2 == 0 )
+					{
+						Shape3D_addFace(shape, &prev[i], &ring[i], &prev[j], NULL, c1);
+						Shape3D_addFace(shape, &ring[i], &ring[j], &prev[j], NULL, c2);
+					}
+					else
+					{
+						Shape3D_addFace(shape, &prev[i], &ring[i], &ring[j], NULL, c2);
+						Shape3D_addFace(shape, &prev[i], &ring[j], &prev[j], NULL, c1);
+					}
+				}
+			}
+		}
+
+		memcpy(prev, ring, sizeof(ring));
+	}
+
+	Shape3D_setClosed(shape, 1);
+	return shape;
+}
+
+typedef struct
+{
+	Scene3DNode* n1;
+	Scene3DNode* n2;
+	Matrix3D rot1;
+	Matrix3D rot2;
+} KnotScene;
+
+static void knotUpdate(BenchScene* b, int frame)
+{
+	KnotScene* k = b->data;
+
+	Scene3DNode_addTransform(k->n1, &k->rot1);
+	Scene3DNode_addTransform(k->n2, &k->rot2);
+	orbitCamera(&b->scene, Point3DMake(0, 0, -4), frame);
+}
+
+static void knotInit(BenchScene* b)
+{
+	static KnotScene k;
+	Scene3D* scene = &b->scene;
+	Scene3D_setGlobalLight(scene, Vector3DMake(0.2f, 0.8f, 0.4f));
+
+	k.n1 = Scene3DNode_newChild(Scene3D_getRootNode(scene));
+	Scene3DNode_addShape(k.n1, newTube(knotCurve, 48, 12, 0.45f, NULL, 0));
+	setWireframe(k.n1, 1, 1, 1);
+	Scene3DNode_setColorBias(k.n1, -1);
+
+	k.n2 = Scene3DNode_newChild(Scene3D_getRootNode(scene));
+	Scene3DNode_addShape(k.n2, newTube(torusCurve, 16, 16, 0.5f, checkerColor, 1));
+
+	k.rot1 = rotation(2, 0, 1, 1);
+	k.rot2 = rotation(1, 1, 1, 0);
+
+	b->data = &k;
+	b->update = knotUpdate;
+}
+
+// ztest.lua
+
+typedef struct
+{
+	Scene3DNode* n2;
+	Matrix3D rot;
+} ZTestScene;
+
+static void ztestUpdate(BenchScene* b, int frame)
+{
+	ZTestScene* z = b->data;
+
+	// (the demo rolls the scene with the arrow buttons; here it rocks back and forth.)
+	Matrix3D roll = rotation(60 * sinf(frame * 0.02f), 1, 0, 0);
+	Scene3DNode_setTransform(Scene3D_getRootNode(&b->scene), &roll);
+	Scene3DNode_addTransform(z->n2, &z->rot);
+	orbitCamera(&b->scene, Point3DMake(0, 0, 4), frame);
+}
+
+static void ztestInit(BenchScene* b)
+{
+	static ZTestScene z;
+	Scene3D* scene = &b->scene;
+	Scene3D_setGlobalLight(scene, Vector3DMake(0.2f, 0.8f, 0.4f));
+
+	Scene3DNode* n = Scene3D_getRootNode(scene);
+
+	Point3D a[4] = { Point3DMake(-2, -2, 0), Point3DMake(2, -2, 0), Point3DMake(2, 2, 0), Point3DMake(-2, 2, 0) };
+	Shape3D* square1 = newShape();
+	Shape3D_addFace(square1, &a[0], &a[1], &a[2], &a[3], 0);
+	Scene3DNode_addShape(Scene3DNode_newChild(n), square1);
+
+	Point3D c[4] = { Point3DMake(-1, -1, 0), Point3DMake(1, -1, 0), Point3DMake(1, 1, 0), Point3DMake(-1, 1, 0) };
+	Shape3D* square2 = newShape();
+	Shape3D_addFace(square2, &c[0], &c[1], &c[2], &c[3], -0.5f);
+	z.n2 = Scene3DNode_newChild(n);
+	Scene3DNode_addShape(z.n2, square2);
+
+	z.rot = rotation(1, 0, 1, 0);
+
+	b->data = &z;
+	b->update = ztestUpdate;
+}
+
+// kart.lua: the track, with karts driven along its path instead of by the physics.
+
+// just enough JSON for track.json
+typedef struct
+{
+	const char* p;
+	int error;
+} JSONReader;
+
+static void json_skipSpace(JSONReader* r)
+{
+	while ( *r->p == ' ' || *r->p == '\n' || *r->p == '\r' || *r->p == '\t' )
+		++r->p;
+}
+
+static int json_accept(JSONReader* r, char c)
+{
+	json_skipSpace(r);
+
+	if ( *r->p != c )
+		return 0;
+
+	++r->p;
+	return 1;
+}
+
+static void json_expect(JSONReader* r, char c)
+{
+	if ( !json_accept(r, c) )
+		r->error = 1;
+}
+
+static float json_number(JSONReader* r)
+{
+	json_skipSpace(r);
+	char* end;
+	float f = strtof(r->p, &end);
+
+	if ( end == r->p )
+		r->error = 1;
+
+	r->p = end;
+	return f;
+}
+
+static void json_key(JSONReader* r, char* key, int size)
+{
+	json_expect(r, '"');
+	int n = 0;
+
+	while ( *r->p != '"' && *r->p != '\0' )
+	{
+		if ( n < size - 1 )
+			key[n++] = *r->p;
+		++r->p;
+	}
+
+	key[n] = '\0';
+	json_expect(r, '"');
+	json_expect(r, ':');
+}
+
+static void json_skipValue(JSONReader* r)
+{
+	json_skipSpace(r);
+	int depth = 0;
+
+	do
+	{
+		char c = *r->p;
+
+		if ( c == '\0' )
+		{
+			r->error = 1;
+			return;
+		}
+
+		if ( c == '[' || c == '{' )
+			++depth;
+		else if ( c == ']' || c == '}' )
+			--depth;
+		else if ( c == '"' )
+			while ( *++r->p != '"' && *r->p != '\0' )
+				;
+
+		++r->p;
+		json_skipSpace(r);
+	}
+	while ( depth > 0 || (*r->p != ',' && *r->p != ']' && *r->p != '}') );
+}
+
+// reads a list of faces (each a list of 3 or 4 [x, y, z]) into shape, with the texture
+// mapped once across each face.
+static void json_faces(JSONReader* r, Shape3D* shape, float colorBias)
+{
+	json_expect(r, '[');
+
+	while ( !r->error && !json_accept(r, ']') )
+	{
+		Point3D p[4];
+		int n = 0;
+
+		json_expect(r, '[');
+
+		while ( !r->error && !json_accept(r, ']') )
+		{
+			json_expect(r, '[');
+			float x = json_number(r);
+			json_expect(r, ',');
+			float y = json_number(r);
+			json_expect(r, ',');
+			float z = json_number(r);
+			json_expect(r, ']');
+
+			if ( n < 4 )
+				p[n++] = Point3DMake(x, y, z);
+
+			json_accept(r, ',');
+		}
+
+		if ( n >= 3 )
+		{
+			size_t f = Shape3D_addFace(shape, &p[0], &p[1], &p[2], (n == 4) ? &p[3] : NULL, colorBias);
+			#if ENABLE_TEXTURES
+			Shape3D_setFaceTextureMap(shape, f, (Point2D){ 0, 0 }, (Point2D){ 1, 0 }, (Point2D){ 1, 1 }, (Point2D){ 0, 1 });
+			#else
+			(void)f;
+			#endif
+		}
+
+		json_accept(r, ',');
+	}
+}
+
+#define KART_PATH_MAX 64
+#define KART_COUNT 5
+
+typedef struct
+{
+	// the middle of each path node, in the order they're driven through
+	Point3D path[KART_PATH_MAX];
+	float length[KART_PATH_MAX]; // distance from path[0] to each
+	int n;
+
+	Scene3DNode* karts[KART_COUNT];
+} KartScene;
+
+// path is the indices of the path nodes to use, in order, and their centres.
+static int json_path(JSONReader* r, Point3D* centres, int* next, int max)
+{
+	int n = 0;
+	json_expect(r, '[');
+
+	while ( !r->error && !json_accept(r, ']') )
+	{
+		float v[6] = { 0 };
+		int nx = -1;
+		char key[8];
+
+		json_expect(r, '{');
+
+		while ( !r->error && !json_accept(r, '}') )
+		{
+			json_key(r, key, sizeof(key));
+
+			static const char* coords[6] = { "x1", "y1", "z1", "x2", "y2", "z2" };
+			int c = 0;
+
+			while ( c < 6 && strcmp(key, coords[c]) != 0 )
+				++c;
+
+			if ( c < 6 )
+				v[c] = json_number(r);
+			else if ( strcmp(key, "next") == 0 )
+			{
+				// (the first of them; these are 1-based, as in Lua)
+				json_expect(r, '[');
+				nx = (int)json_number(r) - 1;
+				while ( !r->error && !json_accept(r, ']') )
+					json_skipValue(r), json_accept(r, ',');
+			}
+			else
+				json_skipValue(r);
+
+			json_accept(r, ',');
+		}
+
+		if ( n < max )
+		{
+			centres[n] = Point3DMake((v[0] + v[3]) / 2, (v[1] + v[4]) / 2, (v[2] + v[5]) / 2);
+			next[n] = nx;
+			++n;
+		}
+
+		json_accept(r, ',');
+	}
+
+	return n;
+}
+
+static int loadTrack(KartScene* k, Shape3D* terrain, Shape3D* banner)
+{
+	char path[512];
+	snprintf(path, sizeof(path), "%s/track.json", benchAssetDir);
+
+	FILE* file = fopen(path, "rb");
+
+	if ( file == NULL )
+	{
+		perror(path);
+		return 0;
+	}
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	char* text = malloc(size + 1);
+	text[fread(text, 1, size, file)] = '\0';
+	fclose(file);
+
+	JSONReader r = { text, 0 };
+	Point3D centres[KART_PATH_MAX];
+	int next[KART_PATH_MAX];
+	int nnodes = 0;
+	char key[16];
+
+	json_expect(&r, '{');
+
+	while ( !r.error && !json_accept(&r, '}') )
+	{
+		json_key(&r, key, sizeof(key));
+
+		if ( strcmp(key, "course") == 0 )
+			json_faces(&r, terrain, 0.2f);
+		else if ( strcmp(key, "banner") == 0 )
+			json_faces(&r, banner, 0);
+		else if ( strcmp(key, "path") == 0 )
+			nnodes = json_path(&r, centres, next, KART_PATH_MAX);
+		else
+			json_skipValue(&r);
+
+		json_accept(&r, ',');
+	}
+
+	free(text);
+
+	if ( r.error )
+	{
+		fprintf(stderr, "%s: can't read this\n", path);
+		return 0;
+	}
+
+	// follow the first "next" of each node around the track, starting from the first
+	// node with a position (which is where the karts start in kart.lua).
+	k->n = 0;
+
+	for ( int i = 0; i >= 0 && i < nnodes && k->n < KART_PATH_MAX; i = next[i] )
+	{
+		if ( k->n > 0 && i == 0 )
+			break;
+
+		k->path[k->n] = centres[i];
+		k->length[k->n] = (k->n == 0) ? 0 : k->length[k->n - 1] + sqrtf(Vector3D_lengthSquared(&(Vector3D){
+			centres[i].x - k->path[k->n - 1].x, centres[i].y - k->path[k->n - 1].y, centres[i].z - k->path[k->n - 1].z }));
+		++k->n;
+	}
+
+	return k->n >= 2;
+}
+
+// position and direction at distance s around the track
+static void trackPosition(KartScene* k, float s, Point3D* pos, Vector3D* dir)
+{
+	Point3D last = k->path[k->n - 1];
+	float total = k->length[k->n - 1] + sqrtf(Vector3D_lengthSquared(&(Vector3D){
+		k->path[0].x - last.x, k->path[0].y - last.y, k->path[0].z - last.z }));
+
+	s = fmodf(s, total);
+
+	if ( s < 0 )
+		s += total;
+
+	int i = 0;
+
+	while ( i + 1 < k->n && k->length[i + 1] <= s )
+		++i;
+
+	Point3D a = k->path[i];
+	Point3D b = k->path[(i + 1) % k->n];
+	float len = ((i + 1 < k->n) ? k->length[i + 1] : total) - k->length[i];
+	float t = (len > 0) ? (s - k->length[i]) / len : 0;
+
+	*pos = Point3DMake(a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t);
+	*dir = Vector3D_normalize(Vector3DMake(b.x - a.x, b.y - a.y, 0));
+}
+
+// distance the karts go each frame (about their top speed at 40 fps in the demo)
+#define KART_SPEED 2.0f
+
+static void kartUpdate(BenchScene* b, int frame)
+{
+	KartScene* k = b->data;
+	Point3D pos;
+	Vector3D f;
+
+	for ( int i = KART_COUNT - 1; i >= 0; --i )
+	{
+		// the others start a little behind and to the side of the player, as in kart.lua
+		float offset = sinf(i * 1.8f);
+		trackPosition(k, frame * KART_SPEED * (1 + 0.1f * cosf(i * 2)) - i * 5, &pos, &f);
+
+		if ( i > 0 )
+			pos = Point3DMake(pos.x + f.dy * 5 * offset, pos.y - f.dx * 5 * offset, pos.z);
+
+		Matrix3D m = rotation(atan2f(f.dy, f.dx) * 180 / (float)M_PI - 90, 0, 0, 1);
+		m.dx = pos.x;
+		m.dy = pos.y;
+		m.dz = pos.z + 0.75f;
+		Scene3DNode_setTransform(k->karts[i], &m);
+	}
+
+	// setShoulderCamera(), for the player (kart 0)
+	const float radius = 10;
+	const float attack = 0.5f;
+	Scene3D_setCamera(&b->scene,
+		Point3DMake(pos.x - f.dx * radius, pos.y - f.dy * radius, pos.z + radius * attack),
+		Point3DMake(pos.x, pos.y, pos.z + 4), 1, Vector3DMake(0, 0, 1));
+
+	#if ENABLE_Z_BUFFER
+	prefetch_zbuf();
+	#endif
+}
+
+#if ENABLE_TEXTURES
+static Texture* loadTexture(const char* name)
+{
+	char path[512];
+	const char* err = NULL;
+	snprintf(path, sizeof(path), "%s/%s", benchAssetDir, name);
+
+	#if ENABLE_TEXTURES_GREYSCALE
+	Texture* texture = Texture_loadFromPath(path, 1, &err);
+	#else
+	// (the demo's textures are greyscale, and .pdi files can't be read on the host.)
+	Texture* texture = NULL;
+	err = "greyscale textures are disabled";
+	#endif
+
+	if ( texture == NULL )
+		fprintf(stderr, "%s: %s; drawing without it\n", path, err);
+
+	return texture;
+}
+#endif
+
+static void kartInit(BenchScene* b)
+{
+	static KartScene k;
+	Scene3D* scene = &b->scene;
+	Scene3D_setGlobalLight(scene, Vector3DMake(0, 0, 1));
+
+	#if ENABLE_RENDER_DISTANCE_MAX
+	setRenderDistanceMax(100.0f);
+	#endif
+
+	Shape3D* terrain = newShape();
+	Shape3D* banner = newShape();
+
+	#if ENABLE_POLYGON_SCANLINING
+	Shape3D_setScanlining(terrain, (ScanlineFill){ .fill = 0xAAAAAAAA, .select = kScanlineEven });
+	#endif
+
+	Shape3D_setClosed(terrain, 1);
+
+	#if ENABLE_CUSTOM_PATTERNS
+	static const uint8_t bannerPatterns[7][8] = {
+		{ 0xD0, 0xF0, 0x70, 0xF0, 0x0D, 0x0F, 0x07, 0x0F },
+		{ 0xF0, 0xD0, 0xF0, 0xF0, 0x0F, 0x0F, 0x07, 0x0F },
+		{ 0xF0, 0xF0, 0xF0, 0xF0, 0x0F, 0x0F, 0x0F, 0x0F },
+		{ 0xF0, 0xF0, 0xF0, 0xF0, 0x0F, 0x0F, 0x0F, 0x0F },
+		{ 0xF0, 0xF0, 0xF0, 0xF0, 0x0F, 0x0F, 0x0F, 0x0F },
+		{ 0xF0, 0xF2, 0xF0, 0xF0, 0x0F, 0x0F, 0x4F, 0x0F },
+		{ 0xF2, 0xF0, 0xF8, 0xF0, 0x2F, 0x0F, 0x8F, 0x0F },
+	};
+
+	// (lib3d.pattern.new() repeats the given patterns to fill the table)
+	PatternTable* pattern = Pattern_new();
+
+	for ( int i = 0; i < LIGHTING_PATTERN_COUNT; ++i )
+		memcpy((*pattern)[i], bannerPatterns[i % 7], sizeof(Pattern));
+
+	Shape3D_setPattern(banner, pattern);
+	Pattern_unref(pattern);
+	#endif
+
+	if ( !loadTrack(&k, terrain, banner) )
+		exit(1);
+
+	#if ENABLE_TEXTURES
+	Texture* texture = loadTexture("texture.png.u");
+
+	if ( texture != NULL )
+	{
+		Shape3D_setTexture(terrain, texture);
+		Texture_unref(texture);
+	}
+	#endif
+
+	Scene3DNode* n = Scene3D_getRootNode(scene);
+	Scene3DNode* n2 = Scene3DNode_newChild(n);
+	Scene3DNode_addShape(n2, terrain);
+	Scene3DNode_addShape(n2, banner);
+
+	const float KSIZE = 4;
+	const float sink = 0.4f;
+
+	Imposter3D* imposter = m3d_malloc(sizeof(Imposter3D));
+	Imposter3D_init(imposter);
+	Imposter3D_setPosition(imposter, &(Point3D){ 0, 0, 0 });
+	Imposter3D_setRectangle(imposter, -KSIZE / 2, -KSIZE * (1 - sink), KSIZE / 2, KSIZE * sink);
+	Imposter3D_setZOffsets(imposter, 0, 0, -4, -4);
+
+	#if ENABLE_TEXTURES
+	Texture* sheet = loadTexture("kart/sheet.png.u");
+
+	if ( sheet != NULL )
+	{
+		Imposter3D_setBitmap(imposter, sheet);
+		Texture_unref(sheet);
+		Imposter3D_setFrames(imposter, 8, 8, 64, 1);
+		Imposter3D_setOrientation(imposter, Vector3DMake(0, 0, 1), Vector3DMake(0, -1, 0));
+	}
+	#endif
+
+	for ( int i = 0; i < KART_COUNT; ++i )
+	{
+		k.karts[i] = Scene3DNode_newChild(n);
+		Scene3DNode_addImposter(k.karts[i], imposter);
+	}
+
+	b->data = &k;
+	b->update = kartUpdate;
+}
+
+// the scenes, in the order frames.c draws them
+
+const BenchSceneInfo benchScenes[] = {
+	{ "kart", kartInit },
+	{ "knot", knotInit },
+	{ "icosahedra", icosahedraInit },
+	{ "ztest", ztestInit },
+};
+
+const int benchSceneCount = sizeof(benchScenes) / sizeof(benchScenes[0]);
+
+void benchDrawFrame(Scene3D* scene, uint8_t* frame, int rowstride)
+{
+	// as scene_draw() in luaglue.c
+	#if ENABLE_TEXTURES && TEXTURE_PERSPECTIVE_MAPPING && PRECOMPUTE_PROJECTION
+	precomputeProjectionTable();
+	#endif
+
+	#if ENABLE_INTERLACE
+	if ( getInterlaceEnabled() )
+	{
+		#if INTERLACE_INTERVAL <= 2
+			setInterlace(!getInterlace());
+		#else
+			setInterlace((getInterlace() + 1) % INTERLACE_INTERVAL);
+		#endif
+	}
+	#endif
+
+	memset(frame, 0, rowstride * LCD_ROWS);
+	Scene3D_draw(scene, frame, rowstride);
+}
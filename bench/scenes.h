@@ -0,0 +1,41 @@
+//
+//  scenes.h
+//  mini3d-plus benchmarks
+//
+//  The demo scenes from Source/*.lua, built in C so the host programs (frames.c, and the
+//  golden image test in test/) can draw them. Each one moves its camera and objects along a
+//  fixed path, so frame N always looks the same for a given build.
+//
+
+#ifndef bench_scenes_h
+#define bench_scenes_h
+
+#include "mini3d.h"
+#include "scene.h"
+
+typedef struct BenchScene
+{
+	const char* name;
+	Scene3D scene;
+	void (*update)(struct BenchScene* b, int frame);
+	void* data;
+} BenchScene;
+
+typedef struct
+{
+	const char* name;
+	// builds the scene in b->scene, which has been initialized, and sets b->update.
+	void (*init)(BenchScene* b);
+} BenchSceneInfo;
+
+extern const BenchSceneInfo benchScenes[];
+extern const int benchSceneCount;
+
+// where track.json etc. are (default Source/assets)
+extern const char* benchAssetDir;
+
+// draws a frame the way scene:draw() in luaglue.c does: steps the interlace, clears the
+// frame and calls Scene3D_draw(). Call b->update(b, n) for frames 0 to n first.
+void benchDrawFrame(Scene3D* scene, uint8_t* frame, int rowstride);
+
+#endif
@@ -0,0 +1,149 @@
+//
+//  sort.c
+//  mini3d-plus benchmarks
+//
+//  Compares the two algorithms available for SORT_3D_FACES_BY_Z (quicksort and radix sort)
+//  on face lists of increasing length, and reports the length at which radix sort starts
+//  to win. Use the result to choose FACE_RADIX_SORT_MIN.
+//
+//  This runs on the host, so it only gives a rough idea of the crossover on the device.
+//
+//  Build and run (from the repository root):
+//      cc -O2 -Imini3d-plus -o sortbench bench/sort.c && ./sortbench
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "qsort.h"
+#include "radixsort.h"
+
+// same layout as SortedFace in scene.h
+typedef struct
+{
+	float comparison;
+	void* instance;
+	uint32_t face;
+} Face;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void fill(Face* faces, int n, unsigned seed)
+{
+	srand(seed);
+	for ( int i = 0; i < n; ++i )
+	{
+		// distances in front of the camera, as in a typical scene
+		faces[i].comparison = 0.75f + 100.0f * (float)rand() / (float)RAND_MAX;
+		faces[i].instance = NULL;
+		faces[i].face = (uint32_t)i;
+	}
+}
+
+static void sort_quick(Face* list, int n)
+{
+	Face tmp;
+	#define LESS(a, b) list[a].comparison > list[b].comparison
+	#define SWAP(a, b) tmp = list[a], list[a] = list[b], list[b] = tmp
+	QSORT(n, LESS, SWAP);
+	#undef LESS
+	#undef SWAP
+}
+
+static Face* sort_radix(Face* list, Face* scratch, int n)
+{
+	#define KEY(f) (~radix_key_float((f).comparison))
+	RADIXSORT(Face, n, list, scratch, KEY);
+	#undef KEY
+	return list;
+}
+
+static int check(Face* list, int n)
+{
+	for ( int i = 1; i < n; ++i )
+	{
+		if ( list[i - 1].comparison < list[i].comparison )
+			return 0;
+	}
+	return 1;
+}
+
+int main(int argc, char** argv)
+{
+	static const int sizes[] = { 8, 16, 24, 32, 48, 64, 96, 128, 192, 256, 512, 1024, 2048, 4096, 16384 };
+	const int nsizes = sizeof(sizes) / sizeof(sizes[0]);
+	const int maxn = sizes[nsizes - 1];
+
+	// elements sorted per measurement, to keep timings for short lists meaningful
+	const long work = (argc > 1) ? atol(argv[1]) : 4000000;
+
+	Face* src = malloc(maxn * sizeof(Face));
+	Face* a = malloc(maxn * sizeof(Face));
+	Face* b = malloc(maxn * sizeof(Face));
+	int crossover = -1;
+
+	printf("%8s %14s %14s\n", "faces", "quick ns/face", "radix ns/face");
+
+	for ( int s = 0; s < nsizes; ++s )
+	{
+		int n = sizes[s];
+		long reps = work / n;
+		double tq = 0, tr = 0;
+
+		fill(src, n, 1234 + n);
+
+		for ( long r = 0; r < reps; ++r )
+		{
+			memcpy(a, src, n * sizeof(Face));
+			double t0 = now();
+			sort_quick(a, n);
+			tq += now() - t0;
+		}
+
+		if ( !check(a, n) )
+		{
+			printf("quicksort failed at n=%d\n", n);
+			return 1;
+		}
+
+		for ( long r = 0; r < reps; ++r )
+		{
+			memcpy(a, src, n * sizeof(Face));
+			double t0 = now();
+			Face* sorted = sort_radix(a, b, n);
+			tr += now() - t0;
+
+			if ( r == reps - 1 && !check(sorted, n) )
+			{
+				printf("radix sort failed at n=%d\n", n);
+				return 1;
+			}
+		}
+
+		double nq = tq * 1e9 / ((double)reps * n);
+		double nr = tr * 1e9 / ((double)reps * n);
+
+		printf("%8d %14.2f %14.2f\n", n, nq, nr);
+
+		if ( crossover < 0 && nr < nq )
+			crossover = n;
+	}
+
+	if ( crossover > 0 )
+		printf("radix sort is faster from about %d faces\n", crossover);
+	else
+		printf("radix sort was never faster\n");
+
+	free(src);
+	free(a);
+	free(b);
+	return 0;
+}
@@ -0,0 +1,124 @@
+//
+//  pd_api.h
+//  mini3d-plus host build
+//
+//  Stand-in for the Playdate SDK's pd_api.h, so mini3d-plus can be built and run on a desktop
+//  machine (see host/Makefile). It declares only the part of the API the engine uses, with
+//  the SDK's names and signatures; pd_host.c implements it with the C library.
+//
+//  This is not used by the Playdate build, and luaglue.c / main.c are not built against it.
+//
+
+#ifndef pd_api_h
+#define pd_api_h
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdarg.h>
+
+#define LCD_COLUMNS 400
+#define LCD_ROWS 240
+#define LCD_ROWSIZE 52
+
+typedef enum
+{
+	kEventInit,
+	kEventInitLua,
+	kEventLock,
+	kEventUnlock,
+	kEventPause,
+	kEventResume,
+	kEventTerminate,
+	kEventKeyPressed,
+	kEventKeyReleased,
+	kEventLowPower
+} PDSystemEvent;
+
+// graphics
+
+typedef struct LCDBitmap LCDBitmap;
+
+typedef enum
+{
+	kColorBlack,
+	kColorWhite,
+	kColorClear,
+	kColorXOR
+} LCDSolidColor;
+
+// an LCDSolidColor, or a pointer to an LCDPattern
+typedef uintptr_t LCDColor;
+typedef uint8_t LCDPattern[16];
+
+struct playdate_graphics
+{
+	LCDBitmap* (*newBitmap)(int width, int height, LCDColor bgcolor);
+	void (*freeBitmap)(LCDBitmap* bitmap);
+	LCDBitmap* (*loadBitmap)(const char* path, const char** outerr);
+	void (*getBitmapData)(LCDBitmap* bitmap, int* width, int* height, int* rowbytes, uint8_t** mask, uint8_t** data);
+};
+
+// file
+
+typedef void SDFile;
+
+typedef enum
+{
+	kFileRead = (1<<0),
+	kFileReadData = (1<<1),
+	kFileWrite = (1<<2),
+	kFileAppend = (2<<2)
+} FileOptions;
+
+typedef struct
+{
+	int isdir;
+	unsigned int size;
+	int m_year;
+	int m_month;
+	int m_day;
+	int m_hour;
+	int m_minute;
+	int m_second;
+} FileStat;
+
+#ifndef SEEK_SET
+#define SEEK_SET 0
+#define SEEK_CUR 1
+#define SEEK_END 2
+#endif
+
+struct playdate_file
+{
+	const char* (*geterr)(void);
+	int (*stat)(const char* path, FileStat* stat);
+	SDFile* (*open)(const char* name, FileOptions mode);
+	int (*close)(SDFile* file);
+	int (*read)(SDFile* file, void* buf, unsigned int len);
+	int (*write)(SDFile* file, const void* buf, unsigned int len);
+	int (*flush)(SDFile* file);
+	int (*tell)(SDFile* file);
+	int (*seek)(SDFile* file, int pos, int whence);
+};
+
+// system
+
+struct playdate_sys
+{
+	void* (*realloc)(void* ptr, size_t size);
+	void (*logToConsole)(const char* fmt, ...);
+	void (*error)(const char* fmt, ...);
+	unsigned int (*getCurrentTimeMilliseconds)(void);
+	float (*getElapsedTime)(void);
+	void (*resetElapsedTime)(void);
+};
+
+typedef struct PlaydateAPI
+{
+	const struct playdate_sys* system;
+	const struct playdate_file* file;
+	const struct playdate_graphics* graphics;
+} PlaydateAPI;
+
+#endif
@@ -0,0 +1,413 @@
+//
+//  pd_host.c
+//  mini3d-plus host build
+//
+//  Implements the stand-in Playdate API (pd_api.h) with the C library.
+//
+//  Bitmaps keep their mask directly after their data, as on the device (render_range.inc
+//  relies on that). Paths are relative to the working directory; kFileRead and kFileReadData
+//  are the same thing here. loadBitmap() can't read .pdi files, so it always fails.
+//
+
+#include "pd_host.h"
+#include "mini3d.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+
+PlaydateAPI* pd = NULL;
+
+// system
+
+static void*
+host_realloc(void* ptr, size_t size)
+{
+	if ( size == 0 )
+	{
+		free(ptr);
+		return NULL;
+	}
+
+	return realloc(ptr, size);
+}
+
+static void
+host_logToConsole(const char* fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	fputc('\n', stderr);
+}
+
+static void
+host_error(const char* fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	fputs("error: ", stderr);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	fputc('\n', stderr);
+	abort();
+}
+
+static double
+host_seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static unsigned int
+host_getCurrentTimeMilliseconds(void)
+{
+	return (unsigned int)(host_seconds() * 1000);
+}
+
+static double elapsedStart = 0;
+
+static float
+host_getElapsedTime(void)
+{
+	return host_seconds() - elapsedStart;
+}
+
+static void
+host_resetElapsedTime(void)
+{
+	elapsedStart = host_seconds();
+}
+
+static const struct playdate_sys host_sys =
+{
+	.realloc = host_realloc,
+	.logToConsole = host_logToConsole,
+	.error = host_error,
+	.getCurrentTimeMilliseconds = host_getCurrentTimeMilliseconds,
+	.getElapsedTime = host_getElapsedTime,
+	.resetElapsedTime = host_resetElapsedTime,
+};
+
+// file
+
+static const char* fileError = NULL;
+
+static void
+setFileError(void)
+{
+	// (same wording as the device, which texture.c checks for.)
+	fileError = (errno == ENOENT) ? "No such file" : strerror(errno);
+}
+
+static const char*
+host_geterr(void)
+{
+	return fileError;
+}
+
+static int
+host_stat(const char* path, FileStat* st)
+{
+	struct stat s;
+
+	if ( stat(path, &s) != 0 )
+	{
+		setFileError();
+		return -1;
+	}
+
+	struct tm* t = gmtime(&s.st_mtime);
+
+	st->isdir = S_ISDIR(s.st_mode);
+	st->size = (unsigned int)s.st_size;
+	st->m_year = t->tm_year + 1900;
+	st->m_month = t->tm_mon + 1;
+	st->m_day = t->tm_mday;
+	st->m_hour = t->tm_hour;
+	st->m_minute = t->tm_min;
+	st->m_second = t->tm_sec;
+	return 0;
+}
+
+static SDFile*
+host_open(const char* name, FileOptions mode)
+{
+	const char* fmode = "rb";
+
+	if ( mode & kFileAppend )
+		fmode = "ab";
+	else if ( mode & kFileWrite )
+		fmode = "wb";
+
+	FILE* file = fopen(name, fmode);
+
+	if ( file == NULL )
+		setFileError();
+
+	return file;
+}
+
+static int
+host_close(SDFile* file)
+{
+	if ( fclose(file) != 0 )
+	{
+		setFileError();
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+host_read(SDFile* file, void* buf, unsigned int len)
+{
+	size_t n = fread(buf, 1, len, file);
+
+	if ( n < len && ferror(file) )
+	{
+		setFileError();
+		return -1;
+	}
+
+	return (int)n;
+}
+
+static int
+host_write(SDFile* file, const void* buf, unsigned int len)
+{
+	size_t n = fwrite(buf, 1, len, file);
+
+	if ( n < len )
+	{
+		setFileError();
+		return -1;
+	}
+
+	return (int)n;
+}
+
+static int
+host_flush(SDFile* file)
+{
+	return fflush(file) == 0 ? 0 : -1;
+}
+
+static int
+host_tell(SDFile* file)
+{
+	return (int)ftell(file);
+}
+
+static int
+host_seek(SDFile* file, int pos, int whence)
+{
+	return fseek(file, pos, whence) == 0 ? 0 : -1;
+}
+
+static const struct playdate_file host_file =
+{
+	.geterr = host_geterr,
+	.stat = host_stat,
+	.open = host_open,
+	.close = host_close,
+	.read = host_read,
+	.write = host_write,
+	.flush = host_flush,
+	.tell = host_tell,
+	.seek = host_seek,
+};
+
+// graphics
+
+struct LCDBitmap
+{
+	int width;
+	int height;
+	int rowbytes;
+	uint8_t* mask; // NULL, or data + height * rowbytes
+	uint8_t data[];
+};
+
+static LCDBitmap*
+host_newBitmap(int width, int height, LCDColor bgcolor)
+{
+	// (rows are padded to 32 bits, as on the device.)
+	int rowbytes = ((width + 31) / 32) * 4;
+	size_t size = (size_t)rowbytes * height;
+	int hasmask = (bgcolor == kColorClear);
+
+	LCDBitmap* bitmap = malloc(sizeof(LCDBitmap) + (hasmask ? 2 * size : size));
+
+	if ( bitmap == NULL )
+		return NULL;
+
+	bitmap->width = width;
+	bitmap->height = height;
+	bitmap->rowbytes = rowbytes;
+	bitmap->mask = hasmask ? bitmap->data + size : NULL;
+
+	if ( bgcolor == kColorBlack || bgcolor == kColorXOR )
+		memset(bitmap->data, 0x00, size);
+	else if ( bgcolor == kColorWhite )
+		memset(bitmap->data, 0xff, size);
+	else if ( hasmask )
+		memset(bitmap->data, 0x00, 2 * size);
+	else
+	{
+		// pattern: 8 rows of colour then 8 rows of mask, which is ignored here
+		const uint8_t* pattern = (const uint8_t*)bgcolor;
+
+		for ( int y = 0; y < height; ++y )
+			memset(bitmap->data + y * rowbytes, pattern[y % 8], rowbytes);
+	}
+
+	return bitmap;
+}
+
+static void
+host_freeBitmap(LCDBitmap* bitmap)
+{
+	free(bitmap);
+}
+
+static LCDBitmap*
+host_loadBitmap(const char* path, const char** outerr)
+{
+	if ( outerr != NULL )
+		*outerr = "loadBitmap is not available on the host";
+
+	return NULL;
+}
+
+static void
+host_getBitmapData(LCDBitmap* bitmap, int* width, int* height, int* rowbytes, uint8_t** mask, uint8_t** data)
+{
+	if ( width ) *width = bitmap->width;
+	if ( height ) *height = bitmap->height;
+	if ( rowbytes ) *rowbytes = bitmap->rowbytes;
+	if ( mask ) *mask = bitmap->mask;
+	if ( data ) *data = bitmap->data;
+}
+
+static const struct playdate_graphics host_graphics =
+{
+	.newBitmap = host_newBitmap,
+	.freeBitmap = host_freeBitmap,
+	.loadBitmap = host_loadBitmap,
+	.getBitmapData = host_getBitmapData,
+};
+
+static PlaydateAPI host_api =
+{
+	.system = &host_sys,
+	.file = &host_file,
+	.graphics = &host_graphics,
+};
+
+void
+pdhost_init(void)
+{
+	pd = &host_api;
+	mini3d_setRealloc(pd->system->realloc);
+	host_resetElapsedTime();
+}
+
+int
+pdhost_writePBM(const char* path, const uint8_t* frame, int rowstride, int width, int height)
+{
+	int rowbytes = (width + 7) / 8;
+	uint8_t row[LCD_ROWSIZE];
+
+	if ( rowbytes > (int)sizeof(row) )
+		return -1;
+
+	FILE* file = fopen(path, "wb");
+
+	if ( file == NULL )
+		return -1;
+
+	fprintf(file, "P4\n%d %d\n", width, height);
+
+	for ( int y = 0; y < height; ++y )
+	{
+		// PBM uses 1 for black; the Playdate uses 1 for white
+		for ( int x = 0; x < rowbytes; ++x )
+			row[x] = ~frame[y * rowstride + x];
+
+		fwrite(row, 1, rowbytes, file);
+	}
+
+	return fclose(file) == 0 ? 0 : -1;
+}
+
+// reads a PBM header number, skipping whitespace and comments before it.
+static int
+readPBMNumber(FILE* file)
+{
+	int c = fgetc(file);
+
+	while ( c == '#' || c == ' ' || c == '\t' || c == '\r' || c == '\n' )
+	{
+		if ( c == '#' )
+		{
+			while ( c != '\n' && c != EOF )
+				c = fgetc(file);
+		}
+
+		c = fgetc(file);
+	}
+
+	int n = -1;
+
+	while ( c >= '0' && c <= '9' )
+	{
+		n = ((n < 0) ? 0 : n * 10) + (c - '0');
+		c = fgetc(file);
+	}
+
+	// (the single whitespace character after the height is consumed here, as it should be.)
+	return n;
+}
+
+int
+pdhost_readPBM(const char* path, uint8_t* frame, int rowstride, int width, int height)
+{
+	int rowbytes = (width + 7) / 8;
+	uint8_t row[LCD_ROWSIZE];
+
+	if ( rowbytes > (int)sizeof(row) )
+		return -1;
+
+	FILE* file = fopen(path, "rb");
+
+	if ( file == NULL )
+		return -1;
+
+	if ( fgetc(file) != 'P' || fgetc(file) != '4' || readPBMNumber(file) != width || readPBMNumber(file) != height )
+	{
+		fclose(file);
+		return -1;
+	}
+
+	for ( int y = 0; y < height; ++y )
+	{
+		if ( fread(row, 1, rowbytes, file) != (size_t)rowbytes )
+		{
+			fclose(file);
+			return -1;
+		}
+
+		for ( int x = 0; x < rowbytes; ++x )
+			frame[y * rowstride + x] = ~row[x];
+	}
+
+	fclose(file);
+	return 0;
+}
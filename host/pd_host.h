@@ -0,0 +1,26 @@
+//
+//  pd_host.h
+//  mini3d-plus host build
+//
+//  The host side of the stand-in Playdate API (pd_api.h), plus a few helpers for
+//  programs that render headlessly.
+//
+
+#ifndef pd_host_h
+#define pd_host_h
+
+#include <pd_api.h>
+
+// sets pd (the engine's PlaydateAPI*) to the host implementation and hands its allocator
+// to mini3d_setRealloc(). Call before anything else.
+void pdhost_init(void);
+
+// writes a 1-bit frame (Playdate layout: MSB first, set bits are white) as a binary PBM.
+// Returns 0 on success.
+int pdhost_writePBM(const char* path, const uint8_t* frame, int rowstride, int width, int height);
+
+// reads a binary PBM written by pdhost_writePBM() into frame. Returns 0 on success, or -1 if
+// the file can't be read or isn't a width x height binary PBM.
+int pdhost_readPBM(const char* path, uint8_t* frame, int rowstride, int width, int height);
+
+#endif
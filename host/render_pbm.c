@@ -0,0 +1,121 @@
+//
+//  render_pbm.c
+//  mini3d-plus host build
+//
+//  Renders a small test scene headlessly and writes the frame as a PBM image.
+//
+//  Usage: render_pbm out.pbm [frames]
+//      Draws the scene the given number of times (default 1), turning the camera a little
+//      each frame, and writes the last frame.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "pd_host.h"
+#include "mini3d.h"
+#include "scene.h"
+#include "shape.h"
+
+static uint8_t frame[LCD_ROWS * LCD_ROWSIZE];
+
+static Shape3D*
+newCube(int textured)
+{
+	Shape3D* shape = m3d_malloc(sizeof(Shape3D));
+	Shape3D_init(shape);
+
+	static const int faces[6][4] = {
+		{ 0, 2, 3, 1 }, { 4, 5, 7, 6 }, { 0, 1, 5, 4 },
+		{ 2, 6, 7, 3 }, { 0, 4, 6, 2 }, { 1, 3, 7, 5 }
+	};
+
+	Point3D p[8];
+
+	for ( int i = 0; i < 8; ++i )
+		p[i] = Point3DMake((i & 1) ? 1 : -1, (i & 2) ? 1 : -1, (i & 4) ? 1 : -1);
+
+	for ( int i = 0; i < 6; ++i )
+		Shape3D_addFace(shape, &p[faces[i][0]], &p[faces[i][1]], &p[faces[i][2]], &p[faces[i][3]], -0.5f + i * 0.2f);
+
+	Shape3D_setClosed(shape, 1);
+
+#if ENABLE_TEXTURES
+	if ( textured )
+	{
+		// 32x32 checkerboard, with a transparent border
+		LCDBitmap* bitmap = pd->graphics->newBitmap(32, 32, kColorClear);
+		int rowbytes;
+		uint8_t* mask;
+		uint8_t* data;
+		pd->graphics->getBitmapData(bitmap, NULL, NULL, &rowbytes, &mask, &data);
+
+		for ( int y = 2; y < 30; ++y )
+		{
+			for ( int x = 2; x < 30; ++x )
+			{
+				if ( ((x / 4) ^ (y / 4)) & 1 )
+					data[y * rowbytes + x / 8] |= 0x80 >> (x % 8);
+
+				mask[y * rowbytes + x / 8] |= 0x80 >> (x % 8);
+			}
+		}
+
+		Texture* texture = Texture_fromLCDBitmap(bitmap);
+		Shape3D_setTexture(shape, texture);
+		Texture_unref(texture);
+
+		for ( int i = 0; i < 6; ++i )
+			Shape3D_setFaceTextureMap(shape, i, (Point2D){ 0, 0 }, (Point2D){ 1, 0 }, (Point2D){ 1, 1 }, (Point2D){ 0, 1 });
+	}
+#endif
+
+	return shape;
+}
+
+int
+main(int argc, char** argv)
+{
+	if ( argc < 2 )
+	{
+		fprintf(stderr, "usage: %s out.pbm [frames]\n", argv[0]);
+		return 1;
+	}
+
+	int frames = (argc > 2) ? atoi(argv[2]) : 1;
+
+	pdhost_init();
+
+	Scene3D scene;
+	Scene3D_init(&scene);
+	Scene3D_setGlobalLight(&scene, Vector3DMake(0.2f, 0.8f, 0.4f));
+
+	Scene3DNode* root = Scene3D_getRootNode(&scene);
+	Shape3D* cubes[2] = { newCube(1), newCube(0) };
+
+	for ( int i = 0; i < 2; ++i )
+	{
+		Scene3DNode* node = Scene3DNode_newChild(root);
+		Scene3DNode_addShapeWithOffset(node, cubes[i], Vector3DMake(i ? 1.3f : -1.3f, 0, 0));
+	}
+
+	for ( int i = 0; i < frames; ++i )
+	{
+		float angle = i * 0.05f;
+		Scene3D_setCamera(&scene, Point3DMake(5 * sinf(angle) + 1.5f, 2, -5 * cosf(angle)), Point3DMake(0, 0, 0), 1, Vector3DMake(0, 1, 0));
+
+		memset(frame, 0xaa, sizeof(frame));
+		Scene3D_draw(&scene, frame, LCD_ROWSIZE);
+	}
+
+	if ( pdhost_writePBM(argv[1], frame, LCD_ROWSIZE, LCD_COLUMNS, LCD_ROWS) != 0 )
+	{
+		perror(argv[1]);
+		return 1;
+	}
+
+	Scene3D_deinit(&scene);
+	return 0;
+}
@@ -40,6 +40,10 @@ static const lua_reg lib3DTexture[];
 static const lua_reg lib3DPattern[];
 #endif
 
+#if ENABLE_RENDER_STATS
+static const lua_reg lib3DStats[];
+#endif
+
 void register3D(PlaydateAPI* playdate)
 {
 	pd = playdate;
@@ -80,6 +84,11 @@ void register3D(PlaydateAPI* playdate)
 		pd->system->logToConsole("%s:%i: registerClass failed, %s", __FILE__, __LINE__, err);
 	#endif
 	
+	#if ENABLE_RENDER_STATS
+	if ( !pd->lua->registerClass("lib3d.stats", lib3DStats, NULL, 0, &err) )
+		pd->system->logToConsole("%s:%i: registerClass failed, %s", __FILE__, __LINE__, err);
+	#endif
+	
 	mini3d_setRealloc(pd->system->realloc);
 }
 
@@ -161,6 +170,20 @@ static int _prefetch_zbuf(lua_State* L)
 	return 0;
 }
 
+// marks the rows the scene changed for display, and returns the first and last of them to Lua (or nothing).
+static int markSceneRows(Scene3D* scene)
+{
+	LCDRowRange rows = Scene3D_getUpdatedRows(scene);
+	
+	if ( rows.end <= rows.start )
+		return 0;
+	
+	pd->graphics->markUpdatedRows(rows.start, rows.end - 1);
+	pd->lua->pushInt(rows.start);
+	pd->lua->pushInt(rows.end - 1);
+	return 2;
+}
+
 static int scene_draw(lua_State* L)
 {
 	Scene3D* scene = getScene(1);
@@ -171,7 +194,7 @@ static int scene_draw(lua_State* L)
 	
 	#if !ENABLE_INTERLACE
 	Scene3D_draw(scene, pd->graphics->getFrame(), LCD_ROWSIZE);
-	pd->graphics->markUpdatedRows(0, LCD_ROWS-1); // XXX
+	return markSceneRows(scene);
 	#else
 	if (getInterlaceEnabled())
 	{
@@ -188,11 +211,19 @@ static int scene_draw(lua_State* L)
 		clear_backbuff_interlaced();
 		Scene3D_draw(scene, &backbuff[0], LCD_ROWSIZE);
 	}
+	// (the whole back buffer is cleared and copied, so every row changes.)
 	memcpy(pd->graphics->getFrame(), backbuff, LCD_ROWS * LCD_ROWSIZE);
 	pd->graphics->markUpdatedRows(0, LCD_ROWS-1);
-	#endif
 	
-	return 0;
+	LCDRowRange rows = Scene3D_getUpdatedRows(scene);
+	
+	if ( rows.end <= rows.start )
+		return 0;
+	
+	pd->lua->pushInt(rows.start);
+	pd->lua->pushInt(rows.end - 1);
+	return 2;
+	#endif
 }
 
 #if ENABLE_Z_BUFFER
@@ -205,15 +236,22 @@ static int draw_zbuff(lua_State* L)
 }
 #endif
 
+// for games drawing with drawNode(): call once per frame, before the first drawNode().
+static int scene_beginFrame(lua_State* L)
+{
+	Scene3D* scene = getScene(1);
+	Scene3D_beginFrame(scene);
+	return 0;
+}
+
 static int scene_drawNode(lua_State* L)
 {
 	Scene3D* scene = getScene(1);
 	Scene3DNode* node = getSceneNode(2);
 
 	Scene3D_drawNode(scene, node, pd->graphics->getFrame(), LCD_ROWSIZE);
-	pd->graphics->markUpdatedRows(0, LCD_ROWS-1); // XXX
 	
-	return 0;
+	return markSceneRows(scene);
 }
 
 static int scene_setLight(lua_State* L)
@@ -239,6 +277,64 @@ static int scene_setCenter(lua_State* L)
 	return 0;
 }
 
+#if ENABLE_FRUSTUM_CULLING
+static int scene_setFarDistance(lua_State* L)
+{
+	Scene3D* scene = getScene(1);
+	Scene3D_setFarDistance(scene, pd->lua->getArgFloat(2));
+	
+	return 0;
+}
+#endif
+
+#if ENABLE_SCENE_ORDERING_TABLE
+static int scene_setOrderTableSize(lua_State* L)
+{
+	Scene3D* scene = getScene(1);
+	Scene3D_setOrderTableSize(scene, pd->lua->getArgInt(2));
+	
+	return 0;
+}
+#endif
+
+#if ENABLE_S_BUFFER
+static int scene_setUsesSBuffer(lua_State* L)
+{
+	Scene3D* scene = getScene(1);
+	Scene3D_setUsesSBuffer(scene, pd->lua->getArgBool(2));
+	
+	return 0;
+}
+#endif
+
+#if ENABLE_Z_BUFFER
+// z buffer bits per pixel (8, 16 or 32). Returns false if that format isn't available.
+static int scene_setZBufferFormat(lua_State* L)
+{
+	Scene3D* scene = getScene(1);
+	pd->lua->pushBool(Scene3D_setZBufferFormat(scene, pd->lua->getArgInt(2)));
+	
+	return 1;
+}
+
+static int scene_getZBufferFormat(lua_State* L)
+{
+	Scene3D* scene = getScene(1);
+	pd->lua->pushInt(scene->zbufferFormat);
+	
+	return 1;
+}
+#endif
+
+// bytes of per-frame memory used by the last draw, and the most used by any draw
+static int scene_getFrameMemory(lua_State* L)
+{
+	Scene3D* scene = getScene(1);
+	pd->lua->pushInt((int)scene->arena.used);
+	pd->lua->pushInt((int)scene->arena.highWater);
+	return 2;
+}
+
 static Point3D cameraOrigin = (Point3D){ 0, -1, 1 };
 static Point3D cameraLookat = (Point3D){ 0, 0, 0 };
 static float cameraScale = 1.0f;
@@ -332,10 +428,25 @@ static const lua_reg lib3DScene[] =
 #if ENABLE_Z_BUFFER
 	{ "drawZBuff",		draw_zbuff },
 #endif
+	{ "beginFrame",		scene_beginFrame },
 	{ "drawNode",		scene_drawNode },
 	{ "getRootNode",	scene_getRoot },
 	{ "setLight",		scene_setLight },
 	{ "setCenter",		scene_setCenter },
+#if ENABLE_FRUSTUM_CULLING
+	{ "setFarDistance",	scene_setFarDistance },
+#endif
+#if ENABLE_SCENE_ORDERING_TABLE
+	{ "setOrderTableSize",	scene_setOrderTableSize },
+#endif
+#if ENABLE_S_BUFFER
+	{ "setUsesSBuffer",	scene_setUsesSBuffer },
+#endif
+#if ENABLE_Z_BUFFER
+	{ "setZBufferFormat",	scene_setZBufferFormat },
+	{ "getZBufferFormat",	scene_getZBufferFormat },
+#endif
+	{ "getFrameMemory",	scene_getFrameMemory },
 	{ "setCameraOrigin",	scene_setCameraOrigin },
 	{ "setCameraScale",		scene_setCameraScale },
 	{ "setCameraTarget",	scene_setCameraTarget },
@@ -816,6 +927,43 @@ static int shape_setOrderTableSize(lua_State* L)
 }
 #endif
 
+#if ENABLE_BSP
+static int shape_buildBSP(lua_State* L)
+{
+	Shape3D_buildBSP(getShape(1));
+	return 0;
+}
+#endif
+
+#if ENABLE_LOD
+static int shape_addLOD(lua_State* L)
+{
+	Shape3D_addLOD(getShape(1), getShape(2), pd->lua->getArgFloat(3));
+	return 0;
+}
+
+static int shape_newSimplified(lua_State* L)
+{
+	Shape3D* shape = Shape3D_newSimplified(getShape(1), MAX(pd->lua->getArgInt(2), 1));
+	Shape3D_retain(shape);
+	pd->lua->pushObject(shape, "lib3d.shape", 0);
+	return 1;
+}
+#endif
+
+#if ENABLE_SHAPE_IMPOSTERS
+static int shape_setImposter(lua_State* L)
+{
+	Imposter3D* imposter = NULL;
+	if (pd->lua->getArgType(2, NULL) != kTypeNil)
+	{
+		imposter = getImposter(2);
+	}
+	Shape3D_setImposter(getShape(1), imposter, pd->lua->getArgFloat(3));
+	return 0;
+}
+#endif
+
 static const lua_reg lib3DShape[] =
 {
 	{ "new",			shape_new },
@@ -839,6 +987,16 @@ static const lua_reg lib3DShape[] =
 #endif
 #if ENABLE_ORDERING_TABLE
 	{ "setOrderTableSize", shape_setOrderTableSize, },
+#endif
+#if ENABLE_BSP
+	{ "buildBSP", shape_buildBSP },
+#endif
+#if ENABLE_LOD
+	{ "addLOD", shape_addLOD },
+	{ "newSimplified", shape_newSimplified },
+#endif
+#if ENABLE_SHAPE_IMPOSTERS
+	{ "setImposter", shape_setImposter },
 #endif
 	{ NULL,				NULL }
 };
@@ -861,6 +1019,34 @@ static int imposter_gc(lua_State* L)
 	return 0;
 }
 
+#if ENABLE_SHAPE_IMPOSTERS
+// newFromShape(shape, nYaw, nPitch, frameSize, [up], [forward])
+static int imposter_newFromShape(lua_State* L)
+{
+	Shape3D* shape = getShape(1);
+	Vector3D up = Vector3DMake(0, 0, 1);
+	Vector3D forward = Vector3DMake(1, 0, 0);
+	
+	if ( pd->lua->getArgCount() > 4 )
+		up = *getVector(5);
+	
+	if ( pd->lua->getArgCount() > 5 )
+		forward = *getVector(6);
+	
+	Imposter3D* imposter = Imposter3D_newFromShape(shape, pd->lua->getArgInt(2), pd->lua->getArgInt(3), pd->lua->getArgInt(4), up, forward);
+	
+	if ( imposter == NULL )
+	{
+		pd->system->error("imposter.newFromShape: out of memory");
+		return 0;
+	}
+	
+	Imposter3D_retain(imposter);
+	pd->lua->pushObject(imposter, "lib3d.imposter", 0);
+	return 1;
+}
+#endif
+
 static int imposter_setPosition(lua_State* L)
 {
 	Imposter3D* imposter = getImposter(1);
@@ -909,6 +1095,28 @@ static int imposter_setBitmap(lua_State* L)
 	return 0;
 }
 
+// setFrames(columns, rows, nYaw, [nPitch])
+static int imposter_setFrames(lua_State* L)
+{
+	Imposter3D* imposter = getImposter(1);
+	int nPitch = 1;
+	
+	if ( pd->lua->getArgCount() > 4 )
+		nPitch = pd->lua->getArgInt(5);
+	
+	Imposter3D_setFrames(imposter, pd->lua->getArgInt(2), pd->lua->getArgInt(3), pd->lua->getArgInt(4), nPitch);
+	return 0;
+}
+
+static int imposter_setOrientation(lua_State* L)
+{
+	Imposter3D* imposter = getImposter(1);
+	Vector3D* up = getVector(2);
+	Vector3D* forward = getVector(3);
+	Imposter3D_setOrientation(imposter, *up, *forward);
+	return 0;
+}
+
 #if ENABLE_TEXTURES_GREYSCALE
 static int imposter_setLighting(lua_State* L)
 {
@@ -938,11 +1146,16 @@ static const lua_reg lib3DImposter[] =
 {
 	{ "new",			imposter_new },
 	{ "__gc",			imposter_gc },
+#if ENABLE_SHAPE_IMPOSTERS
+	{ "newFromShape",	imposter_newFromShape },
+#endif
 	{ "setPosition",	imposter_setPosition },
 	{ "setRectangle", 	imposter_setRectangle },
 	{ "setZOffsets", 	imposter_setZOffsets },
 #if ENABLE_TEXTURES
 	{ "setTexture",		imposter_setBitmap },
+	{ "setFrames",		imposter_setFrames },
+	{ "setOrientation",	imposter_setOrientation },
 	#if ENABLE_TEXTURES_GREYSCALE
 		{ "setLighting", imposter_setLighting },
 	#endif
@@ -1264,6 +1477,15 @@ static int interlace_get_enable(lua_State* L)
 }
 #endif
 
+#if ENABLE_Z_BUFFER
+// bytes of z buffer cleared during the last frame
+static int get_zbuffer_cleared_bytes(lua_State* L)
+{
+	pd->lua->pushInt(getZBufferClearedBytes());
+	return 1;
+}
+#endif
+
 #if ENABLE_RENDER_DISTANCE_MAX
 static int set_render_distance(lua_State* L)
 {
@@ -1328,8 +1550,95 @@ static const lua_reg lib3DRenderer[] =
 	#if ENABLE_DISTANCE_FOG
 	{ "setFog", set_render_fog },
 	#endif
+	#if ENABLE_Z_BUFFER
+	{ "getZBufferClearedBytes", get_zbuffer_cleared_bytes },
+	#endif
+	{ NULL,				NULL }
+};
+
+#if ENABLE_RENDER_STATS
+/// Stats
+
+// (the Lua API can't make tables, so the counters are looked up by name.)
+static const struct
+{
+	const char* name;
+	size_t offset;
+} statFields[] =
+{
+	{ "instancesUpdated", offsetof(RenderStats, instancesUpdated) },
+	{ "instancesCulled", offsetof(RenderStats, instancesCulled) },
+	{ "pointsTransformed", offsetof(RenderStats, pointsTransformed) },
+	{ "facesBackfaceCulled", offsetof(RenderStats, facesBackfaceCulled) },
+	{ "facesRejected", offsetof(RenderStats, facesRejected) },
+	{ "facesOffscreen", offsetof(RenderStats, facesOffscreen) },
+	{ "facesClipped", offsetof(RenderStats, facesClipped) },
+	{ "clipPointsDropped", offsetof(RenderStats, clipPointsDropped) },
+	{ "facesSorted", offsetof(RenderStats, facesSorted) },
+	{ "trianglesFlat", offsetof(RenderStats, triangles[kRenderStatFlat]) },
+	{ "trianglesZ", offsetof(RenderStats, triangles[kRenderStatZ]) },
+	{ "trianglesTextured", offsetof(RenderStats, triangles[kRenderStatTextured]) },
+	{ "trianglesTexturedZ", offsetof(RenderStats, triangles[kRenderStatTexturedZ]) },
+	{ "polygonsFlat", offsetof(RenderStats, polygons[kRenderStatFlat]) },
+	{ "polygonsZ", offsetof(RenderStats, polygons[kRenderStatZ]) },
+	{ "polygonsTextured", offsetof(RenderStats, polygons[kRenderStatTextured]) },
+	{ "polygonsTexturedZ", offsetof(RenderStats, polygons[kRenderStatTexturedZ]) },
+	{ "projective", offsetof(RenderStats, projective) },
+	{ "pixelsWritten", offsetof(RenderStats, pixelsWritten) },
+	{ "zRejects", offsetof(RenderStats, zRejects) },
+};
+
+#define STAT_FIELD_COUNT (int)(sizeof(statFields) / sizeof(statFields[0]))
+
+static uint32_t getStat(int i)
+{
+	return *(uint32_t*)((uint8_t*)&renderStats + statFields[i].offset);
+}
+
+// lib3d.stats.get(name): the named counter from the last scene drawn
+static int stats_get(lua_State* L)
+{
+	const char* name = pd->lua->getArgString(1);
+	
+	for ( int i = 0; i < STAT_FIELD_COUNT; ++i )
+	{
+		if ( strcmp(statFields[i].name, name) == 0 )
+		{
+			pd->lua->pushInt(getStat(i));
+			return 1;
+		}
+	}
+	
+	pd->system->error("no render stat called %s", name);
+	return 0;
+}
+
+// lib3d.stats.names(): the counters' names, as multiple return values
+static int stats_names(lua_State* L)
+{
+	for ( int i = 0; i < STAT_FIELD_COUNT; ++i )
+		pd->lua->pushString(statFields[i].name);
+	
+	return STAT_FIELD_COUNT;
+}
+
+// lib3d.stats.log(): prints all the counters to the console
+static int stats_log(lua_State* L)
+{
+	for ( int i = 0; i < STAT_FIELD_COUNT; ++i )
+		pd->system->logToConsole("%s: %u", statFields[i].name, (unsigned)getStat(i));
+	
+	return 0;
+}
+
+static const lua_reg lib3DStats[] =
+{
+	{ "get",			stats_get },
+	{ "names",			stats_names },
+	{ "log",			stats_log },
 	{ NULL,				NULL }
 };
+#endif
 
 #if ENABLE_TEXTURES
 static int texture_new(lua_State* L)
@@ -9,6 +9,14 @@
 #include <string.h>
 #include "3dmath.h"
 
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+	#include <xmmintrin.h>
+	#define TRANSFORM_SSE 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	#include <arm_neon.h>
+	#define TRANSFORM_NEON 1
+#endif
+
 Matrix3D identityMatrix = { .isIdentity = 1, .inverting = 0, .m = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}}, .dx = 0, .dy = 0, .dz = 0 };
 
 Matrix3D Matrix3DMake(float m11, float m12, float m13, float m21, float m22, float m23, float m31, float m32, float m33, int inverting)
@@ -25,17 +33,22 @@ Matrix3D Matrix3D_multiply(Matrix3D l, Matrix3D r)
 {
 	Matrix3D m = { .isIdentity = 0, .inverting = l.inverting ^ r.inverting };
 	
-	if ( l.isIdentity )
+	if ( l.isIdentity && r.isIdentity )
 	{
-		if ( r.isIdentity )
-			m = identityMatrix;
-		else
-			memcpy(&m.m, &r.m, sizeof(r.m));
-		
+		m = identityMatrix;
 		m.dx = l.dx + r.dx;
 		m.dy = l.dy + r.dy;
 		m.dz = l.dz + r.dz;
 	}
+	else if ( l.isIdentity )
+	{
+		// l is only a translation, but it still has to be rotated by r.
+		memcpy(&m.m, &r.m, sizeof(r.m));
+		
+		m.dx = l.dx * r.m[0][0] + l.dy * r.m[0][1] + l.dz * r.m[0][2] + r.dx;
+		m.dy = l.dx * r.m[1][0] + l.dy * r.m[1][1] + l.dz * r.m[1][2] + r.dy;
+		m.dz = l.dx * r.m[2][0] + l.dy * r.m[2][1] + l.dz * r.m[2][2] + r.dz;
+	}
 	else
 	{
 		if ( !r.isIdentity )
@@ -100,6 +113,39 @@ float Matrix3D_getDeterminant(Matrix3D* m)
 		 - m->m[0][0] * m->m[2][1] * m->m[1][2];
 }
 
+Matrix3D Matrix3D_inverse(Matrix3D m)
+{
+	Matrix3D r = { .isIdentity = m.isIdentity, .inverting = m.inverting };
+	
+	if ( m.isIdentity )
+	{
+		memcpy(&r.m, &m.m, sizeof(m.m));
+		r.dx = -m.dx;
+		r.dy = -m.dy;
+		r.dz = -m.dz;
+		return r;
+	}
+	
+	float d = 1.0f / Matrix3D_getDeterminant(&m);
+	
+	// adjugate divided by determinant
+	r.m[0][0] = (m.m[1][1] * m.m[2][2] - m.m[1][2] * m.m[2][1]) * d;
+	r.m[0][1] = (m.m[0][2] * m.m[2][1] - m.m[0][1] * m.m[2][2]) * d;
+	r.m[0][2] = (m.m[0][1] * m.m[1][2] - m.m[0][2] * m.m[1][1]) * d;
+	r.m[1][0] = (m.m[1][2] * m.m[2][0] - m.m[1][0] * m.m[2][2]) * d;
+	r.m[1][1] = (m.m[0][0] * m.m[2][2] - m.m[0][2] * m.m[2][0]) * d;
+	r.m[1][2] = (m.m[0][2] * m.m[1][0] - m.m[0][0] * m.m[1][2]) * d;
+	r.m[2][0] = (m.m[1][0] * m.m[2][1] - m.m[1][1] * m.m[2][0]) * d;
+	r.m[2][1] = (m.m[0][1] * m.m[2][0] - m.m[0][0] * m.m[2][1]) * d;
+	r.m[2][2] = (m.m[0][0] * m.m[1][1] - m.m[0][1] * m.m[1][0]) * d;
+	
+	r.dx = -(r.m[0][0] * m.dx + r.m[0][1] * m.dy + r.m[0][2] * m.dz);
+	r.dy = -(r.m[1][0] * m.dx + r.m[1][1] * m.dy + r.m[1][2] * m.dz);
+	r.dz = -(r.m[2][0] * m.dx + r.m[2][1] * m.dy + r.m[2][2] * m.dz);
+	
+	return r;
+}
+
 Vector3D Point3D_line_difference(Point3D* a, Point3D* b, Point3D* p)
 {
 	Vector3D line = Point3D_difference(a, b);
@@ -113,4 +159,241 @@ Vector3D Point3D_line_difference(Point3D* a, Point3D* b, Point3D* p)
 	diff.dy -= line.dy;
 	diff.dz -= line.dz;
 	return diff;
-}
\ No newline at end of file
+}
+float Matrix3D_getMaxScale(Matrix3D* m)
+{
+	if ( m->isIdentity )
+		return 1;
+	
+	// the largest eigenvalue of (M^T M) is the square of the largest stretch;
+	// bound it from above by the largest absolute row sum (Gershgorin).
+	float g[3][3];
+	
+	for ( int i = 0; i < 3; ++i )
+	{
+		for ( int j = 0; j < 3; ++j )
+			g[i][j] = m->m[0][i] * m->m[0][j] + m->m[1][i] * m->m[1][j] + m->m[2][i] * m->m[2][j];
+	}
+	
+	float best = 0;
+	
+	for ( int i = 0; i < 3; ++i )
+	{
+		float sum = fabsf(g[i][0]) + fabsf(g[i][1]) + fabsf(g[i][2]);
+		
+		if ( sum > best )
+			best = sum;
+	}
+	
+	return sqrtf(best);
+}
+
+Sphere3D Sphere3D_union(Sphere3D a, Sphere3D b)
+{
+	Vector3D d = Point3D_difference(&a.center, &b.center);
+	float dist = Vector3D_length(&d);
+	
+	// one sphere already contains the other
+	if ( dist + b.radius <= a.radius )
+		return a;
+	if ( dist + a.radius <= b.radius )
+		return b;
+	
+	float radius = (dist + a.radius + b.radius) / 2;
+	float t = (radius - a.radius) / dist;
+	
+	return (Sphere3D){
+		.center = Point3DMake(a.center.x + d.dx * t, a.center.y + d.dy * t, a.center.z + d.dz * t),
+		.radius = radius
+	};
+}
+
+Matrix3D Matrix3D_getNormalMatrix(Matrix3D m)
+{
+	Matrix3D r = { .isIdentity = 0, .inverting = m.inverting, .dx = 0, .dy = 0, .dz = 0 };
+	
+	r.m[0][0] = m.m[1][1] * m.m[2][2] - m.m[1][2] * m.m[2][1];
+	r.m[0][1] = m.m[1][2] * m.m[2][0] - m.m[1][0] * m.m[2][2];
+	r.m[0][2] = m.m[1][0] * m.m[2][1] - m.m[1][1] * m.m[2][0];
+	r.m[1][0] = m.m[0][2] * m.m[2][1] - m.m[0][1] * m.m[2][2];
+	r.m[1][1] = m.m[0][0] * m.m[2][2] - m.m[0][2] * m.m[2][0];
+	r.m[1][2] = m.m[0][1] * m.m[2][0] - m.m[0][0] * m.m[2][1];
+	r.m[2][0] = m.m[0][1] * m.m[1][2] - m.m[0][2] * m.m[1][1];
+	r.m[2][1] = m.m[0][2] * m.m[1][0] - m.m[0][0] * m.m[1][2];
+	r.m[2][2] = m.m[0][0] * m.m[1][1] - m.m[0][1] * m.m[1][0];
+	
+	return r;
+}
+
+// points are skipped (per the mask) in blocks of this many at a time.
+#define TRANSFORM_BLOCK 8
+
+// the scalar loops below are kept free of branches so that the compiler can vectorize them.
+// (the perspective loop divides on every lane, so it needs -fno-trapping-math for this.)
+static void
+transformRun(
+	const Matrix3D* restrict m, const float* restrict x, const float* restrict y, const float* restrict z, int n,
+	Point3D* restrict out, const Projection3D* projection
+)
+{
+	const float m00 = m->m[0][0], m01 = m->m[0][1], m02 = m->m[0][2];
+	const float m10 = m->m[1][0], m11 = m->m[1][1], m12 = m->m[1][2];
+	const float m20 = m->m[2][0], m21 = m->m[2][1], m22 = m->m[2][2];
+	const float dx = m->dx, dy = m->dy, dz = m->dz;
+	
+	int i = 0;
+	
+	const int project = projection != NULL;
+	const int perspective = project && projection->hasPerspective;
+	const float scale = project ? projection->scale : 1;
+	const float cx = project ? projection->centerx : 0;
+	const float cy = project ? projection->centery : 0;
+	const float nearz = perspective ? projection->nearz : 0;
+	
+#if TRANSFORM_SSE
+	const __m128 vm00 = _mm_set1_ps(m00), vm01 = _mm_set1_ps(m01), vm02 = _mm_set1_ps(m02);
+	const __m128 vm10 = _mm_set1_ps(m10), vm11 = _mm_set1_ps(m11), vm12 = _mm_set1_ps(m12);
+	const __m128 vm20 = _mm_set1_ps(m20), vm21 = _mm_set1_ps(m21), vm22 = _mm_set1_ps(m22);
+	const __m128 vdx = _mm_set1_ps(dx), vdy = _mm_set1_ps(dy), vdz = _mm_set1_ps(dz);
+	const __m128 vscale = _mm_set1_ps(scale), vcx = _mm_set1_ps(cx), vcy = _mm_set1_ps(cy);
+	const __m128 vnearz = _mm_set1_ps(nearz);
+	
+	for ( ; i + 4 <= n; i += 4 )
+	{
+		__m128 px = _mm_loadu_ps(x + i);
+		__m128 py = _mm_loadu_ps(y + i);
+		__m128 pz = _mm_loadu_ps(z + i);
+		
+		__m128 X = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, vm00), _mm_mul_ps(py, vm01)), _mm_add_ps(_mm_mul_ps(pz, vm02), vdx));
+		__m128 Y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, vm10), _mm_mul_ps(py, vm11)), _mm_add_ps(_mm_mul_ps(pz, vm12), vdy));
+		__m128 Z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, vm20), _mm_mul_ps(py, vm21)), _mm_add_ps(_mm_mul_ps(pz, vm22), vdz));
+		
+		if ( perspective )
+		{
+			__m128 front = _mm_cmpge_ps(Z, vnearz);
+			__m128 w = _mm_div_ps(vscale, Z);
+			__m128 sx = _mm_add_ps(_mm_mul_ps(X, w), vcx);
+			__m128 sy = _mm_add_ps(_mm_mul_ps(Y, w), vcy);
+			X = _mm_or_ps(_mm_and_ps(front, sx), _mm_andnot_ps(front, X));
+			Y = _mm_or_ps(_mm_and_ps(front, sy), _mm_andnot_ps(front, Y));
+		}
+		else if ( project )
+		{
+			X = _mm_add_ps(_mm_mul_ps(X, vscale), vcx);
+			Y = _mm_add_ps(_mm_mul_ps(Y, vscale), vcy);
+		}
+		
+		// to array-of-structures. Each 16-byte store spills into the next point's x,
+		// which is then overwritten; the last one is stored in pieces to stay in bounds.
+		__m128 W = X;
+		_MM_TRANSPOSE4_PS(X, Y, Z, W);
+		_mm_storeu_ps(&out[i].x, X);
+		_mm_storeu_ps(&out[i + 1].x, Y);
+		_mm_storeu_ps(&out[i + 2].x, Z);
+		_mm_storel_pi((__m64*)&out[i + 3].x, W);
+		_mm_store_ss(&out[i + 3].z, _mm_movehl_ps(W, W));
+	}
+#elif TRANSFORM_NEON
+	for ( ; i + 4 <= n; i += 4 )
+	{
+		float32x4_t px = vld1q_f32(x + i);
+		float32x4_t py = vld1q_f32(y + i);
+		float32x4_t pz = vld1q_f32(z + i);
+		float32x4x3_t p;
+		
+		p.val[0] = vfmaq_n_f32(vfmaq_n_f32(vfmaq_n_f32(vdupq_n_f32(dx), px, m00), py, m01), pz, m02);
+		p.val[1] = vfmaq_n_f32(vfmaq_n_f32(vfmaq_n_f32(vdupq_n_f32(dy), px, m10), py, m11), pz, m12);
+		p.val[2] = vfmaq_n_f32(vfmaq_n_f32(vfmaq_n_f32(vdupq_n_f32(dz), px, m20), py, m21), pz, m22);
+		
+		if ( perspective )
+		{
+			uint32x4_t front = vcgeq_f32(p.val[2], vdupq_n_f32(nearz));
+			float32x4_t w = vdivq_f32(vdupq_n_f32(scale), p.val[2]);
+			p.val[0] = vbslq_f32(front, vfmaq_f32(vdupq_n_f32(cx), p.val[0], w), p.val[0]);
+			p.val[1] = vbslq_f32(front, vfmaq_f32(vdupq_n_f32(cy), p.val[1], w), p.val[1]);
+		}
+		else if ( project )
+		{
+			p.val[0] = vfmaq_n_f32(vdupq_n_f32(cx), p.val[0], scale);
+			p.val[1] = vfmaq_n_f32(vdupq_n_f32(cy), p.val[1], scale);
+		}
+		
+		vst3q_f32(&out[i].x, p);
+	}
+#endif
+	
+	// scalar version (and remainder)
+	if ( perspective )
+	{
+		for ( ; i < n; ++i )
+		{
+			float X = x[i] * m00 + y[i] * m01 + z[i] * m02 + dx;
+			float Y = x[i] * m10 + y[i] * m11 + z[i] * m12 + dy;
+			float Z = x[i] * m20 + y[i] * m21 + z[i] * m22 + dz;
+			float w = scale / Z;
+			float sx = X * w + cx;
+			float sy = Y * w + cy;
+			out[i].x = (Z >= nearz) ? sx : X;
+			out[i].y = (Z >= nearz) ? sy : Y;
+			out[i].z = Z;
+		}
+	}
+	else
+	{
+		for ( ; i < n; ++i )
+		{
+			float X = x[i] * m00 + y[i] * m01 + z[i] * m02 + dx;
+			float Y = x[i] * m10 + y[i] * m11 + z[i] * m12 + dy;
+			float Z = x[i] * m20 + y[i] * m21 + z[i] * m22 + dz;
+			out[i].x = X * scale + cx;
+			out[i].y = Y * scale + cy;
+			out[i].z = Z;
+		}
+	}
+}
+
+static inline int
+transformBlockSkipped(const uint8_t* mask, int i, int n)
+{
+	int end = (i + TRANSFORM_BLOCK < n) ? i + TRANSFORM_BLOCK : n;
+	
+	for ( ; i < end; ++i )
+	{
+		if ( mask[i] )
+			return 0;
+	}
+	
+	return 1;
+}
+
+void Matrix3D_transformPoints(
+	Matrix3D m, const float* x, const float* y, const float* z, int n,
+	Point3D* out, const uint8_t* mask, const Projection3D* projection
+)
+{
+	if ( mask == NULL )
+	{
+		transformRun(&m, x, y, z, n, out, projection);
+		return;
+	}
+	
+	// transform consecutive runs of blocks which have any points in the mask.
+	int i = 0;
+	
+	while ( i < n )
+	{
+		while ( i < n && transformBlockSkipped(mask, i, n) )
+			i += TRANSFORM_BLOCK;
+		
+		int start = i;
+		
+		while ( i < n && !transformBlockSkipped(mask, i, n) )
+			i += TRANSFORM_BLOCK;
+		
+		if ( i > n )
+			i = n;
+		
+		if ( i > start )
+			transformRun(&m, x + start, y + start, z + start, i - start, out + start, projection);
+	}
+}
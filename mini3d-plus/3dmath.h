@@ -145,4 +145,55 @@ Point3D Matrix3D_apply(Matrix3D m, Point3D p);
 
 float Matrix3D_getDeterminant(Matrix3D* m);
 
+// m must be invertible (nonzero determinant).
+Matrix3D Matrix3D_inverse(Matrix3D m);
+
+// transforms face normals to match points transformed by m (up to length; normalize afterward).
+// This is the cofactor matrix of m; it has no translation.
+Matrix3D Matrix3D_getNormalMatrix(Matrix3D m);
+
+// like Matrix3D_apply, but ignores translation.
+static inline Vector3D Matrix3D_applyVector(Matrix3D* m, Vector3D v)
+{
+	return Vector3DMake(
+		v.dx * m->m[0][0] + v.dy * m->m[0][1] + v.dz * m->m[0][2],
+		v.dx * m->m[1][0] + v.dy * m->m[1][1] + v.dz * m->m[1][2],
+		v.dx * m->m[2][0] + v.dy * m->m[2][1] + v.dz * m->m[2][2]
+	);
+}
+
+// projection onto the screen, optionally applied by Matrix3D_transformPoints.
+typedef struct
+{
+	int hasPerspective;
+	float scale;
+	float centerx;
+	float centery;
+	
+	// (perspective only) points closer than this are left unprojected, as they need clipping.
+	float nearz;
+} Projection3D;
+
+// transforms n points, given as separate x, y and z arrays, by m, then
+// projects them if projection is not NULL. Results are written to out.
+// If mask is not NULL, points whose mask entry is zero may be skipped
+// (their entries in out are left undefined).
+void Matrix3D_transformPoints(
+	Matrix3D m, const float* x, const float* y, const float* z, int n,
+	Point3D* out, const uint8_t* mask, const Projection3D* projection
+);
+
+// upper bound on how much this matrix can lengthen a vector.
+// (exact for rotations and axis-aligned scales.)
+float Matrix3D_getMaxScale(Matrix3D* m);
+
+typedef struct
+{
+	Point3D center;
+	float radius;
+} Sphere3D;
+
+// smallest sphere containing both a and b
+Sphere3D Sphere3D_union(Sphere3D a, Sphere3D b);
+
 #endif
@@ -0,0 +1,197 @@
+//
+//  bake.c
+//  Extension
+//
+//  Renders a shape from several directions into one texture, making an imposter
+//  which can stand in for the shape when it's far away (see Shape3D_setImposter).
+//
+//  Each frame is drawn twice, over black and over white: the pixels the shape covers
+//  come out the same both times, and the rest become transparent.
+//
+
+#include "mini3d.h"
+#include "scene.h"
+
+#if ENABLE_SHAPE_IMPOSTERS
+
+#define PI 3.14159265f
+
+// bytes per row of the offscreen buffer (the renderer writes whole words)
+#define BAKE_ROWSTRIDE (((VIEWPORT_RIGHT + 31) / 32) * 4)
+
+// texture coordinates only have room for 1024 texels, so the sheet must be smaller than that
+#define BAKE_MAX_TEXTURE 512
+
+static int
+nextPowerOf2(int n)
+{
+	int p = 1;
+
+	while ( p < n )
+		p <<= 1;
+
+	return p;
+}
+
+static inline int
+getPixel(uint8_t* row, int x)
+{
+	return (row[x / 8] >> (7 - x % 8)) & 1;
+}
+
+static inline void
+setPixel(uint8_t* row, int x, int value)
+{
+	if ( value )
+		row[x / 8] |= 0x80 >> (x % 8);
+	else
+		row[x / 8] &= ~(0x80 >> (x % 8));
+}
+
+Imposter3D* Imposter3D_newFromShape(Shape3D* shape, int nYaw, int nPitch, int frameSize, Vector3D up, Vector3D forward)
+{
+	nYaw = MAX(nYaw, 1);
+	nPitch = MAX(nPitch, 1);
+
+	// textures must be square, with power of 2 sides, so the frames are too (and so is the grid of them).
+	int maxSize = 1;
+
+	while ( maxSize * 2 <= MIN(VIEWPORT_WIDTH, VIEWPORT_HEIGHT) )
+		maxSize <<= 1;
+
+	int columns = 1;
+
+	while ( columns * columns < nYaw * nPitch )
+		columns <<= 1;
+
+	maxSize = MIN(maxSize, BAKE_MAX_TEXTURE / columns);
+	frameSize = MIN(nextPowerOf2(MAX(frameSize, 2)), maxSize);
+
+	if ( frameSize < 2 )
+		return NULL;
+
+	int size = columns * frameSize;
+
+	LCDBitmap* bitmap = pd->graphics->newBitmap(size, size, kColorClear);
+	uint8_t* buffer = m3d_malloc(BAKE_ROWSTRIDE * VIEWPORT_BOTTOM);
+	Imposter3D* imposter = m3d_malloc(sizeof(Imposter3D));
+
+	if ( bitmap == NULL || buffer == NULL || imposter == NULL )
+	{
+		if ( bitmap != NULL )
+			pd->graphics->freeBitmap(bitmap);
+
+		m3d_free(buffer);
+		m3d_free(imposter);
+		return NULL;
+	}
+
+	int width, height, rowbytes;
+	uint8_t* mask;
+	uint8_t* data;
+	pd->graphics->getBitmapData(bitmap, &width, &height, &rowbytes, &mask, &data);
+
+	Imposter3D_init(imposter);
+	Imposter3D_setOrientation(imposter, up, forward);
+	Imposter3D_setFrames(imposter, columns, columns, nYaw, nPitch);
+	Imposter3D_setPosition(imposter, &shape->center);
+
+	up = imposter->up;
+	forward = imposter->forward;
+	Vector3D side = Vector3DCross(up, forward);
+
+	// leave a pixel around the shape, so frames don't bleed into each other
+	float radius = MAX(shape->radius, 1e-3f);
+	float scale = (frameSize / 2 - 1) / radius; // pixels per unit
+	float half = frameSize / 2 / scale;
+
+	Imposter3D_setRectangle(imposter, -half, -half, half, half);
+
+	Scene3D scene;
+	Scene3D_init(&scene);
+	Scene3DNode_addShape(Scene3D_getRootNode(&scene), shape);
+
+	for ( int frame = 0; frame < nYaw * nPitch; ++frame )
+	{
+		float yaw = 2 * PI * (frame % nYaw) / nYaw;
+		float pitch = (nPitch > 1) ? (PI / 2) * (frame / nYaw) / (nPitch - 1) : 0;
+
+		float cy = cosf(yaw), sy = sinf(yaw);
+		float cp = cosf(pitch), sp = sinf(pitch);
+
+		// towards the camera, and the level direction under it
+		Vector3D level = Vector3DMake(cy * forward.dx + sy * side.dx, cy * forward.dy + sy * side.dy, cy * forward.dz + sy * side.dz);
+		Vector3D view = Vector3DMake(cp * level.dx + sp * up.dx, cp * level.dy + sp * up.dy, cp * level.dz + sp * up.dz);
+
+		// the top of the frame is up, tilted back along with the camera (so it's still defined overhead)
+		Vector3D zenith = Vector3DMake(cp * up.dx - sp * level.dx, cp * up.dy - sp * level.dy, cp * up.dz - sp * level.dz);
+
+		// no perspective, so the distance only has to keep the shape past the near plane
+		float d = 2 * radius + 2 * CLIP_EPSILON;
+		Point3D origin = Point3DMake(shape->center.x + d * view.dx, shape->center.y + d * view.dy, shape->center.z + d * view.dz);
+
+		Scene3D_setCamera(&scene, origin, shape->center, 1, zenith);
+		scene.hasPerspective = 0;
+		scene.scale = scale;
+		scene.centerx = VIEWPORT_LEFT + frameSize / 2;
+		scene.centery = VIEWPORT_TOP + frameSize / 2;
+
+		// lit from above and a little in front, the same in every frame
+		Vector3D light = Vector3D_normalize(Vector3DMake(-2 * up.dx - forward.dx, -2 * up.dy - forward.dy, -2 * up.dz - forward.dz));
+		Scene3D_setGlobalLight(&scene, Matrix3D_applyVector(&scene.camera, light));
+
+		// over black, keeping the result in the frame's spot on the texture...
+		memset(buffer, 0x00, BAKE_ROWSTRIDE * VIEWPORT_BOTTOM);
+		Scene3D_draw(&scene, buffer, BAKE_ROWSTRIDE);
+
+		int fx = (frame % columns) * frameSize;
+		int fy = (frame / columns) * frameSize;
+
+		for ( int y = 0; y < frameSize; ++y )
+		{
+			uint8_t* src = buffer + (VIEWPORT_TOP + y) * BAKE_ROWSTRIDE;
+			uint8_t* dst = data + (fy + y) * rowbytes;
+
+			for ( int x = 0; x < frameSize; ++x )
+				setPixel(dst, fx + x, getPixel(src, VIEWPORT_LEFT + x));
+		}
+
+		if ( mask == NULL )
+			continue;
+
+		// ...then over white, and where the two differ the background showed through.
+		// (the scene only draws what's been updated, so it has to be marked as changed.)
+		memset(buffer, 0xff, BAKE_ROWSTRIDE * VIEWPORT_BOTTOM);
+		scene.root.needsUpdate = 1;
+		Scene3D_draw(&scene, buffer, BAKE_ROWSTRIDE);
+
+		for ( int y = 0; y < frameSize; ++y )
+		{
+			uint8_t* src = buffer + (VIEWPORT_TOP + y) * BAKE_ROWSTRIDE;
+			uint8_t* dst = data + (fy + y) * rowbytes;
+			uint8_t* dstmask = mask + (fy + y) * rowbytes;
+
+			for ( int x = 0; x < frameSize; ++x )
+				setPixel(dstmask, fx + x, getPixel(src, VIEWPORT_LEFT + x) == getPixel(dst, fx + x));
+		}
+	}
+
+	Scene3D_deinit(&scene);
+	m3d_free(buffer);
+
+	Texture* texture = Texture_fromLCDBitmap(bitmap);
+
+	if ( texture == NULL )
+	{
+		pd->graphics->freeBitmap(bitmap);
+		m3d_free(imposter);
+		return NULL;
+	}
+
+	Imposter3D_setBitmap(imposter, texture);
+	Texture_unref(texture);
+
+	return imposter;
+}
+
+#endif
@@ -0,0 +1,455 @@
+//
+//  bsp.c
+//  Extension
+//
+//  Builds a BSP tree over a shape's faces, so that they can be drawn back to front
+//  from any viewpoint without sorting. Faces which cross a splitting plane are cut in two.
+//
+
+#include "mini3d.h"
+#include "shape.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if ENABLE_BSP
+
+// number of faces tried as the splitting plane at each node.
+// More gives a better tree, but the build takes longer.
+#define BSP_CANDIDATES 16
+
+// most points a piece of a split face can have: a quad that isn't flat can cross the
+// plane on every edge, and each crossing adds a point to both pieces.
+#define BSP_SPLIT_MAX_POINTS 8
+
+// a face waiting to be put in the tree. (always a tri or a quad)
+typedef struct
+{
+	int n;
+	uint16_t p[4];
+	int src; // index of the original face, whose plane and attributes this keeps
+#if ENABLE_TEXTURES
+	Point2D t[4];
+#endif
+} BSPFace;
+
+typedef struct
+{
+	BSPFace* faces;
+	int n;
+	int capacity;
+} BSPFaceList;
+
+// a subtree still to be built
+typedef struct
+{
+	BSPFaceList list;
+	int parent; // -1 for the root
+	int isFront; // which of the parent's children this is
+	int depth;
+} BSPTask;
+
+typedef struct
+{
+	Shape3D* shape;
+	Face3D* src; // the shape's faces before the build
+#if ENABLE_TEXTURES
+	FaceTexture* srctex;
+	FaceTexture* texmap;
+#endif
+	float epsilon;
+
+	Face3D* faces;
+	int nFaces;
+	int faceCapacity;
+
+	BSPNode3D* nodes;
+	int nNodes;
+	int nodeCapacity;
+} BSPBuilder;
+
+static inline int
+classifyPoint(BSPBuilder* b, Face3D* plane, uint16_t p)
+{
+	Point3D* pt = &b->shape->points[p];
+	float dist = Vector3DDot(plane->normal, Vector3DMake(pt->x, pt->y, pt->z)) + plane->d;
+
+	return (dist > b->epsilon) ? 1 : (dist < -b->epsilon) ? -1 : 0;
+}
+
+// returns 1 if the face is entirely in front of the plane, -1 if behind, 0 if in it, 2 if it crosses it.
+static int
+classifyFace(BSPBuilder* b, Face3D* plane, BSPFace* face)
+{
+	int front = 0, back = 0;
+
+	for ( int i = 0; i < face->n; ++i )
+	{
+		int side = classifyPoint(b, plane, face->p[i]);
+		front |= (side > 0);
+		back |= (side < 0);
+	}
+
+	if ( front && back )
+		return 2;
+
+	return front ? 1 : back ? -1 : 0;
+}
+
+// picks the face whose plane splits the fewest others while keeping the two sides balanced.
+static int
+chooseSplitter(BSPBuilder* b, BSPFace* faces, int n)
+{
+	int step = (n > BSP_CANDIDATES) ? n / BSP_CANDIDATES : 1;
+	int best = 0;
+	int bestScore = -1;
+
+	for ( int c = 0; c < n; c += step )
+	{
+		Face3D* plane = &b->src[faces[c].src];
+		int front = 0, back = 0, split = 0;
+
+		for ( int i = 0; i < n; ++i )
+		{
+			switch ( classifyFace(b, plane, &faces[i]) )
+			{
+				case 1: ++front; break;
+				case -1: ++back; break;
+				case 2: ++split; break;
+			}
+		}
+
+		int score = split * 8 + abs(front - back);
+
+		if ( bestScore < 0 || score < bestScore )
+		{
+			best = c;
+			bestScore = score;
+		}
+	}
+
+	return best;
+}
+
+static void
+pushFace(BSPFaceList* list, BSPFace* face)
+{
+	if ( list->n >= list->capacity )
+	{
+		list->capacity = list->capacity * 2 + 16;
+		list->faces = m3d_realloc(list->faces, list->capacity * sizeof(BSPFace));
+	}
+
+	list->faces[list->n++] = *face;
+}
+
+// adds a polygon of up to BSP_SPLIT_MAX_POINTS points as a quad (or triangle) and,
+// if it has more than four, a fan of triangles for the rest.
+static void
+pushPolygon(BSPFaceList* list, BSPFace* proto, int np, uint16_t* p
+#if ENABLE_TEXTURES
+	, Point2D* t
+#endif
+)
+{
+	if ( np < 3 )
+		return;
+
+	BSPFace f = *proto;
+	f.n = MIN(np, 4);
+
+	for ( int i = 0; i < f.n; ++i )
+	{
+		f.p[i] = p[i];
+		#if ENABLE_TEXTURES
+		f.t[i] = t[i];
+		#endif
+	}
+
+	pushFace(list, &f);
+
+	// the rest of the fan: 0, k, k+1
+	for ( int k = 3; k + 1 < np; ++k )
+	{
+		f.n = 3;
+		f.p[1] = p[k];
+		f.p[2] = p[k + 1];
+		#if ENABLE_TEXTURES
+		f.t[1] = t[k];
+		f.t[2] = t[k + 1];
+		#endif
+
+		pushFace(list, &f);
+	}
+}
+
+// cuts the face along the plane, adding the pieces to the front and back lists.
+// The shape must have room for face->n more points (see canSplit).
+static void
+splitFace(BSPBuilder* b, Face3D* plane, BSPFace* face, BSPFaceList* front, BSPFaceList* back)
+{
+	uint16_t fp[BSP_SPLIT_MAX_POINTS], bp[BSP_SPLIT_MAX_POINTS];
+	int nf = 0, nb = 0;
+	#if ENABLE_TEXTURES
+	Point2D ft[BSP_SPLIT_MAX_POINTS], bt[BSP_SPLIT_MAX_POINTS];
+	#endif
+
+	for ( int i = 0; i < face->n; ++i )
+	{
+		int j = (i + 1) % face->n;
+		uint16_t a = face->p[i];
+		uint16_t c = face->p[j];
+		int sa = classifyPoint(b, plane, a);
+		int sc = classifyPoint(b, plane, c);
+
+		if ( sa >= 0 )
+		{
+			#if ENABLE_TEXTURES
+			ft[nf] = face->t[i];
+			#endif
+			fp[nf++] = a;
+		}
+
+		if ( sa <= 0 )
+		{
+			#if ENABLE_TEXTURES
+			bt[nb] = face->t[i];
+			#endif
+			bp[nb++] = a;
+		}
+
+		if ( sa * sc < 0 )
+		{
+			// edge crosses the plane: both pieces get the intersection point
+			Point3D* pa = &b->shape->points[a];
+			Point3D* pc = &b->shape->points[c];
+			float da = Vector3DDot(plane->normal, Vector3DMake(pa->x, pa->y, pa->z)) + plane->d;
+			float dc = Vector3DDot(plane->normal, Vector3DMake(pc->x, pc->y, pc->z)) + plane->d;
+			float s = da / (da - dc);
+
+			Point3D p = Point3DMake(pa->x + (pc->x - pa->x) * s, pa->y + (pc->y - pa->y) * s, pa->z + (pc->z - pa->z) * s);
+			uint16_t idx = Shape3D_addPoint(b->shape, &p);
+
+			#if ENABLE_TEXTURES
+			Point2D t = { face->t[i].x + (face->t[j].x - face->t[i].x) * s, face->t[i].y + (face->t[j].y - face->t[i].y) * s };
+			ft[nf] = t;
+			bt[nb] = t;
+			#endif
+			fp[nf++] = idx;
+			bp[nb++] = idx;
+		}
+	}
+
+	pushPolygon(front, face, nf, fp
+	#if ENABLE_TEXTURES
+		, ft
+	#endif
+	);
+	pushPolygon(back, face, nb, bp
+	#if ENABLE_TEXTURES
+		, bt
+	#endif
+	);
+}
+
+// point indices are 16 bits, and 0xffff marks a triangle's missing fourth point, so a face
+// is only split if the points for every crossing it could add still fit.
+static inline int
+canSplit(BSPBuilder* b, BSPFace* face)
+{
+	return b->shape->nPoints + face->n < 0xffff;
+}
+
+// adds a face to the shape's new face list.
+static void
+emitFace(BSPBuilder* b, BSPFace* face)
+{
+	if ( b->nFaces >= b->faceCapacity )
+	{
+		b->faceCapacity = b->faceCapacity * 2 + 16;
+		b->faces = m3d_realloc(b->faces, b->faceCapacity * sizeof(Face3D));
+		#if ENABLE_TEXTURES
+		if ( b->srctex != NULL )
+			b->texmap = m3d_realloc(b->texmap, b->faceCapacity * sizeof(FaceTexture));
+		#endif
+	}
+
+	Face3D* f = &b->faces[b->nFaces];
+	*f = b->src[face->src];
+	f->p1 = face->p[0];
+	f->p2 = face->p[1];
+	f->p3 = face->p[2];
+	f->p4 = (face->n == 4) ? face->p[3] : 0xffff;
+
+	#if ENABLE_TEXTURES
+	if ( b->srctex != NULL )
+	{
+		FaceTexture* ft = &b->texmap[b->nFaces];
+		*ft = b->srctex[face->src];
+		ft->t1 = face->t[0];
+		ft->t2 = face->t[1];
+		ft->t3 = face->t[2];
+		ft->t4 = face->t[3];
+	}
+	#endif
+
+	++b->nFaces;
+}
+
+static int
+newNode(BSPBuilder* b)
+{
+	if ( b->nNodes >= b->nodeCapacity )
+	{
+		b->nodeCapacity = b->nodeCapacity * 2 + 16;
+		b->nodes = m3d_realloc(b->nodes, b->nodeCapacity * sizeof(BSPNode3D));
+	}
+
+	return b->nNodes++;
+}
+
+void
+Shape3D_buildBSP(Shape3D* shape)
+{
+	if ( shape->bsp != NULL )
+	{
+		m3d_free(shape->bsp);
+		shape->bsp = NULL;
+		shape->nBSPNodes = 0;
+		shape->bspDepth = 0;
+	}
+
+	if ( shape->nFaces == 0 )
+		return;
+
+	BSPBuilder b;
+	memset(&b, 0, sizeof(b));
+	b.shape = shape;
+	b.src = shape->faces;
+	b.epsilon = 0.0001f * MAX(shape->radius, 1.0f);
+	#if ENABLE_TEXTURES
+	b.srctex = shape->texmap;
+	#endif
+
+	BSPFace* all = m3d_malloc(shape->nFaces * sizeof(BSPFace));
+
+	for ( int i = 0; i < shape->nFaces; ++i )
+	{
+		Face3D* f = &shape->faces[i];
+		BSPFace* face = &all[i];
+
+		face->n = (f->p4 != 0xffff) ? 4 : 3;
+		face->p[0] = f->p1;
+		face->p[1] = f->p2;
+		face->p[2] = f->p3;
+		face->p[3] = f->p4;
+		face->src = i;
+
+		#if ENABLE_TEXTURES
+		if ( b.srctex != NULL )
+		{
+			face->t[0] = b.srctex[i].t1;
+			face->t[1] = b.srctex[i].t2;
+			face->t[2] = b.srctex[i].t3;
+			face->t[3] = b.srctex[i].t4;
+		}
+		#endif
+	}
+
+	// build iteratively, as a degenerate tree can be as deep as there are faces.
+	BSPTask* tasks = m3d_malloc(sizeof(BSPTask));
+	int nTasks = 1;
+	int taskCapacity = 1;
+	int depth = 0;
+
+	tasks[0] = (BSPTask){ .list = { all, shape->nFaces, shape->nFaces }, .parent = -1, .isFront = 0, .depth = 1 };
+
+	while ( nTasks > 0 )
+	{
+		BSPTask task = tasks[--nTasks];
+		int idx = newNode(&b);
+
+		if ( task.parent >= 0 )
+		{
+			if ( task.isFront )
+				b.nodes[task.parent].front = idx;
+			else
+				b.nodes[task.parent].back = idx;
+		}
+
+		if ( task.depth > depth )
+			depth = task.depth;
+
+		BSPFace* faces = task.list.faces;
+		int splitter = chooseSplitter(&b, faces, task.list.n);
+		Face3D* plane = &b.src[faces[splitter].src];
+
+		BSPNode3D* node = &b.nodes[idx];
+		node->normal = plane->normal;
+		node->d = plane->d;
+		node->face = b.nFaces;
+		node->front = -1;
+		node->back = -1;
+
+		BSPFaceList front = { NULL, 0, 0 };
+		BSPFaceList back = { NULL, 0, 0 };
+
+		for ( int i = 0; i < task.list.n; ++i )
+		{
+			BSPFace* face = &faces[i];
+
+			// (the splitter always goes in this node, even if it's a quad that isn't quite flat.)
+			switch ( (i == splitter) ? 0 : classifyFace(&b, plane, face) )
+			{
+				case 0: emitFace(&b, face); break;
+				case 1: pushFace(&front, face); break;
+				case -1: pushFace(&back, face); break;
+				case 2:
+					if ( canSplit(&b, face) )
+						splitFace(&b, plane, face, &front, &back);
+					else
+						emitFace(&b, face); // (out of points, so it's drawn with the splitter, uncut)
+					break;
+			}
+		}
+
+		b.nodes[idx].nFaces = b.nFaces - b.nodes[idx].face;
+		m3d_free(faces);
+
+		if ( nTasks + 2 > taskCapacity )
+		{
+			taskCapacity = taskCapacity * 2 + 2;
+			tasks = m3d_realloc(tasks, taskCapacity * sizeof(BSPTask));
+		}
+
+		if ( front.n > 0 )
+			tasks[nTasks++] = (BSPTask){ .list = front, .parent = idx, .isFront = 1, .depth = task.depth + 1 };
+
+		if ( back.n > 0 )
+			tasks[nTasks++] = (BSPTask){ .list = back, .parent = idx, .isFront = 0, .depth = task.depth + 1 };
+	}
+
+	m3d_free(tasks);
+
+	// replace the shape's faces with the (possibly split) faces in tree order
+	m3d_free(shape->faces);
+	shape->faces = b.faces;
+	shape->nFaces = b.nFaces;
+
+	#if ENABLE_TEXTURES
+	if ( b.srctex != NULL )
+	{
+		m3d_free(shape->texmap);
+		shape->texmap = b.texmap;
+	}
+	#endif
+
+	shape->bsp = b.nodes;
+	shape->nBSPNodes = b.nNodes;
+	shape->bspDepth = depth;
+
+	// instances already in a scene set up their faces and traversal stack again when next updated.
+	++shape->version;
+}
+
+#endif
@@ -10,6 +10,8 @@
 #include "imposter.h"
 #include "pattern.h"
 
+#define PI 3.14159265f
+
 void Imposter3D_init(Imposter3D* imposter)
 {	
 	imposter->retainCount = 0;
@@ -31,6 +33,12 @@ void Imposter3D_init(Imposter3D* imposter)
 	
 	#if ENABLE_TEXTURES
 	imposter->bitmap = NULL;
+	imposter->frameColumns = 1;
+	imposter->frameRows = 1;
+	imposter->nYaw = 1;
+	imposter->nPitch = 1;
+	imposter->up = Vector3DMake(0, 0, 1);
+	imposter->forward = Vector3DMake(1, 0, 0);
 	
 	#if ENABLE_TEXTURES_GREYSCALE
 	imposter->lighting = 0;
@@ -53,8 +61,6 @@ void Imposter3D_release(Imposter3D* imposter)
 	if ( --imposter->retainCount > 0 )
 		return;
 	
-	m3d_free(imposter);
-	
 	#if ENABLE_TEXTURES
 	if (imposter->bitmap)
 		Texture_unref(imposter->bitmap);
@@ -63,6 +69,8 @@ void Imposter3D_release(Imposter3D* imposter)
 	#if ENABLE_CUSTOM_PATTERNS
 	Pattern_unref(imposter->pattern);
 	#endif
+	
+	m3d_free(imposter);
 }
 
 void Imposter3D_setPosition(Imposter3D* imposter, Point3D* position)
@@ -94,6 +102,58 @@ void Imposter3D_setBitmap(Imposter3D* imposter, Texture* bitmap)
 	imposter->bitmap = bitmap;
 }
 
+void Imposter3D_setFrames(Imposter3D* imposter, int columns, int rows, int nYaw, int nPitch)
+{
+	imposter->frameColumns = MAX(columns, 1);
+	imposter->frameRows = MAX(rows, 1);
+	imposter->nYaw = MAX(nYaw, 1);
+	imposter->nPitch = MAX(nPitch, 1);
+}
+
+void Imposter3D_setOrientation(Imposter3D* imposter, Vector3D up, Vector3D forward)
+{
+	up = Vector3D_normalize(up);
+	
+	// keep the part of forward perpendicular to up
+	float d = Vector3DDot(forward, up);
+	forward = Vector3DMake(forward.dx - d * up.dx, forward.dy - d * up.dy, forward.dz - d * up.dz);
+	
+	imposter->up = up;
+	imposter->forward = Vector3D_normalize(forward);
+}
+
+int Imposter3D_getFrame(Imposter3D* imposter, Vector3D view)
+{
+	int nYaw = imposter->nYaw;
+	int nPitch = imposter->nPitch;
+	
+	if ( nYaw == 1 && nPitch == 1 )
+		return 0;
+	
+	Vector3D side = Vector3DCross(imposter->up, imposter->forward);
+	float f = Vector3DDot(view, imposter->forward);
+	float s = Vector3DDot(view, side);
+	int yaw = 0;
+	int pitch = 0;
+	
+	if ( nYaw > 1 )
+	{
+		yaw = (int)floorf(atan2f(s, f) * nYaw / (2 * PI) + 0.5f) % nYaw;
+		
+		if ( yaw < 0 )
+			yaw += nYaw;
+	}
+	
+	if ( nPitch > 1 )
+	{
+		float elevation = atan2f(Vector3DDot(view, imposter->up), sqrtf(f * f + s * s));
+		pitch = CLAMP(0, nPitch - 1, (int)floorf(elevation * (nPitch - 1) / (PI / 2) + 0.5f));
+	}
+	
+	// (views which don't fit on the texture get the last frame)
+	return MIN(pitch * nYaw + yaw, imposter->frameColumns * imposter->frameRows - 1);
+}
+
 #if ENABLE_TEXTURES_GREYSCALE
 void Imposter3D_setLighting(
 	Imposter3D* imposter, float lighting
@@ -8,7 +8,7 @@
 
 typedef LCDBitmap LCDBitmap;
 
-typedef struct
+typedef struct Imposter3D
 {
     int retainCount;
     Point3D center;
@@ -21,6 +21,17 @@ typedef struct
     
     #if ENABLE_TEXTURES
     Texture* bitmap; // FIXME: rename to 'texture'
+    
+    // the texture can be a grid of equal frames, numbered left to right and then top to bottom,
+    // each showing the view from a different direction (see Imposter3D_setFrames).
+    int frameColumns;
+    int frameRows;
+    int nYaw;
+    int nPitch;
+    
+    // in the object space of the imposter's instances, yaw is measured around up, starting from forward.
+    Vector3D up;
+    Vector3D forward;
     #if ENABLE_TEXTURES_GREYSCALE
     float lighting;
     #endif
@@ -42,6 +53,15 @@ void Imposter3D_setZOffsets(Imposter3D* imposter, float z1, float z2, float z3,
 // FIXME: rename to ..._setTexture
 void Imposter3D_setBitmap(Imposter3D* imposter, Texture* bitmap);
 
+// divides the texture into columns x rows frames. The first nYaw * nPitch are views from nYaw directions
+// evenly spaced around the up axis (the first from forward, the next turned towards up x forward),
+// for each of nPitch elevations evenly spaced from level to overhead (just level if nPitch is 1).
+void Imposter3D_setFrames(Imposter3D* imposter, int columns, int rows, int nYaw, int nPitch);
+void Imposter3D_setOrientation(Imposter3D* imposter, Vector3D up, Vector3D forward);
+
+// the frame to show when seen from direction view (pointing towards the viewer, in object space).
+int Imposter3D_getFrame(Imposter3D* imposter, Vector3D view);
+
 #if ENABLE_TEXTURES_GREYSCALE
 void Imposter3D_setLighting(
 	Imposter3D* imposter, float lighting
@@ -26,3 +26,155 @@ void mini3d_setRealloc(void* (*realloc)(void* ptr, size_t size))
 {
 	m3d_realloc = realloc;
 }
+
+// keeps every allocation aligned for any type we put in it
+#define ARENA_ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+typedef struct ArenaOverflow
+{
+	struct ArenaOverflow* next;
+	uint64_t data[];
+} ArenaOverflow;
+
+void
+FrameArena_init(FrameArena* arena)
+{
+	arena->base = NULL;
+	arena->capacity = 0;
+	arena->used = 0;
+	arena->highWater = 0;
+	arena->overflow = NULL;
+}
+
+static void
+FrameArena_freeOverflow(FrameArena* arena)
+{
+	ArenaOverflow* block = arena->overflow;
+	
+	while ( block != NULL )
+	{
+		ArenaOverflow* next = block->next;
+		m3d_free(block);
+		block = next;
+	}
+	
+	arena->overflow = NULL;
+}
+
+void
+FrameArena_deinit(FrameArena* arena)
+{
+	FrameArena_freeOverflow(arena);
+	
+	if ( arena->base != NULL )
+		m3d_free(arena->base);
+	
+	FrameArena_init(arena);
+}
+
+void
+FrameArena_reset(FrameArena* arena)
+{
+	if ( arena->overflow != NULL )
+	{
+		// last frame didn't fit, so make room for all of it in one block.
+		// (nothing in the arena is live anymore, so there's no need to copy.)
+		FrameArena_freeOverflow(arena);
+		
+		if ( arena->base != NULL )
+			m3d_free(arena->base);
+		
+		arena->capacity = arena->highWater;
+		arena->base = m3d_malloc(arena->capacity);
+	}
+	
+	arena->used = 0;
+}
+
+void*
+FrameArena_alloc(FrameArena* arena, size_t size)
+{
+	size = ARENA_ALIGN(size);
+	
+	void* ptr;
+	
+	if ( arena->overflow == NULL && arena->used + size <= arena->capacity )
+	{
+		ptr = arena->base + arena->used;
+	}
+	else
+	{
+		ArenaOverflow* block = m3d_malloc(sizeof(ArenaOverflow) + size);
+		block->next = arena->overflow;
+		arena->overflow = block;
+		ptr = block->data;
+	}
+	
+	arena->used += size;
+	
+	if ( arena->used > arena->highWater )
+		arena->highWater = arena->used;
+	
+	return ptr;
+}
+
+void*
+FrameArena_grow(FrameArena* arena, void* ptr, size_t oldsize, size_t newsize)
+{
+	if ( ptr == NULL )
+		return FrameArena_alloc(arena, newsize);
+	
+	oldsize = ARENA_ALIGN(oldsize);
+	newsize = ARENA_ALIGN(newsize);
+	
+	if ( newsize <= oldsize )
+		return ptr;
+	
+	// the last thing allocated from base can just be extended
+	if ( arena->overflow == NULL && (uint8_t*)ptr + oldsize == arena->base + arena->used
+		&& arena->used - oldsize + newsize <= arena->capacity )
+	{
+		arena->used += newsize - oldsize;
+		
+		if ( arena->used > arena->highWater )
+			arena->highWater = arena->used;
+		
+		return ptr;
+	}
+	
+	void* newptr = FrameArena_alloc(arena, newsize);
+	memcpy(newptr, ptr, oldsize);
+	return newptr;
+}
+
+void*
+ObjectPool_alloc(ObjectPool* pool)
+{
+	if ( pool->freeList == NULL )
+	{
+		size_t size = ARENA_ALIGN(MAX(pool->itemSize, sizeof(void*)));
+		uint8_t* block = m3d_malloc(sizeof(uint64_t) + size * pool->itemsPerBlock);
+		
+		*(void**)block = pool->blocks;
+		pool->blocks = block;
+		
+		// push in reverse, so items are handed out in address order
+		for ( int i = pool->itemsPerBlock - 1; i >= 0; --i )
+		{
+			void** item = (void**)(block + sizeof(uint64_t) + i * size);
+			*item = pool->freeList;
+			pool->freeList = item;
+		}
+	}
+	
+	void** item = pool->freeList;
+	pool->freeList = *item;
+	return item;
+}
+
+void
+ObjectPool_free(ObjectPool* pool, void* ptr)
+{
+	*(void**)ptr = pool->freeList;
+	pool->freeList = ptr;
+}
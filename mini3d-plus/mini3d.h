@@ -40,6 +40,22 @@
     #define ENABLE_Z_BUFFER 0
 #endif
 
+// The S-buffer (span buffer) is a third option, turned on per scene with Scene3D_setUsesSBuffer
+// (scene:setUsesSBuffer() in Lua). Faces are drawn front to back, and each row remembers which spans
+// have been drawn already, so every pixel is written at most once and hidden triangles are skipped
+// before any texture setup. Ordering is the same as SORT_3D_FACES_BY_Z (which it requires),
+// and the Z buffer is not used while it's on. Masked textures have holes, so they're clipped to
+// what's been drawn but don't add to it, and from the nearest masked face back, faces are drawn
+// back to front instead.
+#ifndef ENABLE_S_BUFFER
+    #define ENABLE_S_BUFFER 1
+#endif
+
+// spans each row has room for up front. A row that runs out gets more from a pool that grows as needed.
+#ifndef SBUFFER_SPANS
+    #define SBUFFER_SPANS 32
+#endif
+
 // Ordering Tables are per-shape and only apply to individual shapes.
 // It also requires setting the order table size D on every shape manually.
 // Instead of sorting, we hash faces into D buckets
@@ -49,6 +65,21 @@
     #define ENABLE_ORDERING_TABLE 0
 #endif
 
+// Shapes can be given a BSP tree with Shape3D_buildBSP (shape:buildBSP() in Lua), after which
+// their faces are always drawn in the correct back-to-front order, even if they intersect,
+// without sorting and without the Z-buffer. Faces which cross a splitting plane are cut, so the
+// shape gains some faces. Best for static scenery such as a track or a level.
+// (With SORT_3D_FACES_BY_Z, such a shape is sorted among other faces as a single unit, by its farthest extent.)
+#ifndef ENABLE_BSP
+    #define ENABLE_BSP 1
+#endif
+
+// Shapes can be given simpler versions with Shape3D_addLOD (shape:addLOD() in Lua), which are drawn
+// instead when the shape is small on screen. Shape3D_newSimplified (shape:newSimplified()) makes them.
+#ifndef ENABLE_LOD
+    #define ENABLE_LOD 1
+#endif
+
 // Draw shapes in a scene back-to-front quicksorted by their z values
 // This is a crude version of the painter's algorithm and should probably not be used
 // If a shape contains multiple faces, this does not solve the problem of ordering those faces.
@@ -56,12 +87,51 @@
     #define SORT_3D_INSTANCES_BY_Z 0
 #endif
 
-// Draw faces in a scene back-to-front quicksorted by their z values
+// Draw faces in a scene back-to-front sorted by their z values
 // More expensive than the above.
-#ifndef SORT_
+#ifndef SORT_3D_FACES_BY_Z
     #define SORT_3D_FACES_BY_Z 1
 #endif
 
+// How SORT_3D_FACES_BY_Z sorts the faces:
+// 0: quicksort
+// 1: radix sort (stable, and linear time, but needs a scratch buffer as large as the face list.)
+//    Lists shorter than FACE_RADIX_SORT_MIN are quicksorted anyway, as that's faster for them.
+//    (see bench/sort.c to measure where the crossover lies.)
+#ifndef FACE_RADIX_SORT
+    #define FACE_RADIX_SORT 1
+#endif
+
+#ifndef FACE_RADIX_SORT_MIN
+    #define FACE_RADIX_SORT_MIN 1024
+#endif
+
+// Faces don't usually move much in the sort order from one frame to the next.
+// If this is enabled, SORT_3D_FACES_BY_Z first puts faces back in the order they had
+// last frame and insertion-sorts from there, which is close to linear when little has changed.
+// If that would take more than FACE_SORT_COHERENT_MAX_MOVES moves per face on average
+// (e.g. after the camera jumps), it gives up and does a full sort instead.
+#ifndef FACE_SORT_COHERENT
+    #define FACE_SORT_COHERENT 1
+#endif
+
+#ifndef FACE_SORT_COHERENT_MAX_MOVES
+    #define FACE_SORT_COHERENT_MAX_MOVES 4
+#endif
+
+// Scene-wide ordering table: an approximate, cheaper alternative to sorting the
+// SORT_3D_FACES_BY_Z face list. Faces and imposters from every shape are hashed into
+// D buckets spanning the frame's zmin to zmax, in O(n).
+// Off until D is set with Scene3D_setOrderTableSize (scene:setOrderTableSize() in Lua);
+// SCENE_ORDERING_TABLE_SIZE is the initial value of D.
+#ifndef ENABLE_SCENE_ORDERING_TABLE
+    #define ENABLE_SCENE_ORDERING_TABLE 1
+#endif
+
+#ifndef SCENE_ORDERING_TABLE_SIZE
+    #define SCENE_ORDERING_TABLE_SIZE 0
+#endif
+
 // ------
 
 // viewport bounds
@@ -91,6 +161,13 @@
     #define ENABLE_TEXTURES 1
 #endif
 
+// shapes can be rendered into a texture of views from several angles (Imposter3D_newFromShape),
+// and be drawn as that imposter when further than a given distance (Shape3D_setImposter).
+// (requires ENABLE_TEXTURES)
+#ifndef ENABLE_SHAPE_IMPOSTERS
+    #define ENABLE_SHAPE_IMPOSTERS 1
+#endif
+
 // allow textures to have non-opaque pixels
 #ifndef ENABLE_TEXTURES_MASK
     #define ENABLE_TEXTURES_MASK 1
@@ -192,6 +269,31 @@
     #define CLIP_EPSILON 0.75f
 #endif  
 
+// faces reaching more than GUARD_BAND pixels past the sides of the view are clipped
+// to that band before they're drawn, so huge faces don't reach the rasterizer
+// (or overflow its fixed-point math). Faces inside the band are drawn as they are.
+#ifndef GUARD_BAND_CLIPPING
+    #define GUARD_BAND_CLIPPING 1
+#endif
+
+#ifndef GUARD_BAND
+    #define GUARD_BAND 256
+#endif
+
+// skip transforming and drawing shapes (and entire nodes) whose bounding spheres
+// lie completely outside of the view, or beyond the far distance set
+// by lua: scene:setFarDistance()
+#ifndef ENABLE_FRUSTUM_CULLING
+    #define ENABLE_FRUSTUM_CULLING 1
+#endif
+
+// for closed shapes, reject back faces before any vertices are transformed
+// by comparing each face's plane against the camera position in the shape's own space.
+// Only vertices belonging to the remaining faces are then transformed and projected.
+#ifndef ENABLE_EARLY_BACKFACE_CULLING
+    #define ENABLE_EARLY_BACKFACE_CULLING 1
+#endif
+
 // do not render anything beyond a distance specified
 // by lua: mini3d.renderer.setRenderDistance()
 // set this to 2 to enable only for textured surfaces
@@ -223,11 +325,23 @@
     #define Z_BUFFER_FRAME_PARITY 0
 #endif
 
-// comment this out to use an 8-bit z-buffer, which is faster but less accurate.
-#if !defined(ZBU32) && !defined(ZBUF16) && !defined(ZBUF8)
+// instead of clearing the whole z buffer each frame, clear each row the first time it's drawn to.
+// (rows nothing z-buffered touches are never cleared at all.)
+#ifndef Z_BUFFER_LAZY_CLEAR
+    #define Z_BUFFER_LAZY_CLEAR 1
+#endif
+
+// default z-buffer format. 8-bit is faster; 16- and 32-bit are more accurate (define ZBUF16 or ZBUF32 instead).
+#if !defined(ZBUF32) && !defined(ZBUF16) && !defined(ZBUF8)
     #define ZBUF8
 #endif
 
+// build the z-buffered rasterizers for all of 8-, 16- and 32-bit depth, so each scene can choose.
+// (otherwise only the default format above is built, which saves code space.)
+#ifndef Z_BUFFER_ALL_FORMATS
+    #define Z_BUFFER_ALL_FORMATS 1
+#endif
+
 // distance fog to smoothly fade out objects in the distance to a particular tone.
 // requires Z-based rendering.
 #ifndef ENABLE_DISTANCE_FOG
@@ -239,6 +353,12 @@
     #define ENABLE_ZRENDERSKIP 1
 #endif
 
+// count what each frame does (faces culled and clipped, pixels written, etc.; see RenderStats in render.h),
+// readable from Lua as lib3d.stats. The counting slows rendering a little, so it's off unless needed.
+#ifndef ENABLE_RENDER_STATS
+    #define ENABLE_RENDER_STATS 0
+#endif
+
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
@@ -250,6 +370,41 @@ void m3d_free(void* ptr);
 
 void mini3d_setRealloc(void* (*realloc)(void* ptr, size_t size));
 
+// Bump allocator for data which only lives until the next reset (e.g. a scene's face list, reset
+// each Scene3D_draw). Memory is kept between resets; if a frame needs more than there is,
+// the extra comes from the heap and the arena grows to the high-water mark at the next reset.
+typedef struct
+{
+	uint8_t* base;
+	size_t capacity;
+	size_t used; // bytes allocated since the last reset, including overflow
+	size_t highWater; // most bytes used between two resets
+	void* overflow; // heap blocks allocated when base was full
+} FrameArena;
+
+void FrameArena_init(FrameArena* arena);
+void FrameArena_deinit(FrameArena* arena);
+void FrameArena_reset(FrameArena* arena);
+void* FrameArena_alloc(FrameArena* arena, size_t size);
+
+// like realloc. Grows in place if ptr was the last allocation; otherwise copies.
+void* FrameArena_grow(FrameArena* arena, void* ptr, size_t oldsize, size_t newsize);
+
+// Fixed-size allocator for objects which are created and destroyed often (e.g. scene nodes).
+// Objects come from blocks of itemsPerBlock, and freed ones are reused. Blocks are never returned to the heap.
+typedef struct
+{
+	size_t itemSize;
+	int itemsPerBlock;
+	void* freeList; // free items, each pointing to the next
+	void* blocks; // all blocks, each pointing to the next
+} ObjectPool;
+
+#define OBJECTPOOL_INIT(type, count) { .itemSize = sizeof(type), .itemsPerBlock = (count), .freeList = NULL, .blocks = NULL }
+
+void* ObjectPool_alloc(ObjectPool* pool);
+void ObjectPool_free(ObjectPool* pool, void* ptr);
+
 #define VIEWPORT_WIDTH (VIEWPORT_RIGHT - VIEWPORT_LEFT)
 #define VIEWPORT_HEIGHT (VIEWPORT_BOTTOM - VIEWPORT_TOP)
 
@@ -288,12 +443,38 @@ int mini3d_eventHandler(PlaydateAPI* playdate, PDSystemEvent event, uint32_t arg
 
 // sanity checks
 
-#if SORT_3D_INSTANCES_BY_Z && SORT_FACES_BY_Z
-    #error "Cannot have both SORT_3D_INSTANCES_BY_Z and SORT_FACES_BY_Z"
+#if SORT_3D_INSTANCES_BY_Z && SORT_3D_FACES_BY_Z
+    #error "Cannot have both SORT_3D_INSTANCES_BY_Z and SORT_3D_FACES_BY_Z"
+#endif
+
+#if SORT_3D_FACES_BY_Z && ENABLE_ORDERING_TABLE
+    #error "Cannot have both ENABLE_ORDERING_TABLE and SORT_3D_FACES_BY_Z"
+#endif
+
+#if !SORT_3D_FACES_BY_Z
+    // these work on the face sort list.
+    #undef ENABLE_SCENE_ORDERING_TABLE
+    #define ENABLE_SCENE_ORDERING_TABLE 0
+    #undef ENABLE_S_BUFFER
+    #define ENABLE_S_BUFFER 0
+#endif
+
+#if !FACE_CLIPPING
+    // the pieces are stored as clipped faces.
+    #undef GUARD_BAND_CLIPPING
+    #define GUARD_BAND_CLIPPING 0
+#endif
+
+#if Z_BUFFER_FRAME_PARITY
+    // parity already avoids the clear.
+    #undef Z_BUFFER_LAZY_CLEAR
+    #define Z_BUFFER_LAZY_CLEAR 0
 #endif
 
-#if SORT_FACES_BY_Z && ENABLE_ORDERING_TABLE
-    #error "Cannot have both ENABLE_ORDERING_TABLE and SORT_FACES_BY_Z"
+#if !ENABLE_TEXTURES
+    // baked imposters are textures.
+    #undef ENABLE_SHAPE_IMPOSTERS
+    #define ENABLE_SHAPE_IMPOSTERS 0
 #endif
 
 #endif /* mini3d_h */
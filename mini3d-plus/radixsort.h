@@ -0,0 +1,80 @@
+//
+//  radixsort.h
+//  Extension
+//
+//  Stable least-significant-digit radix sort on 32-bit keys, 8 bits per pass.
+//
+//  Synopsis:
+//      RADIXSORT(T, N, A, B, KEY);
+//  where
+//      T - the element type;
+//      N - the number of elements in A[];
+//      A - the array to sort (a T* lvalue; it is swapped with B during sorting);
+//      B - scratch space for at least N elements (a T* lvalue);
+//      KEY(e) - the uint32_t sort key of element e (of type T).
+//
+//  Elements are sorted into increasing key order, and elements with equal keys keep
+//  their relative order. On return A points to the sorted elements, which may be either
+//  of the two buffers; B points to the other one.
+//  Passes over digits which are the same for every key are skipped.
+//
+
+#ifndef radixsort_h
+#define radixsort_h
+
+#include <stdint.h>
+#include <string.h>
+
+// maps a float to a uint32 such that the order of the floats is preserved (NaN excluded).
+static inline uint32_t radix_key_float(float f)
+{
+	union {
+		float f;
+		uint32_t u;
+	} conv;
+
+	conv.f = f;
+
+	// negative: flip every bit (reverses their order). positive: flip the sign bit.
+	return conv.u ^ ((uint32_t)-(int32_t)(conv.u >> 31) | 0x80000000u);
+}
+
+#define RADIXSORT(T, N, A, B, KEY) \
+do { \
+	uint32_t r_count[4][256]; \
+	size_t r_n = (N); \
+	memset(r_count, 0, sizeof(r_count)); \
+	for ( size_t r_i = 0; r_i < r_n; ++r_i ) \
+	{ \
+		uint32_t r_key = KEY((A)[r_i]); \
+		++r_count[0][r_key & 0xff]; \
+		++r_count[1][(r_key >> 8) & 0xff]; \
+		++r_count[2][(r_key >> 16) & 0xff]; \
+		++r_count[3][r_key >> 24]; \
+	} \
+	for ( int r_pass = 0; r_pass < 4; ++r_pass ) \
+	{ \
+		uint32_t* r_c = r_count[r_pass]; \
+		int r_shift = r_pass * 8; \
+		/* every key has the same digit here; this pass would not move anything. */ \
+		if ( r_n == 0 || r_c[(KEY((A)[0]) >> r_shift) & 0xff] == r_n ) \
+			continue; \
+		uint32_t r_sum = 0; \
+		for ( int r_d = 0; r_d < 256; ++r_d ) \
+		{ \
+			uint32_t r_t = r_c[r_d]; \
+			r_c[r_d] = r_sum; \
+			r_sum += r_t; \
+		} \
+		for ( size_t r_i = 0; r_i < r_n; ++r_i ) \
+		{ \
+			uint32_t r_key = KEY((A)[r_i]); \
+			(B)[r_c[(r_key >> r_shift) & 0xff]++] = (A)[r_i]; \
+		} \
+		T* r_swap = (A); \
+		(A) = (B); \
+		(B) = r_swap; \
+	} \
+} while (0)
+
+#endif /* radixsort_h */
@@ -70,6 +70,15 @@ Pattern patterns[LIGHTING_PATTERN_COUNT] =
 	{ 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff }
 };
 
+#if ENABLE_RENDER_STATS
+RenderStats renderStats;
+
+void resetRenderStats(void)
+{
+	memset(&renderStats, 0, sizeof(renderStats));
+}
+#endif
+
 #if ENABLE_RENDER_DISTANCE_MAX
 float render_distance_max = 100000000000000.0f;
 void setRenderDistanceMax(float f)
@@ -85,6 +94,16 @@ render_distance_bounds(Point3D* p1, Point3D* p2, Point3D* p3)
 {
 	return p1->z > render_distance_max && p2->z > render_distance_max && p3->z > render_distance_max;
 }
+
+static inline int
+render_distance_bounds_polygon(Point3D* points, int n)
+{
+	for ( int i = 0; i < n; ++i )
+		if ( points[i].z <= render_distance_max )
+			return 0;
+	
+	return 1;
+}
 #endif
 
 #if ENABLE_TEXTURES && TEXTURE_PERSPECTIVE_MAPPING && PRECOMPUTE_PROJECTION
@@ -182,20 +201,23 @@ scanlinePermitsRow(int y, ScanlineFill* scanline)
 }
 #endif
 
-#ifdef ZBUF32
-	// this doesn't seem to work at all.
-	// not sure why.
-	typedef uint32_t zbuf_t;
-	#define ZSCALE_MULT 0xffffffff
-	#define ZSHIFT 0
+// z coordinates are fixed-point, with the near plane at ZSCALE_MULT (just under 1<<31).
+// The z buffer keeps the top 8, 16 or 32 bits of them.
+#define ZSCALE_MULT ((float)0x7fffff80)
+#define ZSHIFT 0
+
+#if defined(ZBUF32)
+	#define ZBUF_DEFAULT_BITS 32
 #elif defined(ZBUF16)
-	typedef uint16_t zbuf_t;
-	#define ZSCALE_MULT 0xffff
-	#define ZSHIFT 16
+	#define ZBUF_DEFAULT_BITS 16
 #else
-	typedef uint8_t zbuf_t;
-	#define ZSCALE_MULT 0xff
-	#define ZSHIFT 16
+	#define ZBUF_DEFAULT_BITS 8
+#endif
+
+#if Z_BUFFER_ALL_FORMATS
+	#define ZBUF_HAS_FORMAT(bits) 1
+#else
+	#define ZBUF_HAS_FORMAT(bits) ((bits) == ZBUF_DEFAULT_BITS)
 #endif
 
 #define ZCOORD_INT
@@ -208,8 +230,6 @@ typedef uint32_t zcoord_t;
 // there are additional registers in the FPU which we wouldn't otherwise be using.
 typedef float zcoord_t;
 #define slopez(a, b, c, d, X) slopef(a, b, c, d)
-#undef ZSHIFT
-#define ZSHIFT 0
 #endif
 
 static float zscale;
@@ -224,24 +244,134 @@ static float zscale;
 	#define ZBUFF_PARITY_MULT 1
 #endif
 
-static zbuf_t zbuf[VIEWPORT_WIDTH*VIEWPORT_HEIGHT*ZBUFF_PARITY_MULT];
+// allocated for the current format by setZBufferFormat().
+static uint8_t* zbuf = NULL;
+static int zbufBits = 0;
+static int zbufBytes = 0;
+static int zbufAllocFailed = 0;
+
+#define ZBUF_IDX(x, y) ((void*)(zbuf + ((((y) - VIEWPORT_TOP) * VIEWPORT_WIDTH + (x) - VIEWPORT_LEFT) * ZBUFF_PARITY_MULT) * zbufBytes))
+
+// bytes of z buffer cleared since resetZBuffer()
+static uint32_t zbufClearedBytes;
 
-#define ZBUF_IDX(x, y) (&zbuf[0] + ((((y) - VIEWPORT_TOP) * VIEWPORT_WIDTH + (x) - VIEWPORT_LEFT) * ZBUFF_PARITY_MULT))
+#if Z_BUFFER_LAZY_CLEAR
+// frame each row was last cleared in. A row from an older frame is stale, and is cleared when next drawn to.
+static uint16_t zbufFrame = 1;
+static uint16_t zbufRowFrame[VIEWPORT_HEIGHT];
+
+static inline int zbufRowIsStale(int y)
+{
+	return zbufRowFrame[y - VIEWPORT_TOP] != zbufFrame;
+}
+
+static inline void* zbufRow(int y)
+{
+	if ( zbufRowIsStale(y) )
+	{
+		memset(ZBUF_IDX(VIEWPORT_LEFT, y), 0, VIEWPORT_WIDTH * zbufBytes);
+		zbufRowFrame[y - VIEWPORT_TOP] = zbufFrame;
+		zbufClearedBytes += VIEWPORT_WIDTH * zbufBytes;
+	}
+	
+	// (indexed by screen x)
+	return ZBUF_IDX(0, y);
+}
+
+// the z buffer row for drawing to
+#define ZBUF_ROW(y) zbufRow(y)
+#else
+#define ZBUF_ROW(y) ZBUF_IDX(0, y)
+#endif
+
+int setZBufferFormat(int bits)
+{
+	if ( bits != 8 && bits != 16 && bits != 32 )
+		return 0;
+	
+	if ( !ZBUF_HAS_FORMAT(bits) )
+		return 0;
+	
+	if ( bits == zbufBits )
+		return 1;
+	
+	size_t size = VIEWPORT_WIDTH * VIEWPORT_HEIGHT * ZBUFF_PARITY_MULT * (bits / 8);
+	uint8_t* buf = m3d_realloc(zbuf, size);
+	
+	if ( buf == NULL )
+		return 0;
+	
+	zbuf = buf;
+	zbufBits = bits;
+	zbufBytes = bits / 8;
+	
+	// (whatever was there was in the old format.)
+	memset(zbuf, 0, size);
+	
+	#if Z_BUFFER_LAZY_CLEAR
+	memset(zbufRowFrame, 0, sizeof(zbufRowFrame));
+	zbufFrame = 1;
+	#endif
+	
+	return 1;
+}
+
+int getZBufferFormat(void)
+{
+	return zbufBits ? zbufBits : ZBUF_DEFAULT_BITS;
+}
+
+int getZBufferDefaultFormat(void)
+{
+	return ZBUF_DEFAULT_BITS;
+}
 
 void prefetch_zbuf(void)
 {
 	#if defined(__GNUC__) || defined(__clang__)
-	__builtin_prefetch(&zbuf[0]);
+	if ( zbuf != NULL )
+		__builtin_prefetch(&zbuf[0]);
 	#endif
 }
 
-void resetZBuffer(void)
+int resetZBuffer(void)
 {
-	#if Z_BUFFER_FRAME_PARITY == 0
-	memset(zbuf, 0, sizeof(zbuf));
+	if ( zbuf == NULL && !setZBufferFormat(ZBUF_DEFAULT_BITS) )
+	{
+		// (said once, not every frame)
+		if ( !zbufAllocFailed )
+			pd->system->logToConsole("mini3d: couldn't allocate the z buffer, drawing without it");
+		
+		zbufAllocFailed = 1;
+		return 0;
+	}
+	
+	zbufAllocFailed = 0;
+	
+	#if Z_BUFFER_LAZY_CLEAR
+	zbufClearedBytes = 0;
+	
+	// every row is now stale. (if the frame count wraps, make sure they all are.)
+	if ( ++zbufFrame == 0 )
+	{
+		memset(zbufRowFrame, 0, sizeof(zbufRowFrame));
+		zbufFrame = 1;
+	}
+	#elif Z_BUFFER_FRAME_PARITY == 0
+	size_t size = VIEWPORT_WIDTH * VIEWPORT_HEIGHT * zbufBytes;
+	memset(zbuf, 0, size);
+	zbufClearedBytes = size;
 	#else
 	zbuff_parity = !zbuff_parity;
+	zbufClearedBytes = 0;
 	#endif
+	
+	return 1;
+}
+
+uint32_t getZBufferClearedBytes(void)
+{
+	return zbufClearedBytes;
 }
 #endif
 
@@ -264,8 +394,9 @@ static uint32_t render_fog_slope_p = 0;
 void fog_set(uint8_t color, float startz, float endz)
 {
 	render_fog_color = color;
-	render_fog_startz_p = FOG_SCALE * (zscale / startz);
-	render_fog_endz_p = FOG_SCALE * (zscale / endz);
+	// (in the same units as fog_transform_projective()'s z)
+	render_fog_startz_p = 0x10000 * (zscale / startz) / ZSCALE_MULT;
+	render_fog_endz_p = 0x10000 * (zscale / endz) / ZSCALE_MULT;
 	if (render_fog_endz_p < render_fog_startz_p)
 	{
 		render_fog_slope_p = (float)FOG_SCALE / (render_fog_startz_p - render_fog_endz_p);
@@ -304,6 +435,7 @@ static inline uint32_t swap(uint32_t n)
 static inline void
 _drawMaskPattern(uint32_t* p, uint32_t mask, uint32_t color)
 {
+	RENDER_STAT_ADD(pixelsWritten, __builtin_popcount(mask));
 	*p = (*p & ~mask) | (color & mask);
 }
 
@@ -366,6 +498,197 @@ drawFragment(uint32_t* row, int x1, int x2, uint32_t color)
 	}
 }
 
+#if ENABLE_S_BUFFER
+// for each row, the spans [start, end) drawn since the last reset, sorted and disjoint. Each row
+// has room for SBUFFER_SPANS here; one that fills up moves to a bigger block in sbuffer_pool,
+// which grows as needed and is reused from the start each frame.
+static int sbuffer_enabled = 0;
+static int sbuffer_frozen = 0;
+static uint16_t sbuffer_count[VIEWPORT_HEIGHT];
+static uint16_t sbuffer_capacity[VIEWPORT_HEIGHT];
+static int sbuffer_offset[VIEWPORT_HEIGHT]; // where the row's spans are in the pool, once they've moved
+static LCDRowRange sbuffer[VIEWPORT_HEIGHT][SBUFFER_SPANS];
+
+// spans are disjoint and don't touch (touching ones are merged), so this many fit on any row.
+#define SBUFFER_MAX_SPANS ((VIEWPORT_WIDTH + 1) / 2)
+
+static LCDRowRange* sbuffer_pool = NULL;
+static int sbuffer_poolSize = 0;
+static int sbuffer_poolUsed = 0;
+
+void setSBufferEnabled(int enabled)
+{
+	sbuffer_enabled = enabled;
+}
+
+void setSBufferFrozen(int frozen)
+{
+	sbuffer_frozen = frozen;
+}
+
+void resetSBuffer(void)
+{
+	memset(sbuffer_count, 0, sizeof(sbuffer_count));
+	
+	for ( int i = 0; i < VIEWPORT_HEIGHT; ++i )
+		sbuffer_capacity[i] = SBUFFER_SPANS;
+	
+	sbuffer_poolUsed = 0;
+}
+
+static inline LCDRowRange*
+sbufferRow(int r)
+{
+	return (sbuffer_capacity[r] > SBUFFER_SPANS) ? &sbuffer_pool[sbuffer_offset[r]] : sbuffer[r];
+}
+
+// moves row r to a block twice the size. Returns 0 if that can't be allocated.
+static int
+sbufferGrowRow(int r)
+{
+	int capacity = MIN(2 * sbuffer_capacity[r], SBUFFER_MAX_SPANS);
+	
+	if ( sbuffer_poolUsed + capacity > sbuffer_poolSize )
+	{
+		int size = MAX(sbuffer_poolUsed + capacity, 2 * sbuffer_poolSize);
+		LCDRowRange* pool = m3d_realloc(sbuffer_pool, size * sizeof(LCDRowRange));
+		
+		if ( pool == NULL )
+			return 0;
+		
+		sbuffer_pool = pool;
+		sbuffer_poolSize = size;
+	}
+	
+	memcpy(&sbuffer_pool[sbuffer_poolUsed], sbufferRow(r), sbuffer_count[r] * sizeof(LCDRowRange));
+	sbuffer_offset[r] = sbuffer_poolUsed;
+	sbuffer_capacity[r] = capacity;
+	sbuffer_poolUsed += capacity;
+	
+	return 1;
+}
+
+// finds the parts of [x, endx) on row y which haven't been drawn yet and, if mark is set (and the
+// S-buffer isn't frozen), marks the whole span drawn. Fills in up to SBUFFER_MAX_SPANS + 1 gaps
+// and returns how many there are.
+static int
+sbufferClipRow(int y, int x, int endx, LCDRowRange* gaps, int mark)
+{
+	if ( !sbuffer_enabled )
+	{
+		gaps[0] = (LCDRowRange){ x, endx };
+		return 1;
+	}
+	
+	if ( x < VIEWPORT_LEFT )
+		x = VIEWPORT_LEFT;
+	
+	if ( endx > VIEWPORT_RIGHT )
+		endx = VIEWPORT_RIGHT;
+	
+	if ( x >= endx )
+		return 0;
+	
+	int r = y - VIEWPORT_TOP;
+	LCDRowRange* spans = sbufferRow(r);
+	int count = sbuffer_count[r];
+	int n = 0;
+	int i = 0;
+	
+	while ( i < count && spans[i].end < x )
+		++i;
+	
+	// spans from here to i overlap or touch [x, endx), and are merged with it.
+	int first = i;
+	int cx = x;
+	int start = x;
+	int end = endx;
+	
+	while ( i < count && spans[i].start <= endx )
+	{
+		if ( spans[i].start > cx )
+			gaps[n++] = (LCDRowRange){ cx, spans[i].start };
+		
+		if ( spans[i].end > cx )
+			cx = spans[i].end;
+		
+		start = MIN(start, spans[i].start);
+		end = MAX(end, spans[i].end);
+		++i;
+	}
+	
+	if ( cx < endx )
+		gaps[n++] = (LCDRowRange){ cx, endx };
+	
+	if ( !mark || sbuffer_frozen )
+		return n;
+	
+	if ( i == first && count == sbuffer_capacity[r] )
+	{
+		if ( sbufferGrowRow(r) )
+			spans = sbufferRow(r);
+		else
+		{
+			// out of memory: cover the gap to a neighbour instead, so the span isn't drawn over
+			// later. (that hides whatever would have shown through the gap.)
+			if ( first == count )
+				start = spans[--first].start;
+			else
+				end = spans[i++].end;
+		}
+	}
+	
+	int merged = i - first;
+	
+	memmove(&spans[first + 1], &spans[i], (count - i) * sizeof(LCDRowRange));
+	spans[first] = (LCDRowRange){ start, end };
+	sbuffer_count[r] = count - merged + 1;
+	
+	return n;
+}
+
+// returns 1 if every pixel in the given box (inclusive) has been drawn already.
+static int
+sbufferIsHidden(int y, int endy, int x, int endx)
+{
+	if ( !sbuffer_enabled )
+		return 0;
+	
+	x = MAX(x, VIEWPORT_LEFT);
+	endx = MIN(endx, VIEWPORT_RIGHT - 1);
+	y = MAX(y, VIEWPORT_TOP);
+	endy = MIN(endy, VIEWPORT_BOTTOM - 1);
+	
+	for ( ; y <= endy; ++y )
+	{
+		LCDRowRange* spans = sbufferRow(y - VIEWPORT_TOP);
+		int count = sbuffer_count[y - VIEWPORT_TOP];
+		int i = 0;
+		
+		while ( i < count && spans[i].end <= endx )
+			++i;
+		
+		if ( i == count || spans[i].start > x )
+			return 0;
+	}
+	
+	return 1;
+}
+
+static void
+drawFragment_s(uint32_t* row, int y, int x1, int x2, uint32_t color)
+{
+	LCDRowRange gaps[SBUFFER_MAX_SPANS + 1];
+	int n = sbufferClipRow(y, x1, x2, gaps, 1);
+	
+	for ( int i = 0; i < n; ++i )
+		drawFragment(row, gaps[i].start, gaps[i].end, color);
+}
+#else
+#define drawFragment_s(row, y, x1, x2, color) drawFragment(row, x1, x2, color)
+#define sbufferIsHidden(y, endy, x, endx) 0
+#endif
+
 #define RZ 1
 #define RT 2
 #define RA 4
@@ -374,8 +697,8 @@ drawFragment(uint32_t* row, int x1, int x2, uint32_t color)
 #define RL 32
 
 #if ENABLE_Z_BUFFER
-	#define RENDER RZ
-	#include "render_range.inc"
+	#define RENDER_Z_VARIANT RZ
+	#include "render_range_z.inc"
 #endif
 
 #if TEXTURE_PERSPECTIVE_MAPPING
@@ -408,28 +731,28 @@ drawFragment(uint32_t* row, int x1, int x2, uint32_t color)
 	#if ENABLE_Z_BUFFER
 		#if ENABLE_TEXTURES && ENABLE_TEXTURES_GREYSCALE
 			#if ENABLE_TEXTURES_MASK
-				#define RENDER RZ | RT | RA | RG | RL | RP
-				#include "render_range.inc"
+				#define RENDER_Z_VARIANT RZ | RT | RA | RG | RL | RP
+				#include "render_range_z.inc"
 				
-				#define RENDER RZ | RT | RA | RG | RP
-				#include "render_range.inc"
+				#define RENDER_Z_VARIANT RZ | RT | RA | RG | RP
+				#include "render_range_z.inc"
 			#endif
 			
-			#define RENDER RZ | RT | RG | RL | RP
-			#include "render_range.inc"
+			#define RENDER_Z_VARIANT RZ | RT | RG | RL | RP
+			#include "render_range_z.inc"
 			
-			#define RENDER RZ | RT | RG | RP
-			#include "render_range.inc"
+			#define RENDER_Z_VARIANT RZ | RT | RG | RP
+			#include "render_range_z.inc"
 		#endif
 		
 		#if ENABLE_TEXTURES && ENABLE_TEXTURES_MASK
-			#define RENDER RZ | RT | RA | RP
-			#include "render_range.inc"
+			#define RENDER_Z_VARIANT RZ | RT | RA | RP
+			#include "render_range_z.inc"
 		#endif
 
 		#if ENABLE_TEXTURES
-			#define RENDER RZ | RT | RP
-			#include "render_range.inc"
+			#define RENDER_Z_VARIANT RZ | RT | RP
+			#include "render_range_z.inc"
 		#endif
 	#endif
 #endif
@@ -463,31 +786,59 @@ drawFragment(uint32_t* row, int x1, int x2, uint32_t color)
 #if ENABLE_Z_BUFFER
 	#if ENABLE_TEXTURES && ENABLE_TEXTURES_GREYSCALE
 		#if ENABLE_TEXTURES_MASK
-			#define RENDER RZ | RT | RA | RG | RL
-			#include "render_range.inc"
+			#define RENDER_Z_VARIANT RZ | RT | RA | RG | RL
+			#include "render_range_z.inc"
 			
-			#define RENDER RZ | RT | RA | RG
-			#include "render_range.inc"
+			#define RENDER_Z_VARIANT RZ | RT | RA | RG
+			#include "render_range_z.inc"
 		#endif
 		
-		#define RENDER RZ | RT | RG | RL
-		#include "render_range.inc"
+		#define RENDER_Z_VARIANT RZ | RT | RG | RL
+		#include "render_range_z.inc"
 		
-		#define RENDER RZ | RT | RG
-		#include "render_range.inc"
+		#define RENDER_Z_VARIANT RZ | RT | RG
+		#include "render_range_z.inc"
 	#endif
 	
 	#if ENABLE_TEXTURES && ENABLE_TEXTURES_MASK
-		#define RENDER RZ | RT | RA
-		#include "render_range.inc"
+		#define RENDER_Z_VARIANT RZ | RT | RA
+		#include "render_range_z.inc"
 	#endif
 
 	#if ENABLE_TEXTURES
-		#define RENDER RZ | RT
-		#include "render_range.inc"
+		#define RENDER_Z_VARIANT RZ | RT
+		#include "render_range_z.inc"
 	#endif
 #endif
 
+#if ENABLE_Z_BUFFER
+// calls the z-buffered function built for the current z buffer format,
+// e.g. ZBUF_DISPATCH(fillRange, tg, ...) calls fillRange_z8tg, fillRange_z16tg or fillRange_z32tg.
+#if Z_BUFFER_ALL_FORMATS
+	#define ZBUF_DISPATCH(fn, variant, ...) do { \
+		switch ( zbufBits ) \
+		{ \
+		case 32: fn##_z32##variant(__VA_ARGS__); break; \
+		case 16: fn##_z16##variant(__VA_ARGS__); break; \
+		default: fn##_z8##variant(__VA_ARGS__); break; \
+		} \
+	} while (0)
+#elif ZBUF_DEFAULT_BITS == 32
+	#define ZBUF_DISPATCH(fn, variant, ...) fn##_z32##variant(__VA_ARGS__)
+#elif ZBUF_DEFAULT_BITS == 16
+	#define ZBUF_DISPATCH(fn, variant, ...) fn##_z16##variant(__VA_ARGS__)
+#else
+	#define ZBUF_DISPATCH(fn, variant, ...) fn##_z8##variant(__VA_ARGS__)
+#endif
+
+#define drawFragment_z(...) ZBUF_DISPATCH(drawFragment, , __VA_ARGS__)
+#define fillRange_z(...) ZBUF_DISPATCH(fillRange, , __VA_ARGS__)
+#define fillRange_zt(...) ZBUF_DISPATCH(fillRange, t, __VA_ARGS__)
+#define fillRange_ztg(...) ZBUF_DISPATCH(fillRange, tg, __VA_ARGS__)
+#define fillRange_ztp(...) ZBUF_DISPATCH(fillRange, tp, __VA_ARGS__)
+#define fillRange_ztgp(...) ZBUF_DISPATCH(fillRange, tgp, __VA_ARGS__)
+#endif
+
 static inline int32_t slope(float x1, float y1, float x2, float y2, const int shift)
 {
 	float dx = x2-x1;
@@ -544,12 +895,12 @@ drawLine_zbuf(uint8_t* bitmap, int rowstride, Point3D* p1, Point3D* p2, int thic
 	int32_t x = p1->x * (1<<16);
 	int32_t dx = slope(p1->x, p1->y, p2->x, p2->y + 1, 16);
 	
-	// move lines a bit forward so they don't get buried in solid geometry
-	float z1 = zscale / (p1->z + Z_BIAS) + 256;
-	float z2 = zscale / (p2->z + Z_BIAS) + 256;
+	// move lines a bit forward (a step of the 8-bit z buffer) so they don't get buried in solid geometry
+	float z1 = zscale / (p1->z + Z_BIAS) + ZSCALE_MULT / 256;
+	float z2 = zscale / (p2->z + Z_BIAS) + ZSCALE_MULT / 256;
 
-	if ( z1 > zscale ) z1 = zscale;
-	if ( z2 > zscale ) z2 = zscale;
+	if ( z1 > ZSCALE_MULT ) z1 = ZSCALE_MULT;
+	if ( z2 > ZSCALE_MULT ) z2 = ZSCALE_MULT;
 	zcoord_t z = z1 * (1<<ZSHIFT);
 
 	zcoord_t dzdy = slopez(z1, p1->y, z2, p2->y + 1, ZSHIFT);
@@ -571,11 +922,11 @@ drawLine_zbuf(uint8_t* bitmap, int rowstride, Point3D* p1, Point3D* p2, int thic
 		if ( dx < 0 )
 		{
 			z += dzdy;
-			drawFragment_z((uint32_t*)&bitmap[y*rowstride], ZBUF_IDX(0, y), x1>>16, (x>>16) + thick, z, dzdx, color);
+			drawFragment_z((uint32_t*)&bitmap[y*rowstride], ZBUF_ROW(y), x1>>16, (x>>16) + thick, z, dzdx, color);
 		}
 		else
 		{
-			drawFragment_z((uint32_t*)&bitmap[y*rowstride], ZBUF_IDX(0, y), x>>16, (x1>>16) + thick, z, dzdx, color);
+			drawFragment_z((uint32_t*)&bitmap[y*rowstride], ZBUF_ROW(y), x>>16, (x1>>16) + thick, z, dzdx, color);
 			z += dzdy;
 		}
 
@@ -585,7 +936,7 @@ drawLine_zbuf(uint8_t* bitmap, int rowstride, Point3D* p1, Point3D* p2, int thic
 		x = x1;
 	}
 	
-	return (LCDRowRange){ MAX(VIEWPORT_TOP, p1->y), MIN(VIEWPORT_BOTTOM, p2->y) };
+	return (LCDRowRange){ MAX(VIEWPORT_TOP, p1->y), MIN(VIEWPORT_BOTTOM, p2->y + 1) };
 }
 #endif
 
@@ -621,9 +972,9 @@ drawLine(uint8_t* bitmap, int rowstride, Point3D* p1, Point3D* p2, int thick, ui
 		int32_t x1 = (y < endy) ? x+dx : p2->x * (1<<16);
 		
 		if ( dx < 0 )
-			drawFragment((uint32_t*)&bitmap[y*rowstride], x1>>16, (x>>16) + thick, color);
+			drawFragment_s((uint32_t*)&bitmap[y*rowstride], y, x1>>16, (x>>16) + thick, color);
 		else
-			drawFragment((uint32_t*)&bitmap[y*rowstride], x>>16, (x1>>16) + thick, color);
+			drawFragment_s((uint32_t*)&bitmap[y*rowstride], y, x>>16, (x1>>16) + thick, color);
 		
 		if ( ++y == VIEWPORT_BOTTOM )
 			break;
@@ -631,7 +982,7 @@ drawLine(uint8_t* bitmap, int rowstride, Point3D* p1, Point3D* p2, int thick, ui
 		x = x1;
 	}
 	
-	return (LCDRowRange){ MAX(VIEWPORT_TOP, p1->y), MIN(VIEWPORT_BOTTOM, p2->y) };
+	return (LCDRowRange){ MAX(VIEWPORT_TOP, p1->y), MIN(VIEWPORT_BOTTOM, p2->y + 1) };
 }
 
 static void fillRange(uint8_t* bitmap, int rowstride, int y, int endy, int32_t* x1p, int32_t dx1, int32_t* x2p, int32_t dx2, uint8_t pattern[8])
@@ -661,12 +1012,12 @@ static void fillRange(uint8_t* bitmap, int rowstride, int y, int endy, int32_t*
 			uint8_t p = pattern[y%8];
 			uint32_t color = (p<<24) | (p<<16) | (p<<8) | p;
 			
-			drawFragment((uint32_t*)&bitmap[y*rowstride], (x1>>16), (x2>>16)+1, color);
-			
-			x1 += dx1;
-			x2 += dx2;
-			++y;
+			drawFragment_s((uint32_t*)&bitmap[y*rowstride], y, (x1>>16), (x2>>16)+1, color);
 		}
+		
+		x1 += dx1;
+		x2 += dx2;
+		++y;
 	}
 	
 	*x1p = x1;
@@ -783,6 +1134,12 @@ LCDRowRange fillTriangle(uint8_t* bitmap, int rowstride, Point3D* p1, Point3D* p
 	
 	if ( p1->y > VIEWPORT_BOTTOM || endy < VIEWPORT_TOP )
 		return (LCDRowRange){ 0, 0 };
+	
+	// (a pixel of slack either side, for rounding)
+	if ( sbufferIsHidden(p1->y, p3->y + 1, MIN(p1->x, MIN(p2->x, p3->x)) - 1, MAX(p1->x, MAX(p2->x, p3->x)) + 1) )
+		return (LCDRowRange){ 0, 0 };
+	
+	RENDER_STAT_ADD(triangles[kRenderStatFlat], 1);
 
 	int32_t x1 = p1->x * (1<<16);
 	int32_t x2 = x1;
@@ -825,6 +1182,8 @@ LCDRowRange fillTriangle_zbuf(uint8_t* bitmap, int rowstride, Point3D* p1, Point
 	
 	if ( p1->y > VIEWPORT_BOTTOM || endy < VIEWPORT_TOP || det == 0 )
 		return (LCDRowRange){ 0, 0 };
+	
+	RENDER_STAT_ADD(triangles[kRenderStatZ], 1);
 
 	int32_t x1 = p1->x * (1<<16);
 	int32_t x2 = x1;
@@ -842,17 +1201,17 @@ LCDRowRange fillTriangle_zbuf(uint8_t* bitmap, int rowstride, Point3D* p1, Point
 	float mx = p1->x + (p2->y-p1->y) * (p3->x-p1->x) / (p3->y-p1->y);
 	float mz = z1 + (p2->y-p1->y) * (z3-z1) / (p3->y-p1->y);
 
-	int32_t dzdx, dzdy;
+	zcoord_t dzdx, dzdy;
 
 	if ( sc < sb )
 	{
-		dzdx = slope(mz, mx, z2, p2->x, 16);
-		dzdy = slope(z1, p1->y, z3, p3->y, 16);
+		dzdx = slopez(mz, mx, z2, p2->x, ZSHIFT);
+		dzdy = slopez(z1, p1->y, z3, p3->y, ZSHIFT);
 	}
 	else
 	{
-		dzdx = slope(z2, p2->x, mz, mx, 16);
-		dzdy = slope(z1, p1->y, z2, p2->y, 16);
+		dzdx = slopez(z2, p2->x, mz, mx, ZSHIFT);
+		dzdy = slopez(z1, p1->y, z2, p2->y, ZSHIFT);
 	}
 	
 	#ifdef ZCOORD_INT
@@ -867,7 +1226,7 @@ LCDRowRange fillTriangle_zbuf(uint8_t* bitmap, int rowstride, Point3D* p1, Point
 
 	if ( sb < sc )
 	{
-		dzdy = slope(z2, p2->y, z3, p3->y, 16);
+		dzdy = slopez(z2, p2->y, z3, p3->y, ZSHIFT);
 		x1 = p2->x * (1<<16);
 		z = z2 * (1<<ZSHIFT);
 		fillRange_z(bitmap, rowstride, p2->y, endy, &x1, dx, &x2, dx2, &z, dzdy, dzdx, pattern);
@@ -901,7 +1260,11 @@ projective_ratio_test(Point3D* p1, Point3D* p2, Point3D* p3)
 	#if TEXTURE_PERSPECTIVE_MAPPING == 1
 		return 1; // always.
 	#elif TEXTURE_PERSPECTIVE_MAPPING == 2
+		#ifdef TEXTURE_PROJECTIVE_RATIO_THRESHOLD
 		return zmax * TEXTURE_PROJECTIVE_RATIO_THRESHOLD > zmin;
+		#else
+		return 1; // (check disabled)
+		#endif
 	#elif TEXTURE_PERSPECTIVE_MAPPING == 3
 		// twice the area of the triangle
 		// https://keisan.casio.com/exec/system/1223520411
@@ -996,22 +1359,268 @@ static inline int splitTriangleProjective(
 	#undef RENDER_Z
 #endif
 
+// finds the polygon's top and bottom points, and whether walking forwards from the top follows
+// its right side on the screen (i.e. whether it winds clockwise). Returns 0 if it has no area.
+static int
+polygonSetup(Point3D* points, int n, int* top, int* bottom, int* clockwise)
+{
+	float area = 0;
+	
+	*top = 0;
+	*bottom = 0;
+	
+	for ( int i = 0; i < n; ++i )
+	{
+		Point3D* p = &points[i];
+		Point3D* q = &points[(i + 1) % n];
+		area += p->x * q->y - q->x * p->y;
+		
+		if ( p->y < points[*top].y )
+			*top = i;
+		
+		if ( p->y > points[*bottom].y )
+			*bottom = i;
+	}
+	
+	*clockwise = area > 0;
+	return area != 0;
+}
+
+// Fills a convex polygon in one pass down the screen: its left and right sides are followed
+// from the top point to the bottom one, and each stretch of rows between two points is a
+// single fillRange() call.
+LCDRowRange fillPolygon(uint8_t* bitmap, int rowstride, Point3D* points, int n, uint8_t pattern[8])
+{
+	int top, bottom, clockwise;
+	
+	if ( n < 3 || !polygonSetup(points, n, &top, &bottom, &clockwise) )
+		return (LCDRowRange){ 0, 0 };
+	
+	#if ENABLE_RENDER_DISTANCE_MAX == 1
+	if (render_distance_bounds_polygon(points, n)) return (LCDRowRange){ 0, 0 };
+	#endif
+	
+	int endy = MIN(VIEWPORT_BOTTOM, points[bottom].y);
+	
+	if ( points[top].y > VIEWPORT_BOTTOM || endy < VIEWPORT_TOP )
+		return (LCDRowRange){ 0, 0 };
+	
+	#if ENABLE_S_BUFFER
+	float minx = points[0].x;
+	float maxx = points[0].x;
+	
+	for ( int i = 1; i < n; ++i )
+	{
+		minx = MIN(minx, points[i].x);
+		maxx = MAX(maxx, points[i].x);
+	}
+	
+	// (a pixel of slack either side, for rounding)
+	if ( sbufferIsHidden(points[top].y, points[bottom].y + 1, minx - 1, maxx + 1) )
+		return (LCDRowRange){ 0, 0 };
+	#endif
+	
+	RENDER_STAT_ADD(polygons[kRenderStatFlat], 1);
+	
+	// l and r are the points at the top of the current left and right edges, nl and nr at the bottom.
+	int dl = clockwise ? n - 1 : 1;
+	int dr = n - dl;
+	int l = top, nl = (top + dl) % n;
+	int r = top, nr = (top + dr) % n;
+	
+	int32_t x1 = points[top].x * (1<<16);
+	int32_t x2 = x1;
+	int32_t dx1 = slope(points[l].x, points[l].y, points[nl].x, points[nl].y, 16);
+	int32_t dx2 = slope(points[r].x, points[r].y, points[nr].x, points[nr].y, 16);
+	
+	int y = points[top].y;
+	
+	// (each step moves at least one side down a point; a bent polygon mustn't go around twice.)
+	for ( int steps = 0; (l != bottom || r != bottom) && steps < n; ++steps )
+	{
+		float ly = (l == bottom) ? 1e23f : points[nl].y;
+		float ry = (r == bottom) ? 1e23f : points[nr].y;
+		int nexty = MIN(ly, ry);
+		
+		fillRange(bitmap, rowstride, y, MIN(VIEWPORT_BOTTOM, nexty), &x1, dx1, &x2, dx2, pattern);
+		
+		if ( nexty > y )
+			y = nexty;
+		
+		if ( y >= VIEWPORT_BOTTOM )
+			break;
+		
+		if ( ly <= ry )
+		{
+			l = nl;
+			nl = (l + dl) % n;
+			x1 = points[l].x * (1<<16);
+			dx1 = slope(points[l].x, points[l].y, points[nl].x, points[nl].y, 16);
+		}
+		
+		if ( ry <= ly )
+		{
+			r = nr;
+			nr = (r + dr) % n;
+			x2 = points[r].x * (1<<16);
+			dx2 = slope(points[r].x, points[r].y, points[nr].x, points[nr].y, 16);
+		}
+	}
+	
+	return (LCDRowRange){ MAX(VIEWPORT_TOP, points[top].y), endy };
+}
+
+#if ENABLE_Z_BUFFER
+// as fillPolygon(), with z interpolated down the left side and (at the same rate on every row,
+// since the polygon is flat) across.
+LCDRowRange fillPolygon_zbuf(uint8_t* bitmap, int rowstride, Point3D* points, int n, uint8_t pattern[8])
+{
+	int top, bottom, clockwise;
+	
+	if ( n < 3 || n > POLYGON_MAX_POINTS || !polygonSetup(points, n, &top, &bottom, &clockwise) )
+		return (LCDRowRange){ 0, 0 };
+	
+	#if ENABLE_RENDER_DISTANCE_MAX == 1
+	if (render_distance_bounds_polygon(points, n)) return (LCDRowRange){ 0, 0 };
+	#endif
+	
+	int endy = MIN(VIEWPORT_BOTTOM, points[bottom].y);
+	
+	if ( points[top].y > VIEWPORT_BOTTOM || endy < VIEWPORT_TOP )
+		return (LCDRowRange){ 0, 0 };
+	
+	RENDER_STAT_ADD(polygons[kRenderStatZ], 1);
+	
+	float zs[POLYGON_MAX_POINTS];
+	
+	for ( int i = 0; i < n; ++i )
+		zs[i] = zscale / (points[i].z + Z_BIAS);
+	
+	// the change in z across a row, from the widest triangle of the fan from the first point
+	float best = 0;
+	float gradient = 0;
+	
+	for ( int i = 1; i + 1 < n; ++i )
+	{
+		Point3D* a = &points[0];
+		Point3D* b = &points[i];
+		Point3D* c = &points[i + 1];
+		float det = (b->x - a->x) * (c->y - a->y) - (c->x - a->x) * (b->y - a->y);
+		
+		if ( fabsf(det) > fabsf(best) )
+		{
+			best = det;
+			gradient = ((zs[i] - zs[0]) * (c->y - a->y) - (zs[i + 1] - zs[0]) * (b->y - a->y)) / det;
+		}
+	}
+	
+	zcoord_t dzdx = slopez(0, 0, gradient, 1, ZSHIFT);
+	
+	int dl = clockwise ? n - 1 : 1;
+	int dr = n - dl;
+	int l = top, nl = (top + dl) % n;
+	int r = top, nr = (top + dr) % n;
+	
+	int32_t x1 = points[top].x * (1<<16);
+	int32_t x2 = x1;
+	int32_t dx1 = slope(points[l].x, points[l].y, points[nl].x, points[nl].y, 16);
+	int32_t dx2 = slope(points[r].x, points[r].y, points[nr].x, points[nr].y, 16);
+	zcoord_t z = zs[top] * (1<<ZSHIFT);
+	zcoord_t dzdy = slopez(zs[l], points[l].y, zs[nl], points[nl].y, ZSHIFT);
+	
+	int y = points[top].y;
+	
+	for ( int steps = 0; (l != bottom || r != bottom) && steps < n; ++steps )
+	{
+		float ly = (l == bottom) ? 1e23f : points[nl].y;
+		float ry = (r == bottom) ? 1e23f : points[nr].y;
+		int nexty = MIN(ly, ry);
+		
+		fillRange_z(bitmap, rowstride, y, MIN(VIEWPORT_BOTTOM, nexty), &x1, dx1, &x2, dx2, &z, dzdy, dzdx, pattern);
+		
+		if ( nexty > y )
+			y = nexty;
+		
+		if ( y >= VIEWPORT_BOTTOM )
+			break;
+		
+		if ( ly <= ry )
+		{
+			l = nl;
+			nl = (l + dl) % n;
+			x1 = points[l].x * (1<<16);
+			dx1 = slope(points[l].x, points[l].y, points[nl].x, points[nl].y, 16);
+			z = zs[l] * (1<<ZSHIFT);
+			dzdy = slopez(zs[l], points[l].y, zs[nl], points[nl].y, ZSHIFT);
+		}
+		
+		if ( ry <= ly )
+		{
+			r = nr;
+			nr = (r + dr) % n;
+			x2 = points[r].x * (1<<16);
+			dx2 = slope(points[r].x, points[r].y, points[nr].x, points[nr].y, 16);
+		}
+	}
+	
+	return (LCDRowRange){ MAX(VIEWPORT_TOP, points[top].y), endy };
+}
+#endif
+
+// the points of a quad go around it without turning back on themselves.
+// (a bent quad can be squashed into a dart or a bow-tie on screen; those are drawn as two triangles instead.)
+static inline int
+quadIsConvex(Point3D* p1, Point3D* p2, Point3D* p3, Point3D* p4)
+{
+	Point3D* p[4] = { p1, p2, p3, p4 };
+	int sides = 0;
+	
+	for ( int i = 0; i < 4; ++i )
+	{
+		Point3D* a = p[i];
+		Point3D* b = p[(i + 1) % 4];
+		Point3D* c = p[(i + 2) % 4];
+		float cross = (b->x - a->x) * (c->y - b->y) - (b->y - a->y) * (c->x - b->x);
+		
+		if ( cross > 0 )
+			sides |= 1;
+		else if ( cross < 0 )
+			sides |= 2;
+	}
+	
+	return sides != 3;
+}
+
 LCDRowRange fillQuad(uint8_t* bitmap, int rowstride, Point3D* p1, Point3D* p2, Point3D* p3, Point3D* p4, uint8_t pattern[8])
 {
-	// XXX - implement with 3 fillrange_z() calls
-	fillTriangle(bitmap, rowstride, p1, p2, p3, pattern);
-	return fillTriangle(bitmap, rowstride, p1, p3, p4, pattern);
+	if ( quadIsConvex(p1, p2, p3, p4) )
+		return fillPolygon(bitmap, rowstride, (Point3D[4]){ *p1, *p2, *p3, *p4 }, 4, pattern);
+	
+	LCDRowRange rows = fillTriangle(bitmap, rowstride, p1, p2, p3, pattern);
+	return rowRangeUnion(rows, fillTriangle(bitmap, rowstride, p1, p3, p4, pattern));
 }
 
 #if ENABLE_Z_BUFFER
 LCDRowRange fillQuad_zbuf(uint8_t* bitmap, int rowstride, Point3D* p1, Point3D* p2, Point3D* p3, Point3D* p4, uint8_t pattern[8])
 {
-	// XXX - implement with 3 fillrange_z() calls
-	fillTriangle_zbuf(bitmap, rowstride, p1, p2, p3, pattern);
-	return fillTriangle_zbuf(bitmap, rowstride, p1, p3, p4, pattern);
+	if ( quadIsConvex(p1, p2, p3, p4) )
+		return fillPolygon_zbuf(bitmap, rowstride, (Point3D[4]){ *p1, *p2, *p3, *p4 }, 4, pattern);
+	
+	LCDRowRange rows = fillTriangle_zbuf(bitmap, rowstride, p1, p2, p3, pattern);
+	return rowRangeUnion(rows, fillTriangle_zbuf(bitmap, rowstride, p1, p3, p4, pattern));
 }
 #endif
 
+#if ENABLE_TEXTURES
+#include "render_polygon.inc"
+#endif
+
+#if ENABLE_Z_BUFFER && ENABLE_TEXTURES
+	#define RENDER_Z
+	#include "render_polygon.inc"
+	#undef RENDER_Z
+#endif
+
 #if ENABLE_Z_BUFFER && ENABLE_TEXTURES
 LCDRowRange fillQuad_zt(
 	uint8_t* bitmap, int rowstride, Point3D* p1, Point3D* p2, Point3D* p3, Point3D* p4,
@@ -1030,8 +1639,25 @@ LCDRowRange fillQuad_zt(
 	#endif
 )
 {
-	// XXX - implement with 3 fillrange_z() calls
-	fillTriangle_zt(
+	if ( quadIsConvex(p1, p2, p3, p4) )
+		return fillPolygon_zt(
+			bitmap, rowstride, (Point3D[4]){ *p1, *p2, *p3, *p4 }, 4,
+			texture, (Point2D[4]){ t1, t2, t3, t4 }
+			#if ENABLE_CUSTOM_PATTERNS
+			, pattern
+			#endif
+			#if ENABLE_POLYGON_SCANLINING
+			, scanline
+			#endif
+			#if ENABLE_TEXTURES_GREYSCALE
+			, lighting, lighting_weight
+			#endif
+			#if TEXTURE_PERSPECTIVE_MAPPING
+			, projective
+			#endif
+		);
+	
+	LCDRowRange rows = fillTriangle_zt(
 		bitmap, rowstride, p1, p2, p3, texture, t1, t2, t3
 		#if ENABLE_CUSTOM_PATTERNS
 		, pattern
@@ -1046,7 +1672,7 @@ LCDRowRange fillQuad_zt(
 		, projective
 		#endif
 	);
-	return fillTriangle_zt(
+	return rowRangeUnion(rows, fillTriangle_zt(
 		bitmap, rowstride, p1, p3, p4, texture, t1, t3, t4
 		#if ENABLE_CUSTOM_PATTERNS
 		, pattern
@@ -1060,7 +1686,7 @@ LCDRowRange fillQuad_zt(
 		#if TEXTURE_PERSPECTIVE_MAPPING
 		, projective
 		#endif
-	);
+	));
 }
 #endif
 
@@ -1082,8 +1708,25 @@ LCDRowRange fillQuad_t(
 	#endif
 )
 {
-	// XXX - implement with 3 fillrange() calls
-	fillTriangle_t(
+	if ( quadIsConvex(p1, p2, p3, p4) )
+		return fillPolygon_t(
+			bitmap, rowstride, (Point3D[4]){ *p1, *p2, *p3, *p4 }, 4,
+			texture, (Point2D[4]){ t1, t2, t3, t4 }
+			#if ENABLE_CUSTOM_PATTERNS
+			, pattern
+			#endif
+			#if ENABLE_POLYGON_SCANLINING
+			, scanline
+			#endif
+			#if ENABLE_TEXTURES_GREYSCALE
+			, lighting, lighting_weight
+			#endif
+			#if TEXTURE_PERSPECTIVE_MAPPING
+			, projective
+			#endif
+		);
+	
+	LCDRowRange rows = fillTriangle_t(
 		bitmap, rowstride, p1, p2, p3, texture, t1, t2, t3
 		#if ENABLE_CUSTOM_PATTERNS
 		, pattern
@@ -1098,7 +1741,7 @@ LCDRowRange fillQuad_t(
 		, projective
 		#endif
 	);
-	return fillTriangle_t(
+	return rowRangeUnion(rows, fillTriangle_t(
 		bitmap, rowstride, p1, p3, p4, texture, t1, t3, t4
 		#if ENABLE_CUSTOM_PATTERNS
 		, pattern
@@ -1112,15 +1755,31 @@ LCDRowRange fillQuad_t(
 		#if TEXTURE_PERSPECTIVE_MAPPING
 		, projective
 		#endif
-	);
+	));
 }
 #endif
 
 #if ENABLE_Z_BUFFER
 #include <stdlib.h>
 
+// the top 8 bits of the z buffer at (x, y)
+static inline uint8_t zbufDepth8(int x, int y)
+{
+	void* p = ZBUF_IDX(x, y);
+	
+	switch ( zbufBits )
+	{
+	case 32: return *(uint32_t*)p >> 24;
+	case 16: return *(uint16_t*)p >> 8;
+	default: return *(uint8_t*)p;
+	}
+}
+
 void render_zbuff(uint8_t* out, int rowstride)
 {
+	if ( zbuf == NULL )
+		return;
+	
 	for (uint16_t x = VIEWPORT_LEFT; x < VIEWPORT_RIGHT; ++x)
 	{
 		for (uint16_t y = VIEWPORT_TOP; y < VIEWPORT_BOTTOM; ++y)
@@ -1128,7 +1787,12 @@ void render_zbuff(uint8_t* out, int rowstride)
 			uint16_t pixi = (y * rowstride) + (x/8);
 			uint8_t mask = 0x80 >> (x % 8);
 			out[pixi] &= ~mask;
-			if ((rand() & ZSCALE_MULT) < *ZBUF_IDX(x, y))
+			#if Z_BUFFER_LAZY_CLEAR
+			if (zbufRowIsStale(y))
+				continue;
+			#endif
+			
+			if ((rand() & 0xff) < zbufDepth8(x, y))
 			{
 				out[pixi] |= mask;
 			}
@@ -14,21 +14,85 @@
 #include "texture.h"
 #include "scanline.h"
 
+// the rows a draw call touched, from start up to (not including) end. Empty if end <= start.
 typedef struct
 {
 	int16_t start;
 	int16_t end;
 } LCDRowRange;
 
+// the smallest range covering both
+static inline LCDRowRange
+rowRangeUnion(LCDRowRange a, LCDRowRange b)
+{
+	if ( a.end <= a.start )
+		return b;
+	
+	if ( b.end <= b.start )
+		return a;
+	
+	return (LCDRowRange){ MIN(a.start, b.start), MAX(a.end, b.end) };
+}
+
+#if ENABLE_RENDER_STATS
+// which rasterizer a triangle or polygon was filled with
+enum
+{
+	kRenderStatFlat,
+	kRenderStatZ,
+	kRenderStatTextured,
+	kRenderStatTexturedZ,
+	kRenderStatVariants
+};
+
+// counts since the last resetRenderStats(), which Scene3D_draw() calls, so after a frame
+// they describe that frame.
+typedef struct
+{
+	uint32_t instancesUpdated; // shape and imposter instances
+	uint32_t instancesCulled; // of those, outside the view (ENABLE_FRUSTUM_CULLING)
+	uint32_t pointsTransformed;
+	uint32_t facesBackfaceCulled; // in object space (ENABLE_EARLY_BACKFACE_CULLING), or by winding when drawn
+	uint32_t facesRejected; // all points outside the same side of the view
+	uint32_t facesOffscreen; // found to be off the screen when drawn
+	uint32_t facesClipped; // crossing the near plane or the guard band
+	uint32_t clipPointsDropped; // clipped polygon points past CLIP_MAX_POINTS
+	uint32_t facesSorted; // length of the sorted face list (SORT_3D_FACES_BY_Z)
+	uint32_t triangles[kRenderStatVariants];
+	uint32_t polygons[kRenderStatVariants]; // including convex quads
+	uint32_t projective; // textured triangles and polygons mapped perspective-correct
+	uint32_t pixelsWritten; // including ones drawn over later
+	uint32_t zRejects; // pixels behind the z buffer
+} RenderStats;
+
+extern RenderStats renderStats;
+
+void resetRenderStats(void);
+
+#define RENDER_STAT_ADD(counter, n) (renderStats.counter += (n))
+#else
+#define RENDER_STAT_ADD(counter, n) ((void)0)
+#endif
+
 LCDRowRange drawLine(uint8_t* bitmap, int rowstride, Point3D* p1, Point3D* p2, int thick, uint8_t pattern[8]);
 LCDRowRange fillTriangle(uint8_t* bitmap, int rowstride, Point3D* p1, Point3D* p2, Point3D* p3, uint8_t pattern[8]);
 LCDRowRange fillQuad(uint8_t* bitmap, int rowstride, Point3D* p1, Point3D* p2, Point3D* p3, Point3D* p4, uint8_t pattern[8]);
+// the points go around a convex polygon, in either direction (at most POLYGON_MAX_POINTS of them)
+#define POLYGON_MAX_POINTS 16
+LCDRowRange fillPolygon(uint8_t* bitmap, int rowstride, Point3D* points, int n, uint8_t pattern[8]);
 
 // used for z buffer and for projective texture mapping
 void resetZScale(float zmin);
 
 #if ENABLE_Z_BUFFER
-void resetZBuffer(void);
+// returns 0 if there's no z buffer to draw with: none was set up and the default can't be allocated.
+int resetZBuffer(void);
+// 8, 16 or 32 bits per pixel. Returns 0 if that format isn't built (see Z_BUFFER_ALL_FORMATS) or can't be allocated.
+int setZBufferFormat(int bits);
+int getZBufferFormat(void);
+int getZBufferDefaultFormat(void);
+// bytes of z buffer cleared since resetZBuffer(), i.e. during the last frame once it's drawn.
+uint32_t getZBufferClearedBytes(void);
 // intended for debugging.
 void render_zbuff(uint8_t* out, int rowstride);
 void prefetch_zbuf(void);
@@ -36,6 +100,15 @@ void prefetch_zbuf(void);
 LCDRowRange drawLine_zbuf(uint8_t* bitmap, int rowstride, Point3D* p1, Point3D* p2, int thick, uint8_t pattern[8]);
 LCDRowRange fillTriangle_zbuf(uint8_t* bitmap, int rowstride, Point3D* p1, Point3D* p2, Point3D* p3, uint8_t pattern[8]);
 LCDRowRange fillQuad_zbuf(uint8_t* bitmap, int rowstride, Point3D* p1, Point3D* p2, Point3D* p3, Point3D* p4, uint8_t pattern[8]);
+LCDRowRange fillPolygon_zbuf(uint8_t* bitmap, int rowstride, Point3D* points, int n, uint8_t pattern[8]);
+#endif
+
+#if ENABLE_S_BUFFER
+// while enabled, the non-Z-buffer functions only draw what hasn't been drawn since resetSBuffer().
+void setSBufferEnabled(int enabled);
+// while frozen, drawing is still clipped to what hasn't been drawn, but doesn't add to it.
+void setSBufferFrozen(int frozen);
+void resetSBuffer(void);
 #endif
 
 #if ENABLE_TEXTURES && ENABLE_Z_BUFFER
@@ -77,6 +150,22 @@ LCDRowRange fillQuad_zt(
 	, int projective
 	#endif
 );
+LCDRowRange fillPolygon_zt(
+	uint8_t* bitmap, int rowstride, Point3D* points, int n,
+	Texture* texture, Point2D* tex
+	#if ENABLE_CUSTOM_PATTERNS
+	, PatternTable* pattern
+	#endif
+	#if ENABLE_POLYGON_SCANLINING
+	, ScanlineFill* scanline
+	#endif
+	#if ENABLE_TEXTURES_GREYSCALE
+	, float lighting, float lighting_weight
+	#endif
+	#if TEXTURE_PERSPECTIVE_MAPPING
+	, int projective
+	#endif
+);
 #endif
 
 #if ENABLE_TEXTURES
@@ -118,6 +207,22 @@ LCDRowRange fillQuad_t(
 	, int projective
 	#endif
 );
+LCDRowRange fillPolygon_t(
+	uint8_t* bitmap, int rowstride, Point3D* points, int n,
+	Texture* texture, Point2D* tex
+	#if ENABLE_CUSTOM_PATTERNS
+	, PatternTable* pattern
+	#endif
+	#if ENABLE_POLYGON_SCANLINING
+	, ScanlineFill* scanline
+	#endif
+	#if ENABLE_TEXTURES_GREYSCALE
+	, float lighting, float lighting_weight
+	#endif
+	#if TEXTURE_PERSPECTIVE_MAPPING
+	, int projective
+	#endif
+);
 #endif
 
 #if ENABLE_INTERLACE
@@ -14,28 +14,66 @@
 #include "shape.h"
 #include "render.h"
 #include "qsort.h"
+#include "radixsort.h"
 
 #include <pd_api.h>
 
-static inline int face_clips_epsilon(FaceInstance* face)
+// which planes of the view a point is outside of (see Scene3D_getOutcode)
+#define OUTCODE_NEAR	(1<<0)
+#define OUTCODE_LEFT	(1<<1)
+#define OUTCODE_RIGHT	(1<<2)
+#define OUTCODE_TOP		(1<<3)
+#define OUTCODE_BOTTOM	(1<<4)
+#define OUTCODE_GUARD	(1<<5) // past the guard band on any side
+#if ENABLE_RENDER_DISTANCE_MAX
+#define OUTCODE_FAR		(1<<6) // past the render distance (see setRenderDistanceMax)
+#else
+#define OUTCODE_FAR		0
+#endif
+#define OUTCODE_VIEW	(OUTCODE_NEAR | OUTCODE_LEFT | OUTCODE_RIGHT | OUTCODE_TOP | OUTCODE_BOTTOM | OUTCODE_FAR)
+
+// faces only: all of its points are outside the same plane, so none of it can be seen.
+#define OUTCODE_REJECTED	(1<<7)
+
+// true if the face isn't drawn as it is: either it's out of view, or its clipped pieces are drawn instead.
+static inline int face_is_clipped(FaceInstance* face)
 {
-	return (face->p1->z < CLIP_EPSILON || face->p2->z < CLIP_EPSILON || face->p3->z < CLIP_EPSILON || (face->p4 && face->p4->z < CLIP_EPSILON));
+	return face->outcodes & (OUTCODE_NEAR | OUTCODE_GUARD | OUTCODE_REJECTED);
+}
+
+// faces rejected before transformation have stale points, so they must be skipped entirely.
+static inline int face_is_backface(FaceInstance* face)
+{
+#if ENABLE_EARLY_BACKFACE_CULLING
+	return face->isBackface;
+#else
+	return 0;
+#endif
 }
 
 #if SORT_3D_FACES_BY_Z
+#define FACELIST_INCREMENT 0x50
+
 static void Scene3D_add_face_to_sortlist(Scene3D* scene, SortedFace sface)
 {
 	int idx = scene->sortedfacelistc++;
 	if (idx >= scene->sortedfacelistsize)
 	{
-		#define FACELIST_INCREMENT 0x50
+		int oldsize = scene->sortedfacelistsize;
 		scene->sortedfacelistsize += FACELIST_INCREMENT;
-		scene->sortedfacelist = m3d_realloc(scene->sortedfacelist, scene->sortedfacelistsize * sizeof(SortedFace));
+		scene->sortedfacelist = FrameArena_grow(&scene->arena, scene->sortedfacelist,
+			oldsize * sizeof(SortedFace), scene->sortedfacelistsize * sizeof(SortedFace));
 	}
 	scene->sortedfacelist[idx] = sface;
 }
 #endif
 
+// child nodes are allocated from here (the root is part of the scene).
+static ObjectPool nodePool = OBJECTPOOL_INIT(Scene3DNode, 32);
+
+// changes whenever a node is added anywhere, so scenes know to rebuild their flattened node lists.
+static int nodeTopologyVersion = 0;
+
 void
 Scene3DNode_init(Scene3DNode* node)
 {
@@ -43,32 +81,55 @@ Scene3DNode_init(Scene3DNode* node)
 	node->parentNode = NULL;
 	node->childNodes = NULL;
 	node->nChildren = 0;
+	node->childCapacity = 0;
 	node->nInstance = 0;
+	node->instanceCapacity = 0;
 	node->instances = NULL;
 	node->colorBias = 0;
 	node->renderStyle = kRenderInheritStyle;
 	node->isVisible = 1;
 	node->needsUpdate = 1;
+	node->flatIndex = -1;
 #if ENABLE_Z_BUFFER
 	node->useZBuffer = 1;
 #endif
+#if ENABLE_FRUSTUM_CULLING
+	node->bounds.center = (Point3D){ 0, 0, 0 };
+	node->bounds.radius = 0;
+	node->boundsEmpty = 1;
+	node->needsBoundsUpdate = 1;
+	node->isCulled = 0;
+#endif
 }
 
 void
 Scene3DNode_deinit(Scene3DNode* node)
 {
-	InstanceHeader* instance = node->instances;
-	
-	while ( instance != NULL )
+	for ( int i = 0; i < node->nInstance; ++i )
 	{
-		InstanceHeader* next = instance->next;
+		InstanceHeader* instance = &node->instances[i].header;
 		switch(instance->type)
 		{
 		case kInstanceTypeShape: {
 				ShapeInstance* shape = (ShapeInstance*)instance;
+				#if ENABLE_LOD
+				// (the prototype is the base shape or one of its levels, which the base keeps.)
+				Shape3D_release(shape->lodBase);
+				#else
 				Shape3D_release(shape->prototype);
+				#endif
 				m3d_free(shape->points);
+				m3d_free(shape->outcodes);
 				m3d_free(shape->faces);
+				if ( shape->clip != NULL )
+					m3d_free(shape->clip);
+				#if ENABLE_EARLY_BACKFACE_CULLING
+				m3d_free(shape->pointVisible);
+				#endif
+				#if ENABLE_BSP
+				if ( shape->bspStack != NULL )
+					m3d_free(shape->bspStack);
+				#endif
 			}
 			break;
 		case kInstanceTypeImposter: {
@@ -77,14 +138,19 @@ Scene3DNode_deinit(Scene3DNode* node)
 			}
 			break;
 		}
-		m3d_free(instance);
-		instance = next;
 	}
 	
+	if ( node->instances != NULL )
+		m3d_free(node->instances);
+	
+	node->instances = NULL;
+	node->nInstance = 0;
+	node->instanceCapacity = 0;
+	
 	for ( int i = 0; i < node->nChildren; ++i )
 	{
 		Scene3DNode_deinit(node->childNodes[i]);
-		m3d_free(node->childNodes[i]);
+		ObjectPool_free(&nodePool, node->childNodes[i]);
 	}
 	
 	if ( node->childNodes != NULL )
@@ -93,11 +159,98 @@ Scene3DNode_deinit(Scene3DNode* node)
 	node->childNodes = NULL;
 }
 
+#if ENABLE_FRUSTUM_CULLING
+// marks this node's bounds (and thus its ancestors' bounds) as needing recomputation.
+static void
+Scene3DNode_invalidateBounds(Scene3DNode* node)
+{
+	// a node's bounds are only recomputed after its parent's,
+	// so if this node is already marked, its ancestors are too.
+	while ( node != NULL && !node->needsBoundsUpdate )
+	{
+		node->needsBoundsUpdate = 1;
+		node = node->parentNode;
+	}
+}
+
+static void
+Scene3DNode_updateBounds(Scene3DNode* node)
+{
+	if ( !node->needsBoundsUpdate )
+		return;
+	
+	node->needsBoundsUpdate = 0;
+	node->boundsEmpty = 1;
+	node->bounds.center = (Point3D){ 0, 0, 0 };
+	node->bounds.radius = 0;
+	
+	for ( int i = 0; i < node->nInstance; ++i )
+	{
+		InstanceHeader* instance = &node->instances[i].header;
+		
+		if ( instance->type != kInstanceTypeShape )
+		{
+			// imposter rectangles are sized in camera space, so they don't scale with the node.
+			node->bounds.radius = -1;
+			node->boundsEmpty = 0;
+			return;
+		}
+		
+		#if ENABLE_LOD
+		Shape3D* proto = ((ShapeInstance*)instance)->lodBase;
+		#else
+		Shape3D* proto = ((ShapeInstance*)instance)->prototype;
+		#endif
+		Sphere3D s = {
+			.center = Matrix3D_apply(instance->transform, proto->center),
+			.radius = proto->radius * Matrix3D_getMaxScale(&instance->transform)
+		};
+		
+		node->bounds = node->boundsEmpty ? s : Sphere3D_union(node->bounds, s);
+		node->boundsEmpty = 0;
+	}
+	
+	for ( int i = 0; i < node->nChildren; ++i )
+	{
+		Scene3DNode* child = node->childNodes[i];
+		
+		if ( !child->isVisible )
+			continue;
+		
+		Scene3DNode_updateBounds(child);
+		
+		if ( child->boundsEmpty )
+			continue;
+		
+		if ( child->bounds.radius < 0 )
+		{
+			node->bounds.radius = -1;
+			node->boundsEmpty = 0;
+			return;
+		}
+		
+		Sphere3D s = {
+			.center = Matrix3D_apply(child->transform, child->bounds.center),
+			.radius = child->bounds.radius * Matrix3D_getMaxScale(&child->transform)
+		};
+		
+		node->bounds = node->boundsEmpty ? s : Sphere3D_union(node->bounds, s);
+		node->boundsEmpty = 0;
+	}
+}
+#endif
+
 void
 Scene3DNode_setTransform(Scene3DNode* node, Matrix3D* xform)
 {
 	node->transform = *xform;
 	
+#if ENABLE_FRUSTUM_CULLING
+	// our own bounds are in local space and don't change, but our parent's do.
+	if ( node->parentNode != NULL )
+		Scene3DNode_invalidateBounds(node->parentNode);
+#endif
+	
 	// mark this branch of the tree for updating
 	
 	while ( node != NULL )
@@ -147,6 +300,11 @@ Scene3DNode_setVisible(Scene3DNode* node, int visible)
 {
 	node->isVisible = visible;
 	node->needsUpdate = 1;
+	
+#if ENABLE_FRUSTUM_CULLING
+	if ( node->parentNode != NULL )
+		Scene3DNode_invalidateBounds(node->parentNode);
+#endif
 }
 
 #if ENABLE_Z_BUFFER
@@ -157,28 +315,70 @@ void Scene3DNode_setUsesZBuffer(Scene3DNode* node, int flag)
 }
 #endif
 
-void
-Scene3DNode_addShapeWithTransform(Scene3DNode* node, Shape3D* shape, Matrix3D transform)
+// makes room for one more instance at the end of the node's array.
+static Scene3DInstance*
+Scene3DNode_newInstance(Scene3DNode* node)
+{
+	if ( node->nInstance == node->instanceCapacity )
+	{
+		node->instanceCapacity = (node->instanceCapacity == 0) ? 1 : node->instanceCapacity * 2;
+		node->instances = m3d_realloc(node->instances, node->instanceCapacity * sizeof(Scene3DInstance));
+	}
+	
+	return &node->instances[node->nInstance++];
+}
+
+// sets up the instance's points and faces for the given prototype, growing its arrays if needed.
+// (called again when a different level of detail is selected.)
+static void
+ShapeInstance_setPrototype(ShapeInstance* nodeshape, Shape3D* shape)
 {
-	ShapeInstance* nodeshape = m3d_malloc(sizeof(ShapeInstance));
 	int i;
 	
-	nodeshape->header.type = kInstanceTypeShape;
-	nodeshape->renderStyle = kRenderInheritStyle;
-	nodeshape->prototype = Shape3D_retain(shape);
+	nodeshape->prototype = shape;
+	nodeshape->prototypeVersion = shape->version;
 	nodeshape->nPoints = shape->nPoints;
-	nodeshape->points = m3d_malloc(sizeof(Point3D) * shape->nPoints);
+	
+	if ( shape->nPoints > nodeshape->pointCapacity )
+	{
+		nodeshape->pointCapacity = shape->nPoints;
+		nodeshape->points = m3d_realloc(nodeshape->points, sizeof(Point3D) * shape->nPoints);
+		nodeshape->outcodes = m3d_realloc(nodeshape->outcodes, shape->nPoints);
+		
+	#if ENABLE_EARLY_BACKFACE_CULLING
+		nodeshape->pointVisible = m3d_realloc(nodeshape->pointVisible, shape->nPoints);
+	#endif
+	}
 
 	// not strictly necessary, since we set these again in Scene3D_updateShapeInstance:
 	//for ( i = 0; i < shape->nPoints; ++i )
 	//	nodeshape->points[i] = shape->points[i];
 	
 	nodeshape->nFaces = shape->nFaces;
-	nodeshape->faces = m3d_malloc(sizeof(FaceInstance) * shape->nFaces);
 	
-	nodeshape->clipCapacity = 0;
+	if ( shape->nFaces > nodeshape->faceCapacity )
+	{
+		nodeshape->faceCapacity = shape->nFaces;
+		nodeshape->faces = m3d_realloc(nodeshape->faces, sizeof(FaceInstance) * shape->nFaces);
+	}
+
+#if ENABLE_BSP
+	// a traversal never holds more than two pending entries per level of the tree, plus one.
+	if ( shape->bsp != NULL )
+		nodeshape->bspStack = m3d_realloc(nodeshape->bspStack, (2 * shape->bspDepth + 1) * sizeof(int));
+	else if ( nodeshape->bspStack != NULL )
+	{
+		m3d_free(nodeshape->bspStack);
+		nodeshape->bspStack = NULL;
+	}
+#endif
+
+#if SORT_3D_FACES_BY_Z && FACE_SORT_COHERENT
+	nodeshape->sortSlot = -1;
+#endif
+	
+	// clipped faces point into the faces array, so they're no longer valid.
 	nodeshape->nClip = 0;
-	nodeshape->clip = NULL;
 	
 	for ( i = 0; i < shape->nFaces; ++i )
 	{
@@ -204,7 +404,54 @@ Scene3DNode_addShapeWithTransform(Scene3DNode* node, Shape3D* shape, Matrix3D tr
 		// also not necessary
 		face->normal = normal(face->p1, face->p2, face->p3);
 		face->isDoubleSided = shape->faces[i].isDoubleSided;
+		face->outcodes = 0;
+		#if ENABLE_EARLY_BACKFACE_CULLING
+		face->isBackface = 0;
+		#endif
+		#if SORT_3D_FACES_BY_Z && FACE_SORT_COHERENT
+		face->sortSlot = -1;
+		#endif
 	}
+}
+
+void
+Scene3DNode_addShapeWithTransform(Scene3DNode* node, Shape3D* shape, Matrix3D transform)
+{
+	ShapeInstance* nodeshape = &Scene3DNode_newInstance(node)->shape;
+	
+	nodeshape->header.type = kInstanceTypeShape;
+	nodeshape->renderStyle = kRenderInheritStyle;
+	Shape3D_retain(shape);
+#if ENABLE_LOD
+	nodeshape->lodBase = shape;
+#endif
+	
+	nodeshape->points = NULL;
+	nodeshape->outcodes = NULL;
+	nodeshape->pointCapacity = 0;
+	nodeshape->faces = NULL;
+	nodeshape->faceCapacity = 0;
+#if ENABLE_EARLY_BACKFACE_CULLING
+	nodeshape->pointVisible = NULL;
+#endif
+#if ENABLE_BSP
+	nodeshape->bspStack = NULL;
+#endif
+	nodeshape->clipCapacity = 0;
+	nodeshape->clip = NULL;
+#if ENABLE_SHAPE_IMPOSTERS
+	nodeshape->isImposter = 0;
+	nodeshape->imposter.header.type = kInstanceTypeImposter;
+	nodeshape->imposter.prototype = NULL;
+	#if ENABLE_FRUSTUM_CULLING
+	nodeshape->imposter.header.isCulled = 0;
+	#endif
+	#if SORT_3D_FACES_BY_Z && FACE_SORT_COHERENT
+	nodeshape->imposter.sortSlot = -1;
+	#endif
+#endif
+	
+	ShapeInstance_setPrototype(nodeshape, shape);
 	
 	nodeshape->header.transform = transform;
 	nodeshape->header.center = Matrix3D_apply(transform, shape->center);
@@ -215,9 +462,10 @@ Scene3DNode_addShapeWithTransform(Scene3DNode* node, Shape3D* shape, Matrix3D tr
 	nodeshape->orderTable = NULL;
 #endif
 	
-	nodeshape->header.next = node->instances;
-	node->instances = &nodeshape->header;
-	++node->nInstance;
+#if ENABLE_FRUSTUM_CULLING
+	nodeshape->header.isCulled = 0;
+	Scene3DNode_invalidateBounds(node);
+#endif
 }
 
 void
@@ -234,15 +482,26 @@ Scene3DNode_addShape(Scene3DNode* node, Shape3D* shape)
 
 void Scene3DNode_addImposterWithTransform(Scene3DNode* node, Imposter3D* imposter, Matrix3D transform)
 {
-	ImposterInstance* nodeimp = m3d_malloc(sizeof(ImposterInstance));
+	ImposterInstance* nodeimp = &Scene3DNode_newInstance(node)->imposter;
 	nodeimp->header.type = kInstanceTypeImposter;
 	nodeimp->prototype = Imposter3D_retain(imposter);
 	nodeimp->header.transform = transform;
 	nodeimp->header.center = Matrix3D_apply(transform, imposter->center);
 	
-	nodeimp->header.next = node->instances;
-	node->instances = &nodeimp->header;
-	++node->nInstance;
+#if ENABLE_TEXTURES
+	nodeimp->frame = 0;
+#endif
+#if ENABLE_SHAPE_IMPOSTERS
+	nodeimp->scale = 1;
+#endif
+#if SORT_3D_FACES_BY_Z && FACE_SORT_COHERENT
+	nodeimp->sortSlot = -1;
+#endif
+	
+#if ENABLE_FRUSTUM_CULLING
+	nodeimp->header.isCulled = 0;
+	Scene3DNode_invalidateBounds(node);
+#endif
 }
 
 void Scene3DNode_addImposter(Scene3DNode* node, Imposter3D* imposter)
@@ -253,13 +512,23 @@ void Scene3DNode_addImposter(Scene3DNode* node, Imposter3D* imposter)
 Scene3DNode*
 Scene3DNode_newChild(Scene3DNode* node)
 {
-	node->childNodes = m3d_realloc(node->childNodes, sizeof(Scene3DNode*) * (node->nChildren + 1));
+	if ( node->nChildren == node->childCapacity )
+	{
+		node->childCapacity = (node->childCapacity == 0) ? 4 : node->childCapacity * 2;
+		node->childNodes = m3d_realloc(node->childNodes, sizeof(Scene3DNode*) * node->childCapacity);
+	}
 
-	Scene3DNode* child = m3d_malloc(sizeof(Scene3DNode));
+	Scene3DNode* child = ObjectPool_alloc(&nodePool);
 	Scene3DNode_init(child);
 
 	node->childNodes[node->nChildren++] = child;
 	child->parentNode = node;
+	++nodeTopologyVersion;
+	
+#if ENABLE_FRUSTUM_CULLING
+	// child's own flag is already set, so this wouldn't propagate from there.
+	Scene3DNode_invalidateBounds(node);
+#endif
 
 	return child;
 }
@@ -281,496 +550,505 @@ static void applyPerspectiveToPoint(Scene3D* scene, Point3D* p)
 	}
 }
 
+// which planes of the view (and of the guard band around it) the point is outside of.
+// If it isn't projected yet, its camera-space position is compared to the planes in
+// homogeneous form instead, which still holds for points behind the camera.
+static uint8_t
+Scene3D_getOutcode(Scene3D* scene, Point3D* p, int projected)
+{
+	float x = p->x;
+	float y = p->y;
+	float w = 1;
+	
+	if ( !projected )
+	{
+		if ( scene->hasPerspective )
+		{
+			x = scene->scale * p->x + scene->centerx * p->z;
+			y = scene->scale * p->y + scene->centery * p->z;
+			w = p->z;
+		}
+		else
+		{
+			x = scene->scale * p->x + scene->centerx;
+			y = scene->scale * p->y + scene->centery;
+		}
+	}
+	
+	uint8_t code = 0;
+	
+	if ( p->z < CLIP_EPSILON )
+		code |= OUTCODE_NEAR;
+	
+#if ENABLE_RENDER_DISTANCE_MAX
+	// the renderer drops a face only if all of it is past this, so there's nothing to clip against.
+	if ( p->z > getRenderDistanceMax() )
+		code |= OUTCODE_FAR;
+#endif
+	
+	if ( x < VIEWPORT_LEFT * w )
+		code |= OUTCODE_LEFT;
+	else if ( x >= VIEWPORT_RIGHT * w )
+		code |= OUTCODE_RIGHT;
+	
+	if ( y < VIEWPORT_TOP * w )
+		code |= OUTCODE_TOP;
+	else if ( y >= VIEWPORT_BOTTOM * w )
+		code |= OUTCODE_BOTTOM;
+	
+#if GUARD_BAND_CLIPPING
+	if ( x < (VIEWPORT_LEFT - GUARD_BAND) * w || x > (VIEWPORT_RIGHT + GUARD_BAND) * w ||
+		 y < (VIEWPORT_TOP - GUARD_BAND) * w || y > (VIEWPORT_BOTTOM + GUARD_BAND) * w )
+		code |= OUTCODE_GUARD;
+#endif
+	
+	return code;
+}
+
 #if FACE_CLIPPING
-Scene3D* clipScene; // stored globally for ease of access.
 static ClippedFace3D* clipAllocate(ShapeInstance* shape, FaceInstance* face)
 {
-	int index = shape->nClip++;
-	if (shape->nClip > shape->clipCapacity)
+	if ( shape->nClip == shape->clipCapacity )
 	{
-		shape->clipCapacity += CLIP_RESIZE;
+		shape->clipCapacity = (shape->clipCapacity == 0) ? CLIP_RESIZE : shape->clipCapacity * 2;
 		shape->clip = m3d_realloc(shape->clip, shape->clipCapacity * sizeof(ClippedFace3D));
 	}
-	shape->clip[index].p1 = NULL;
-	shape->clip[index].src = face;
-	#if ENABLE_TEXTURES && ENABLE_TEXTURES_GREYSCALE
-	if (shape->prototype->texmap)
-	{
-		// copy lighting value from source texmap
-		shape->clip[index].tex.lighting = shape->prototype->texmap[face->org_face].lighting;
-	}
+	
+	face->clipIndex = shape->nClip;
+	
+	ClippedFace3D* clip = &shape->clip[shape->nClip++];
+	clip->nPoints = 0;
+	clip->src = face;
+	
+	#if ENABLE_TEXTURES
+	FaceTexture* ft = (shape->prototype->texmap != NULL) ? &shape->prototype->texmap[face->org_face] : NULL;
+	clip->texture_enabled = (ft != NULL && ft->texture_enabled);
+	#if ENABLE_TEXTURES_GREYSCALE
+	// copy lighting value from source texmap
+	clip->lighting = (ft != NULL) ? ft->lighting : 0;
+	#endif
 	#endif
-	return &shape->clip[index];
+	
+	return clip;
 }
 
-static float interpolatePointAtZClip(Point3D* out, Point3D* a, Point3D* b)
+// adds the point t of the way from point a to point b of the input polygon to the output.
+// On the screen with perspective, it's 1/z and the texture coordinates over z that
+// change linearly, so those are what's interpolated.
+static void
+addClipIntersection(ClippedFace3D* out, ClippedFace3D* in, int a, int b, float t, int perspective)
 {
-	float p = (CLIP_EPSILON - b->z) / (a->z - b->z);
-	out->z = CLIP_EPSILON;
-	out->x = p * a->x + (1 - p) * b->x;
-	out->y = p * a->y + (1 - p) * b->y;
-	return p;
+	Point3D* pa = &in->points[a];
+	Point3D* pb = &in->points[b];
+	float wa = 1 - t;
+	float wb = t;
+	
+	if ( perspective )
+	{
+		wa /= pa->z;
+		wb /= pb->z;
+	}
+	
+	float sum = wa + wb;
+	Point3D* p = &out->points[out->nPoints];
+	p->x = (1 - t) * pa->x + t * pb->x;
+	p->y = (1 - t) * pa->y + t * pb->y;
+	p->z = (wa * pa->z + wb * pb->z) / sum;
+	
+	#if ENABLE_TEXTURES
+	Point2D* ta = &in->tex[a];
+	Point2D* tb = &in->tex[b];
+	out->tex[out->nPoints].x = (wa * ta->x + wb * tb->x) / sum;
+	out->tex[out->nPoints].y = (wa * ta->y + wb * tb->y) / sum;
+	#endif
+	
+	++out->nPoints;
 }
 
-#if ENABLE_TEXTURES
-static void interpolatePoint2D(Point2D* out, Point2D* a, Point2D* b, float p)
+static void
+addClipPoint(ClippedFace3D* out, ClippedFace3D* in, int i)
 {
-	out->x = p * a->x + (1-p) * b->x;
-	out->y = p * a->y + (1-p) * b->y;
+	out->points[out->nPoints] = in->points[i];
+	#if ENABLE_TEXTURES
+	out->tex[out->nPoints] = in->tex[i];
+	#endif
+	++out->nPoints;
 }
-#endif
 
-#if ENABLE_TEXTURES
-// cheap trick to check if the face is NULL given only the offset into its point
-#define POINT_FT_NOT_NULL(point) ((uintptr_t)(point) > offsetof(FaceTexture, t4))
-#endif
+// Sutherland-Hodgman: keeps the part of the polygon on the inner side of a plane, where
+// the given function of a point is >= 0. Each plane adds at most one point to a convex polygon.
+#define CLIP_POLYGON(out, in, DIST, perspective) \
+{ \
+	(out)->nPoints = 0; \
+	for ( int i = 0; i < (in)->nPoints; ++i ) \
+	{ \
+		int j = (i + 1) % (in)->nPoints; \
+		Point3D* p = &(in)->points[i]; \
+		float da = (DIST); \
+		p = &(in)->points[j]; \
+		float db = (DIST); \
+		if ( da >= 0 && (out)->nPoints < CLIP_MAX_POINTS ) \
+			addClipPoint(out, in, i); \
+		else if ( da >= 0 ) \
+			RENDER_STAT_ADD(clipPointsDropped, 1); \
+		if ( (da >= 0) != (db >= 0) && (out)->nPoints < CLIP_MAX_POINTS ) \
+			addClipIntersection(out, in, i, j, da / (da - db), perspective); \
+		else if ( (da >= 0) != (db >= 0) ) \
+			RENDER_STAT_ADD(clipPointsDropped, 1); \
+	} \
+}
 
-// one point in front of camera, two points behind.
-// as in all following clip straddle functions, the points are given
-// in counterclockwise order starting with the rightmost point that is 
-// in front of the camera.
-static void calculateClipping_straddle12(
-	ClippedFace3D* clip, Point3D* a, Point3D* b1, Point3D* b2
-#if ENABLE_TEXTURES
-	, Point2D* ta, Point2D* tb1, Point2D* tb2
-#endif
-)
+// clips the face at the near plane (in camera space, if it isn't projected yet) and, if it
+// still reaches past the guard band, at the band's edges on the screen. What's left of it
+// is stored in the shape's clip list.
+static void
+clipFace(Scene3D* scene, ShapeInstance* shape, FaceInstance* face, int projected)
 {
-	clip->p2 = *a;
-	float pab1 = interpolatePointAtZClip(&clip->p3, a, b1);
-	float pab2 = interpolatePointAtZClip(&clip->p4, a, b2);
+	ClippedFace3D polys[2];
+	ClippedFace3D* in = &polys[0];
+	ClippedFace3D* out = &polys[1];
+	ClippedFace3D* tmp;
+	
+	RENDER_STAT_ADD(facesClipped, 1);
+	
+	Point3D* points[4] = { face->p1, face->p2, face->p3, face->p4 };
+	in->nPoints = (face->p4 != NULL) ? 4 : 3;
 	
 	#if ENABLE_TEXTURES
-	if (POINT_FT_NOT_NULL(ta))
+	FaceTexture* ft = (shape->prototype->texmap != NULL) ? &shape->prototype->texmap[face->org_face] : NULL;
+	Point2D texcoords[4] = { { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 } };
+	
+	if ( ft != NULL && ft->texture_enabled )
 	{
-		clip->tex.t1 = *ta;
-		interpolatePoint2D(&clip->tex.t2, ta, tb1, pab1);
-		interpolatePoint2D(&clip->tex.t3, ta, tb2, pab2);
-		clip->tex.texture_enabled = 1;
+		texcoords[0] = ft->t1;
+		texcoords[1] = ft->t2;
+		texcoords[2] = ft->t3;
+		texcoords[3] = ft->t4;
 	}
-	else
+	#endif
+	
+	for ( int i = 0; i < in->nPoints; ++i )
 	{
-		clip->tex.texture_enabled = 0;
+		in->points[i] = *points[i];
+		#if ENABLE_TEXTURES
+		in->tex[i] = texcoords[i];
+		#endif
 	}
-	#endif
 	
-	applyPerspectiveToPoint(clipScene, &clip->p2);
-	applyPerspectiveToPoint(clipScene, &clip->p3);
-	applyPerspectiveToPoint(clipScene, &clip->p4);
-}
-
-// two points in front of camera, one point behind.
-static void calculateClipping_straddle21(
-	ClippedFace3D* clip, Point3D* a1, Point3D* a2, Point3D* b
-#if ENABLE_TEXTURES
-	, Point2D* ta1, Point2D* ta2, Point2D* tb
-#endif
-)
-{
-	clip->p1 = a1;
-	clip->p2 = *a2;
-	float pa2b = interpolatePointAtZClip(&clip->p3, a2, b);
-	float pa1b = interpolatePointAtZClip(&clip->p4, a1, b);
+	uint8_t any = face->outcodes;
+	uint8_t all = 0;
 	
-	#if ENABLE_TEXTURES
-	if (POINT_FT_NOT_NULL(ta1))
+	if ( !projected )
 	{
-		clip->tex.t4 = *ta1;
-		clip->tex.t1 = *ta2;
-		interpolatePoint2D(&clip->tex.t2, ta2, tb, pa2b);
-		interpolatePoint2D(&clip->tex.t3, ta1, tb, pa1b);
-		clip->tex.texture_enabled = 1;
+		if ( face->outcodes & OUTCODE_NEAR )
+		{
+			// (everything changes linearly in camera space.)
+			CLIP_POLYGON(out, in, p->z - CLIP_EPSILON, 0);
+			tmp = in; in = out; out = tmp;
+			
+			for ( int i = 0; i < in->nPoints; ++i )
+			{
+				if ( in->points[i].z < CLIP_EPSILON )
+					in->points[i].z = CLIP_EPSILON;
+			}
+		}
+		
+		// now it's on the screen its points' outcodes can be found (or found again).
+		any = 0;
+		all = 0xff;
+		
+		for ( int i = 0; i < in->nPoints; ++i )
+		{
+			applyPerspectiveToPoint(scene, &in->points[i]);
+			
+			uint8_t code = Scene3D_getOutcode(scene, &in->points[i], 1);
+			any |= code;
+			all &= code;
+		}
 	}
-	else
+	
+	if ( in->nPoints < 3 || (all & OUTCODE_VIEW) )
+		return;
+	
+#if GUARD_BAND_CLIPPING
+	if ( any & OUTCODE_GUARD )
 	{
-		clip->tex.texture_enabled = 0;
+		int perspective = scene->hasPerspective;
+		
+		CLIP_POLYGON(out, in, p->x - (VIEWPORT_LEFT - GUARD_BAND), perspective);
+		CLIP_POLYGON(in, out, (VIEWPORT_RIGHT + GUARD_BAND) - p->x, perspective);
+		CLIP_POLYGON(out, in, p->y - (VIEWPORT_TOP - GUARD_BAND), perspective);
+		CLIP_POLYGON(in, out, (VIEWPORT_BOTTOM + GUARD_BAND) - p->y, perspective);
+		
+		if ( in->nPoints < 3 )
+			return;
 	}
-	#endif
+#endif
 	
-	applyPerspectiveToPoint(clipScene, &clip->p2);
-	applyPerspectiveToPoint(clipScene, &clip->p3);
-	applyPerspectiveToPoint(clipScene, &clip->p4);
+	ClippedFace3D* clip = clipAllocate(shape, face);
+	clip->nPoints = in->nPoints;
+	memcpy(clip->points, in->points, in->nPoints * sizeof(Point3D));
+	
+	#if ENABLE_TEXTURES
+	memcpy(clip->tex, in->tex, in->nPoints * sizeof(Point2D));
+	#endif
 }
 
-// three points in front of camera, zero behind.
-static void calculateClipping_straddle30(
-	ClippedFace3D* clip, Point3D* a1, Point3D* a2, Point3D* a3
-#if ENABLE_TEXTURES
-	, Point2D* ta1, Point2D* ta2, Point2D* ta3
-#endif
-)
+// replaces the faces which cross the near plane or reach past the guard band with their clipped
+// polygons. If the points aren't projected yet, the polygons are, as they're clipped.
+static void
+calculateClipping(Scene3D* scene, ShapeInstance* shape, int projected)
 {
-	clip->p2 = *a1;
-	clip->p3 = *a2;
-	clip->p4 = *a3;
+	// reset clip buffer
+	shape->nClip = 0;
 	
-	#if ENABLE_TEXTURES
-	if (POINT_FT_NOT_NULL(ta1))
-	{
-		clip->tex.t1 = *ta1;
-		clip->tex.t2 = *ta2;
-		clip->tex.t3 = *ta3;
-		clip->tex.texture_enabled = 1;
-	}
-	else
+	for ( int i = 0; i < shape->nFaces; ++i )
 	{
-		clip->tex.texture_enabled = 0;
+		FaceInstance* face = &shape->faces[i];
+		
+		if ( face_is_backface(face) || (face->outcodes & OUTCODE_REJECTED) )
+			continue;
+		
+		if ( face->outcodes & (OUTCODE_NEAR | OUTCODE_GUARD) )
+		{
+			face->clipIndex = -1;
+			clipFace(scene, shape, face, projected);
+		}
 	}
-	#endif
 	
-	applyPerspectiveToPoint(clipScene, &clip->p2);
-	applyPerspectiveToPoint(clipScene, &clip->p3);
-	applyPerspectiveToPoint(clipScene, &clip->p4);
+	// (the clip buffer is kept even if unused, so it doesn't have to be reallocated next frame.)
 }
-
-// two points in front of camera, two points behind.
-static void calculateClipping_straddle22(
-	ClippedFace3D* clip, Point3D* a1, Point3D* a2, Point3D* b1, Point3D* b2
-#if ENABLE_TEXTURES
-	, Point2D* ta1, Point2D* ta2, Point2D* tb1, Point2D* tb2
 #endif
-)
+
+#if ENABLE_FRUSTUM_CULLING
+static void
+Scene3D_updateFrustum(Scene3D* scene)
 {
-	float pa2b1 = interpolatePointAtZClip(&clip->p2, a2, b1);
-	float pa1b2 = interpolatePointAtZClip(&clip->p3, a1, b2);
-	clip->p4 = *a1;
-	clip->p1 = a2;
+	// x and y extents of the view, as a slope (if perspective) or offset (if not)
+	float edge[4] = {
+		(VIEWPORT_LEFT - scene->centerx) / scene->scale,
+		(VIEWPORT_RIGHT - scene->centerx) / scene->scale,
+		(VIEWPORT_TOP - scene->centery) / scene->scale,
+		(VIEWPORT_BOTTOM - scene->centery) / scene->scale
+	};
 	
-	#if ENABLE_TEXTURES
-	if (POINT_FT_NOT_NULL(ta1))
+	for ( int i = 0; i < 4; ++i )
 	{
-		interpolatePoint2D(&clip->tex.t1, ta2, tb1, pa2b1);
-		interpolatePoint2D(&clip->tex.t2, ta1, tb2, pa1b2);
-		clip->tex.t3 = *ta1;
-		clip->tex.t4 = *ta2;
-		clip->tex.texture_enabled = 1;
+		// left and top planes face in the positive direction, right and bottom in the negative.
+		float sign = (i % 2 == 0) ? 1 : -1;
+		Vector3D n = { 0, 0, 0 };
+		
+		if ( i < 2 )
+			n.dx = sign;
+		else
+			n.dy = sign;
+		
+		if ( scene->hasPerspective )
+		{
+			n.dz = -sign * edge[i];
+			scene->frustum[i] = Vector3D_normalize(n);
+			scene->frustumOffset[i] = 0;
+		}
+		else
+		{
+			scene->frustum[i] = n;
+			scene->frustumOffset[i] = -sign * edge[i];
+		}
 	}
-	else
+}
+
+// true if the given sphere (in camera space) cannot possibly be seen.
+static int
+Scene3D_isSphereCulled(Scene3D* scene, Point3D center, float radius)
+{
+	if ( center.z + radius < CLIP_EPSILON )
+		return 1;
+	
+	if ( center.z - radius > scene->farDistance )
+		return 1;
+	
+	Vector3D c = { center.x, center.y, center.z };
+	
+	for ( int i = 0; i < 4; ++i )
 	{
-		clip->tex.texture_enabled = 0;
+		if ( Vector3DDot(scene->frustum[i], c) + scene->frustumOffset[i] < -radius )
+			return 1;
 	}
-	#endif
 	
-	applyPerspectiveToPoint(clipScene, &clip->p2);
-	applyPerspectiveToPoint(clipScene, &clip->p3);
-	applyPerspectiveToPoint(clipScene, &clip->p4);
+	return 0;
 }
-
-// two points in front of camera, two points behind,
-// but we rotate the points on the resulting quad to ensure
-// consistent triangulation.
-static void calculateClipping_straddle22R(
-	ClippedFace3D* clip, Point3D* a1, Point3D* a2, Point3D* b1, Point3D* b2
-#if ENABLE_TEXTURES
-	, Point2D* ta1, Point2D* ta2, Point2D* tb1, Point2D* tb2
 #endif
-)
+
+#if ENABLE_EARLY_BACKFACE_CULLING || ENABLE_BSP || ENABLE_TEXTURES
+// the camera in the object space of transform m, as a homogeneous point:
+// its position if perspective, otherwise the (reversed) view direction at infinity.
+static void
+Scene3D_getEye(Scene3D* scene, Matrix3D* m, Vector3D* eye, float* w)
 {
-	float pa2b1 = interpolatePointAtZClip(&clip->p3, a2, b1);
-	float pa1b2 = interpolatePointAtZClip(&clip->p4, a1, b2);
-	clip->p2 = *a2;
-	clip->p1 = a1;
+	Matrix3D inv = Matrix3D_inverse(*m);
 	
-	#if ENABLE_TEXTURES
-	if (POINT_FT_NOT_NULL(ta1))
+	if ( scene->hasPerspective )
 	{
-		interpolatePoint2D(&clip->tex.t2, ta2, tb1, pa2b1);
-		interpolatePoint2D(&clip->tex.t3, ta1, tb2, pa1b2);
-		clip->tex.t1 = *ta2;
-		clip->tex.t4 = *ta1;
-		clip->tex.texture_enabled = 1;
+		Point3D p = Matrix3D_apply(inv, Point3DMake(0, 0, 0));
+		*eye = Vector3DMake(p.x, p.y, p.z);
+		*w = 1;
 	}
 	else
 	{
-		clip->tex.texture_enabled = 0;
+		*eye = Vector3DMake(-inv.m[0][2], -inv.m[1][2], -inv.m[2][2]);
+		*w = 0;
 	}
-	#endif
-	
-	applyPerspectiveToPoint(clipScene, &clip->p2);
-	applyPerspectiveToPoint(clipScene, &clip->p3);
-	applyPerspectiveToPoint(clipScene, &clip->p4);
 }
+#endif
 
-// three points in front of camera, one point behind.
-// interpolate b toward a1
-static void calculateClipping_straddle31A1(
-	ClippedFace3D* clip, Point3D* a1, Point3D* a2, Point3D* a3, Point3D* b
-#if ENABLE_TEXTURES
-	, Point2D* ta1, Point2D* ta2, Point2D* ta3, Point2D* tb
-#endif
-)
+#if ENABLE_EARLY_BACKFACE_CULLING
+// marks the faces of a closed shape which face away from the camera, and the points
+// still needed by the remaining faces. Done in object space, so nothing needs transforming first.
+static void
+Scene3D_cullBackfaces(Scene3D* scene, ShapeInstance* shape, Matrix3D* m, int inverting, RenderStyle style)
 {
-	clip->p1 = a1;
-	clip->p2 = *a2;
-	clip->p3 = *a3;
-	float pa1b = interpolatePointAtZClip(&clip->p4, a1, b);
+	Shape3D* proto = shape->prototype;
+	float det = Matrix3D_getDeterminant(m);
 	
-	#if ENABLE_TEXTURES
-	if (POINT_FT_NOT_NULL(ta1))
+	// wireframe-back style draws back faces as well.
+	if ( !proto->isClosed || (style & kRenderWireframeBack) || det == 0 )
 	{
-		clip->tex.t4 = *ta1;
-		clip->tex.t1 = *ta2;
-		clip->tex.t2 = *ta3;
-		interpolatePoint2D(&clip->tex.t3, ta1, tb, pa1b);
-		clip->tex.texture_enabled = 1;
+		for ( int i = 0; i < shape->nFaces; ++i )
+			shape->faces[i].isBackface = 0;
+		
+		memset(shape->pointVisible, 1, shape->nPoints);
+		return;
 	}
-	else
+	
+	// Which side of a face is the front agrees with the winding check in drawShapeFace,
+	// so it depends on the orientation of the transform (the camera itself is a reflection).
+	Vector3D eye;
+	float w;
+	
+	Scene3D_getEye(scene, m, &eye, &w);
+	
+	memset(shape->pointVisible, 0, shape->nPoints);
+	
+	for ( int i = 0; i < shape->nFaces; ++i )
 	{
-		clip->tex.texture_enabled = 0;
+		Face3D* f = &proto->faces[i];
+		FaceInstance* face = &shape->faces[i];
+		
+		float side = Vector3DDot(f->normal, eye) + f->d * w;
+		
+		if ( det > 0 )
+			side = -side;
+		
+		face->isBackface = !f->isDoubleSided && ((side >= 0) ^ (inverting ? 1 : 0));
+		
+		if ( face->isBackface )
+		{
+			RENDER_STAT_ADD(facesBackfaceCulled, 1);
+			continue;
+		}
+		
+		shape->pointVisible[f->p1] = 1;
+		shape->pointVisible[f->p2] = 1;
+		shape->pointVisible[f->p3] = 1;
+		if ( f->p4 != 0xffff )
+			shape->pointVisible[f->p4] = 1;
 	}
-	#endif
-	
-	applyPerspectiveToPoint(clipScene, &clip->p2);
-	applyPerspectiveToPoint(clipScene, &clip->p3);
-	applyPerspectiveToPoint(clipScene, &clip->p4);
 }
-
-// three points in front of camera, one point behind.
-// interpolate b toward a3
-static void calculateClipping_straddle31A3(
-	ClippedFace3D* clip, Point3D* a1, Point3D* a2, Point3D* a3, Point3D* b
-#if ENABLE_TEXTURES
-	, Point2D* ta1, Point2D* ta2, Point2D* ta3, Point2D* tb
 #endif
-)
+
+static void
+Scene3D_updateImposterInstance(Scene3D* scene, ImposterInstance* imposter, Matrix3D xform)
 {
-	clip->p1 = a1;
-	clip->p2 = *a2;
-	clip->p3 = *a3;
-	float pa3b = interpolatePointAtZClip(&clip->p4, a3, b);
+	Imposter3D* proto = imposter->prototype;
+	imposter->header.center = Matrix3D_apply(xform, Matrix3D_apply(imposter->header.transform, proto->center));
 	
-	#if ENABLE_TEXTURES
-	if (POINT_FT_NOT_NULL(ta1))
-	{
-		clip->tex.t4 = *ta1;
-		clip->tex.t1 = *ta2;
-		clip->tex.t2 = *ta3;
-		interpolatePoint2D(&clip->tex.t3, ta3, tb, pa3b);
-		clip->tex.texture_enabled = 1;
-	}
-	else
+	RENDER_STAT_ADD(instancesUpdated, 1);
+	
+	if (imposter->header.center.z < CLIP_EPSILON) return;
+	
+	#if ENABLE_SHAPE_IMPOSTERS
+	float scale = imposter->scale;
+	#else
+	float scale = 1;
+	#endif
+	
+	#if ENABLE_FRUSTUM_CULLING
+	float rx = MAX(fabsf(proto->x1), fabsf(proto->x2)) * scale;
+	float ry = MAX(fabsf(proto->y1), fabsf(proto->y2)) * scale;
+	imposter->header.isCulled = Scene3D_isSphereCulled(scene, imposter->header.center, sqrtf(rx * rx + ry * ry));
+	
+	if ( imposter->header.isCulled )
 	{
-		clip->tex.texture_enabled = 0;
+		RENDER_STAT_ADD(instancesCulled, 1);
+		return;
 	}
 	#endif
 	
-	applyPerspectiveToPoint(clipScene, &clip->p2);
-	applyPerspectiveToPoint(clipScene, &clip->p3);
-	applyPerspectiveToPoint(clipScene, &clip->p4);
-}
-
-#if !ENABLE_TEXTURES
-	#define CLIP3(AB, A, B, C) \
-	{ \
-		calculateClipping_straddle##AB( \
-			clipAllocate(shape, face), \
-			p##A, p##B, p##C \
-		); \
-	}
-	#define CLIP4(AB, A, B, C, D) \
-	{ \
-		calculateClipping_straddle##AB( \
-			clipAllocate(shape, face), \
-			p##A, p##B, p##C, p##D \
-		); \
-	}
-#else
-	#define CLIP3(AB, A, B, C) \
-	{ \
-		if (shape->prototype->texmap && shape->prototype->texmap[face->org_face].texture_enabled) \
-		{ \
-			FaceTexture* ft = &shape->prototype->texmap[face->org_face]; \
-			calculateClipping_straddle##AB( \
-				clipAllocate(shape, face), \
-				p##A, p##B, p##C, &ft->t##A, &ft->t##B, &ft->t##C \
-			); \
-		}\
-		else \
-		{\
-			calculateClipping_straddle##AB( \
-				clipAllocate(shape, face), \
-				p##A, p##B, p##C, NULL, NULL, NULL \
-			); \
-		}\
-	}
-	#define CLIP4(AB, A, B, C, D) \
-	{ \
-		if (shape->prototype->texmap && shape->prototype->texmap[face->org_face].texture_enabled) \
-		{ \
-			FaceTexture* ft = &shape->prototype->texmap[face->org_face]; \
-			calculateClipping_straddle##AB( \
-				clipAllocate(shape, face), \
-				p##A, p##B, p##C, p##D, &ft->t##A, &ft->t##B, &ft->t##C, &ft->t##D \
-			); \
-		}\
-		else \
-		{\
-			calculateClipping_straddle##AB( \
-				clipAllocate(shape, face), \
-				p##A, p##B, p##C, p##D, NULL, NULL, NULL, NULL \
-			); \
-		}\
-	}
-#endif
-
-// enable this to use fewer clipfaces but some texture jumping will occur.
-//#define USE_FEWER_CLIPFACES
-
-static void calculateClipping_straddleDispatch(ShapeInstance* shape, FaceInstance* face)
-{
-	Point3D* p1 = face->p1;
-	Point3D* p2 = face->p2;
-	Point3D* p3 = face->p3;
-	
-	uint8_t q1 = p1->z >= CLIP_EPSILON;
-	uint8_t q2 = p2->z >= CLIP_EPSILON;
-	uint8_t q3 = p3->z >= CLIP_EPSILON;
-	
-	if (face->p4)
-	{
-		Point3D* p4 = face->p4;
-		uint8_t q4 = p4->z >= CLIP_EPSILON;
-		if (q4 && q3 && q2 && q1) return;
-		else if (!q4 && !q3 && !q2 && !q1) return;
-		else if (q1 && !q2 && !q3 && !q4)
-		{
-			#if USE_FEWER_CLIPFACES
-			CLIP3(12, 1, 2, 4);
-			#else
-			CLIP3(12, 1, 2, 3);
-			CLIP3(12, 1, 3, 4);
-			#endif
-		}
-		else if (!q1 && q2 && !q3 && !q4)
-		{
-			CLIP3(12, 2, 3, 1);
-		}
-		else if (!q1 && !q2 && q3 && !q4)
-		{
-			#if USE_FEWER_CLIPFACES
-			CLIP3(12, 3, 4, 2);
-			#else
-			CLIP3(12, 3, 4, 1);
-			CLIP3(12, 3, 1, 2);
-			#endif
-		}
-		else if (!q1 && !q2 && !q3 && q4)
-		{
-			CLIP3(12, 4, 1, 3);
-		}
-		else if (q1 && q2 && !q3 && !q4)
-		{
-			#if USE_FEWER_CLIPFACES
-			CLIP4(22, 1, 2, 3, 4);
-			#else
-			CLIP3(21, 1, 2, 3);
-			CLIP3(12, 1, 3, 4);
-			#endif
-		}
-		else if (!q1 && q2 && q3 && !q4)
-		{
-			#if USE_FEWER_CLIPFACES
-			CLIP4(22R, 2, 3, 4, 1);
-			#else
-			CLIP3(21, 2, 3, 1);
-			CLIP3(12, 3, 4, 1);
-			#endif
-		}
-		else if (!q1 && !q2 && q3 && q4)
-		{
-			#if USE_FEWER_CLIPFACES
-			CLIP4(22, 3, 4, 1, 2);
-			#else
-			CLIP3(21, 3, 4, 1);
-			CLIP3(12, 3, 1, 2);
-			#endif
-		}
-		else if (q1 && !q2 && !q3 && q4)
-		{
-			#if USE_FEWER_CLIPFACES
-			CLIP4(22R, 4, 1, 2, 3);
-			#else
-			CLIP3(21, 4, 1, 3);
-			CLIP3(12, 1, 2, 3);
-			#endif
-		}
-		else if (!q1 && q2 && q3 && q4)
-		{
-			CLIP3(21, 2, 3, 1);
-			CLIP3(21, 3, 4, 1);
-		}
-		else if (q1 && !q2 && q3 && q4)
-		{
-			CLIP3(30, 3, 4, 1);
-			CLIP3(21, 3, 1, 2);
-		}
-		else if (q1 && q2 && !q3 && q4)
-		{
-			CLIP3(21, 4, 1, 3);
-			CLIP3(21, 1, 2, 3);
-		}
-		else if (q1 && q2 && q3 && !q4)
-		{
-			CLIP3(30, 1, 2, 3);
-			CLIP3(21, 1, 3, 4);
-		}
-	}
-	else
+	#if SORT_3D_FACES_BY_Z
+	SortedFace sf = {
+		.comparison = imposter->header.center.z,
+		.instance = &imposter->header,
+	};
+	Scene3D_add_face_to_sortlist(scene, sf);
+	#endif
+	
+	imposter->tl = imposter->header.center;
+	imposter->br = imposter->header.center;
+	imposter->tl.x += proto->x1 * scale;
+	imposter->tl.y += proto->y1 * scale;
+	imposter->br.x += proto->x2 * scale;
+	imposter->br.y += proto->y2 * scale;
+	applyPerspectiveToPoint(scene, &imposter->tl);
+	applyPerspectiveToPoint(scene, &imposter->br);
+	
+	#if ENABLE_TEXTURES
+	if ( proto->nYaw > 1 || proto->nPitch > 1 )
 	{
-		if (q1 && q2 && q3) return;
-		else if (!q1 && !q2 && !q3) return;
-		else if (q1 && !q2 && !q3)
-		{
-			CLIP3(12, 1, 2, 3);
-		}
-		else if (!q1 && q2 && !q3)
-		{
-			CLIP3(12, 2, 3, 1);
-		}
-		else if (!q1 && !q2 && q3)
-		{
-			CLIP3(12, 3, 1, 2);
-		}
-		else if (q1 && q2 && !q3)
-		{
-			CLIP3(21, 1, 2, 3);
-		}
-		else if (q1 && !q2 && q3)
-		{
-			CLIP3(21, 3, 1, 2);
-		}
-		else if (!q1 && q2 && q3)
-		{
-			CLIP3(21, 2, 3, 1);
-		}
+		// pick the frame from the direction of the camera in the imposter's object space
+		Matrix3D m = Matrix3D_multiply(imposter->header.transform, xform);
+		Vector3D eye;
+		float w;
+		
+		Scene3D_getEye(scene, &m, &eye, &w);
+		
+		if ( w != 0 )
+			eye = Vector3DMake(eye.dx - proto->center.x, eye.dy - proto->center.y, eye.dz - proto->center.z);
+		
+		imposter->frame = Imposter3D_getFrame(proto, eye);
 	}
+	else
+		imposter->frame = 0;
+	#endif
 }
 
-// adds clipped faces for those faces which straddle Z=0
-static void calculateClipping(ShapeInstance* shape)
+#if ENABLE_LOD
+// the simplest of the shape's levels of detail which its size on screen allows.
+static Shape3D*
+Scene3D_selectLOD(Scene3D* scene, Shape3D* shape, Matrix3D* m)
 {
-	// reset clip buffer
-	shape->nClip = 0;
+	if ( shape->nLODs == 0 )
+		return shape;
 	
-	// determine which faces need clipping
-	for (int i = 0; i < shape->nFaces; ++i)
+	// projected radius, in pixels
+	float size = shape->radius * Matrix3D_getMaxScale(m) * scene->scale;
+	
+	if ( scene->hasPerspective )
 	{
-		FaceInstance* face = &shape->faces[i];
-		calculateClipping_straddleDispatch(shape, face);
+		float z = Matrix3D_apply(*m, shape->center).z;
 		
-		if (shape->nClip >= MAXCLIP_CAPACITY - 2)
-		{
-			return;
-		}
+		// (the camera is inside it or close enough.)
+		if ( z < CLIP_EPSILON )
+			return shape;
+		
+		size /= z;
 	}
 	
-	// free clip buffer if unused
-	if (shape->nClip == 0 && shape->clipCapacity > 0)
-	{
-		shape->clipCapacity = 0;
-		m3d_free(shape->clip);
-		shape->clip = NULL;
-	}
+	Shape3D* level = shape;
+	
+	for ( int i = 0; i < shape->nLODs && size < shape->lodSizes[i]; ++i )
+		level = shape->lods[i];
+	
+	return level;
 }
 #endif
 
@@ -780,18 +1058,113 @@ Scene3D_updateShapeInstance(Scene3D* scene, ShapeInstance* shape, Matrix3D xform
 	Shape3D* proto = shape->prototype;
 	int i;
 	
-	// transform points
+	// object space to camera space
+	Matrix3D m = Matrix3D_multiply(shape->header.transform, xform);
 	
-	for ( i = 0; i < shape->nPoints; ++i )
+	shape->header.center = Matrix3D_apply(m, proto->center);
+	float radius = proto->radius * Matrix3D_getMaxScale(&m);
+	
+	RENDER_STAT_ADD(instancesUpdated, 1);
+	
+#if ENABLE_FRUSTUM_CULLING
+	shape->header.isCulled = Scene3D_isSphereCulled(scene, shape->header.center, radius);
+	
+	if ( shape->header.isCulled )
+	{
+		RENDER_STAT_ADD(instancesCulled, 1);
+		return;
+	}
+#endif
+
+#if ENABLE_SHAPE_IMPOSTERS
+	#if ENABLE_LOD
+	Shape3D* base = shape->lodBase;
+	#else
+	Shape3D* base = proto;
+	#endif
+	
+	shape->isImposter = base->imposter != NULL && shape->header.center.z > base->imposterDistance;
+	
+	if ( shape->isImposter )
 	{
-		shape->points[i] = Matrix3D_apply(xform, Matrix3D_apply(shape->header.transform, proto->points[i]));
+		ImposterInstance* imposter = &shape->imposter;
+		imposter->prototype = base->imposter;
+		imposter->header.transform = shape->header.transform;
+		imposter->scale = Matrix3D_getMaxScale(&m);
+	#if ENABLE_Z_BUFFER
+		imposter->header.useZBuffer = shape->header.useZBuffer;
+	#endif
+		
+		Scene3D_updateImposterInstance(scene, imposter, xform);
+		return;
+	}
+#endif
+
+#if ENABLE_LOD
+	Shape3D* level = Scene3D_selectLOD(scene, shape->lodBase, &m);
+	
+	if ( level != proto )
+	{
+		ShapeInstance_setPrototype(shape, level);
+		proto = level;
+		shape->header.center = Matrix3D_apply(m, proto->center);
+		radius = proto->radius * Matrix3D_getMaxScale(&m);
 	}
+#endif
+	
+	// the shape was changed (e.g. given a BSP tree) after it was added.
+	if ( shape->prototypeVersion != proto->version )
+		ShapeInstance_setPrototype(shape, proto);
+	
+	const uint8_t* mask = NULL;
+	
+#if ENABLE_EARLY_BACKFACE_CULLING
+	Scene3D_cullBackfaces(scene, shape, &m, xform.inverting, style);
+	mask = shape->pointVisible;
+#endif
+
+#if ENABLE_BSP
+	if ( proto->bsp != NULL )
+		Scene3D_getEye(scene, &m, &shape->eye, &shape->eyeW);
+#endif
+	
+	// if the whole shape is in front of the camera, no faces need clipping,
+	// so points can be projected in the same pass that transforms them.
+#if FACE_CLIPPING
+	int needsClipping = shape->header.center.z - radius < CLIP_EPSILON;
+#else
+	int needsClipping = 0;
+#endif
+	
+	Projection3D projection = {
+		.hasPerspective = scene->hasPerspective,
+		.scale = scene->scale,
+		.centerx = scene->centerx,
+		.centery = scene->centery,
+		.nearz = CLIP_EPSILON
+	};
+	
+	// transform points
+	
+	Matrix3D_transformPoints(
+		m, proto->pointsX, proto->pointsY, proto->pointsZ, shape->nPoints,
+		shape->points, mask, needsClipping ? NULL : &projection
+	);
 
-	shape->header.center = Matrix3D_apply(xform, Matrix3D_apply(shape->header.transform, proto->center));
 	shape->colorBias = proto->colorBias + colorBias;
 	shape->renderStyle = style;
 	shape->inverted = xform.inverting;
 	
+	// classify each point against the view just once; faces are then tested by their points' codes.
+	for ( i = 0; i < shape->nPoints; ++i )
+	{
+		if ( mask && !mask[i] )
+			continue;
+		
+		RENDER_STAT_ADD(pointsTransformed, 1);
+		shape->outcodes[i] = Scene3D_getOutcode(scene, &shape->points[i], !needsClipping);
+	}
+	
 #if ENABLE_ORDERING_TABLE
 	float zmin = 1e23;
 	float zmax = 0;
@@ -806,12 +1179,38 @@ Scene3D_updateShapeInstance(Scene3D* scene, ShapeInstance* shape, Matrix3D xform
 	memset(shape->orderTable, 0, ordersize * sizeof(FaceInstance*));
 #endif
 
-	// recompute face normals
+	// recompute face normals (from the prototype's, so the points may already be projected)
+	
+	Matrix3D normalMatrix = Matrix3D_getNormalMatrix(m);
 
 	for ( i = 0; i < shape->nFaces; ++i )
 	{
 		FaceInstance* face = &shape->faces[i];
-		face->normal = normal(face->p1, face->p2, face->p3);
+		if ( face_is_backface(face) )
+			continue;
+		
+		Face3D* f = &proto->faces[i];
+		uint8_t* codes = shape->outcodes;
+		uint8_t any = codes[f->p1] | codes[f->p2] | codes[f->p3];
+		uint8_t all = codes[f->p1] & codes[f->p2] & codes[f->p3];
+		
+		if ( f->p4 != 0xffff )
+		{
+			any |= codes[f->p4];
+			all &= codes[f->p4];
+		}
+		
+		// trivially rejected if all its points are outside the same plane
+		if ( all & OUTCODE_VIEW )
+		{
+			face->outcodes = OUTCODE_REJECTED;
+			RENDER_STAT_ADD(facesRejected, 1);
+			continue;
+		}
+		
+		face->outcodes = any;
+		face->normal = Vector3D_normalize(Matrix3D_applyVector(&normalMatrix, proto->faces[i].normal));
+
 		face->isDoubleSided = shape->faces[i].isDoubleSided;
 		
 #if ENABLE_ORDERING_TABLE
@@ -826,22 +1225,32 @@ Scene3D_updateShapeInstance(Scene3D* scene, ShapeInstance* shape, Matrix3D xform
 	}
 	
 	#if FACE_CLIPPING
-	clipScene = scene;
-	calculateClipping(shape);
-	#endif
+	calculateClipping(scene, shape, !needsClipping);
 	
-	// apply perspective, scale to display
+	if ( needsClipping )
+	{
+		// apply perspective, scale to display
+		
+		for ( i = 0; i < shape->nPoints; ++i )
+		{
+			if ( mask && !mask[i] )
+				continue;
+			
+			applyPerspectiveToPoint(scene, &shape->points[i]);
+		}
+	}
+	#endif
 	
+#if ENABLE_Z_BUFFER
 	for ( i = 0; i < shape->nPoints; ++i )
 	{
-		Point3D* p = &shape->points[i];
-		applyPerspectiveToPoint(scene, p);
+		if ( mask && !mask[i] )
+			continue;
 		
-#if ENABLE_Z_BUFFER
-		if ( p->z < scene->zmin )
-			scene->zmin = p->z;
-#endif
+		if ( shape->points[i].z < scene->zmin )
+			scene->zmin = shape->points[i].z;
 	}
+#endif
 	
 #if ENABLE_ORDERING_TABLE
 	// Put faces in bins separated by average z value
@@ -853,6 +1262,8 @@ Scene3D_updateShapeInstance(Scene3D* scene, ShapeInstance* shape, Matrix3D xform
 		for ( i = 0; i < shape->nFaces; ++i )
 		{
 			FaceInstance* face = &shape->faces[i];
+			if ( face_is_backface(face) || (face->outcodes & OUTCODE_REJECTED) )
+				continue;
 			
 			// note the conversion float -> size_t
 			size_t idx = (size_t)(ordersize * (face->p1->z + face->p2->z + face->p3->z - zmin) / d);
@@ -864,12 +1275,26 @@ Scene3D_updateShapeInstance(Scene3D* scene, ShapeInstance* shape, Matrix3D xform
 #endif
 
 #if SORT_3D_FACES_BY_Z
+	#if ENABLE_BSP
+	if ( proto->bsp != NULL )
+	{
+		// the BSP tree orders this shape's own faces, so it goes in the list as a whole.
+		SortedFace sf = {
+			.comparison = shape->header.center.z + radius,
+			.instance = &shape->header,
+			.face = SORTEDFACE_SHAPE
+		};
+		Scene3D_add_face_to_sortlist(scene, sf);
+		return;
+	}
+	#endif
+	
 	// add non-clipped faces to the face sort list.
 	for ( int i = 0; i < shape->nFaces; ++i )
 	{
 		FaceInstance* face = &shape->faces[i];
-		// skip if face goes behind the camera at all.
-		if (face_clips_epsilon(face))
+		// skip if face is out of view, or clipped (its pieces are added below).
+		if (face_is_backface(face) || face_is_clipped(face))
 		{
 			continue;
 		}
@@ -890,8 +1315,9 @@ Scene3D_updateShapeInstance(Scene3D* scene, ShapeInstance* shape, Matrix3D xform
 	for (int i = 0; i < shape->nClip; ++i)
 	{
 		ClippedFace3D* face = &shape->clip[i];
-		float zcomp = MAX(MAX(face->p2.z, face->p3.z), face->p4.z);
-		if (face->p1) zcomp = MAX(zcomp, face->p1->z);
+		float zcomp = face->points[0].z;
+		for (int j = 1; j < face->nPoints; ++j)
+			zcomp = MAX(zcomp, face->points[j].z);
 		
 		SortedFace sf = {
 			.comparison = zcomp,
@@ -903,57 +1329,138 @@ Scene3D_updateShapeInstance(Scene3D* scene, ShapeInstance* shape, Matrix3D xform
 #endif
 }
 
-static void
-Scene3D_updateImposterInstance(Scene3D* scene, ImposterInstance* imposter, Matrix3D xform)
+static int
+Scene3D_flattenNode(Scene3D* scene, Scene3DNode* node, int parent, int index)
 {
-	Imposter3D* proto = imposter->prototype;
-	imposter->header.center = Matrix3D_apply(xform, Matrix3D_apply(imposter->header.transform, proto->center));
+	FlatNode3D* flat = &scene->flatNodes[index];
+	flat->node = node;
+	flat->parent = parent;
+	node->flatIndex = index;
 	
-	if (imposter->header.center.z < CLIP_EPSILON) return;
+	int next = index + 1;
 	
-	#if SORT_3D_FACES_BY_Z
-	SortedFace sf = {
-		.comparison = imposter->header.center.z,
-		.instance = &imposter->header,
-	};
-	Scene3D_add_face_to_sortlist(scene, sf);
-	#endif
+	for ( int i = 0; i < node->nChildren; ++i )
+		next = Scene3D_flattenNode(scene, node->childNodes[i], index, next);
 	
-	imposter->tl = imposter->header.center;
-	imposter->br = imposter->header.center;
-	imposter->tl.x += proto->x1;
-	imposter->tl.y += proto->y1;
-	imposter->br.x += proto->x2;
-	imposter->br.y += proto->y2;
-	applyPerspectiveToPoint(scene, &imposter->tl);
-	applyPerspectiveToPoint(scene, &imposter->br);
+	scene->flatNodes[index].end = next;
+	return next;
 }
 
-void
-Scene3D_updateNode(Scene3D* scene, Scene3DNode* node, Matrix3D xform, float colorBias, RenderStyle style, int update)
+static int
+Scene3DNode_countNodes(Scene3DNode* node)
 {
-	if ( !node->isVisible )
+	int count = 1;
+	
+	for ( int i = 0; i < node->nChildren; ++i )
+		count += Scene3DNode_countNodes(node->childNodes[i]);
+	
+	return count;
+}
+
+// rebuilds the flattened node list if any nodes were added since it was built.
+static void
+Scene3D_flattenNodes(Scene3D* scene)
+{
+	if ( scene->flatNodes != NULL && scene->flatVersion == nodeTopologyVersion )
 		return;
 	
-	if ( node->needsUpdate )
+	int count = Scene3DNode_countNodes(&scene->root);
+	
+	if ( count != scene->nFlatNodes )
 	{
-		update = 1;
-		node->needsUpdate = 0;
+		scene->nFlatNodes = count;
+		scene->flatNodes = m3d_realloc(scene->flatNodes, count * sizeof(FlatNode3D));
 	}
 	
-	if ( update )
+	Scene3D_flattenNode(scene, &scene->root, -1, 0);
+	scene->flatVersion = nodeTopologyVersion;
+}
+
+// updates, in one pass down the flattened list, every node which needs it and all its descendents.
+static void
+Scene3D_updateNodes(Scene3D* scene)
+{
+	Scene3D_flattenNodes(scene);
+	
+	FlatNode3D* flatNodes = scene->flatNodes;
+	int i = 0;
+	
+	while ( i < scene->nFlatNodes )
 	{
+		FlatNode3D* flat = &flatNodes[i];
+		Scene3DNode* node = flat->node;
+		
+		if ( !node->isVisible )
+		{
+			i = flat->end;
+			continue;
+		}
+		
+		// (children are only reached if their parent was updated, so they're updated too.)
+		if ( flat->parent < 0 && !node->needsUpdate )
+			break;
+		
+		node->needsUpdate = 0;
+		
+		Matrix3D xform;
+		float colorBias;
+		RenderStyle style;
+		
+		if ( flat->parent < 0 )
+		{
+			xform = scene->camera;
+			colorBias = 0;
+			style = kRenderFilled;
+		}
+		else
+		{
+			FlatNode3D* parent = &flatNodes[flat->parent];
+			xform = parent->xform;
+			colorBias = parent->colorBias;
+			style = parent->style;
+		}
+		
 		xform = Matrix3D_multiply(node->transform, xform);
+		
+#if ENABLE_FRUSTUM_CULLING
+		// skip this entire subtree if its bounding sphere is out of view.
+		Scene3DNode_updateBounds(node);
+		
+		node->isCulled = node->boundsEmpty || (node->bounds.radius >= 0 && Scene3D_isSphereCulled(
+			scene, Matrix3D_apply(xform, node->bounds.center),
+			node->bounds.radius * Matrix3D_getMaxScale(&xform)
+		));
+		
+		if ( node->isCulled )
+		{
+			i = flat->end;
+			continue;
+		}
+#endif
+		
 		colorBias += node->colorBias;
 		
 		if ( node->renderStyle != kRenderInheritStyle )
 			style = node->renderStyle;
 		
-		// update instances
-		InstanceHeader* instance = node->instances;
+		flat->xform = xform;
+		flat->colorBias = colorBias;
+		flat->style = style;
 		
-		while ( instance != NULL )
+		// update instances
+		for ( int j = 0; j < node->nInstance; ++j )
 		{
+			InstanceHeader* instance = &node->instances[j].header;
+			
+#if ENABLE_Z_BUFFER
+			// (set first: a shape drawn as an imposter passes it on while updating.)
+			instance->useZBuffer = node->useZBuffer;
+	#if ENABLE_S_BUFFER
+			if ( scene->useSBuffer )
+				instance->useZBuffer = 0;
+	#endif
+#endif
+			
 			switch(instance->type)
 			{
 			case kInstanceTypeShape:
@@ -963,17 +1470,9 @@ Scene3D_updateNode(Scene3D* scene, Scene3DNode* node, Matrix3D xform, float colo
 				Scene3D_updateImposterInstance(scene, (ImposterInstance*)instance, xform);
 				break;
 			}
-#if ENABLE_Z_BUFFER
-			instance->useZBuffer = node->useZBuffer;
-#endif
-			instance = instance->next;
 		}
 		
-		// update children
-		int i;
-		
-		for ( i = 0; i < node->nChildren; ++i )
-			Scene3D_updateNode(scene, node->childNodes[i], xform, colorBias, style, update);
+		++i;
 	}
 }
 
@@ -989,6 +1488,20 @@ Scene3D_init(Scene3D* scene)
 
 	Scene3DNode_init(&scene->root);
 	
+	scene->flatNodes = NULL;
+	scene->nFlatNodes = 0;
+	scene->flatVersion = 0;
+	
+	FrameArena_init(&scene->arena);
+	
+	scene->drawnRows = (LCDRowRange){ 0, 0 };
+	scene->lastDrawnRows = (LCDRowRange){ 0, 0 };
+	
+	#if ENABLE_Z_BUFFER
+	scene->zbufferFormat = getZBufferDefaultFormat();
+	scene->hasZBuffer = 0;
+	#endif
+	
 	#if SORT_3D_INSTANCES_BY_Z
 	scene->instancelist = NULL;
 	scene->instancelistsize = 0;
@@ -997,20 +1510,41 @@ Scene3D_init(Scene3D* scene)
 	#if SORT_3D_FACES_BY_Z
 	scene->sortedfacelist = NULL;
 	scene->sortedfacelistc = scene->sortedfacelistsize = 0;
+	#if FACE_RADIX_SORT || FACE_SORT_COHERENT || ENABLE_SCENE_ORDERING_TABLE
+	scene->sortedfacescratch = NULL;
+	#endif
+	#if FACE_SORT_COHERENT
+	scene->prevsortedfacelistc = 0;
+	scene->sortslots = NULL;
+	#endif
+	#if ENABLE_SCENE_ORDERING_TABLE
+	scene->orderTableSize = 0;
+	scene->orderTable = NULL;
+	Scene3D_setOrderTableSize(scene, SCENE_ORDERING_TABLE_SIZE);
+	#endif
+	#endif
+	
+	#if ENABLE_FRUSTUM_CULLING
+	scene->farDistance = 1e23;
+	#endif
+	
+	#if ENABLE_S_BUFFER
+	scene->useSBuffer = 0;
 	#endif
 }
 
 void
 Scene3D_deinit(Scene3D* scene)
 {
-	#if SORT_3D_INSTANCES_BY_Z
-	if ( scene->instancelist != NULL )
-		m3d_free(scene->instancelist);
-	#endif
+	if ( scene->flatNodes != NULL )
+		m3d_free(scene->flatNodes);
 	
-	#if SORT_3D_FACES_BY_Z
-	if ( scene->sortedfacelist != NULL )
-		m3d_free(scene->sortedfacelist);
+	// (the instance and face lists are in the arena.)
+	FrameArena_deinit(&scene->arena);
+	
+	#if ENABLE_SCENE_ORDERING_TABLE
+	if ( scene->orderTable != NULL )
+		m3d_free(scene->orderTable);
 	#endif
 	
 	Scene3DNode_deinit(&scene->root);
@@ -1029,40 +1563,132 @@ Scene3D_setCenter(Scene3D* scene, float x, float y)
 	scene->centery = y * scene->scale + VIEWPORT_TOP;
 }
 
+#if ENABLE_FRUSTUM_CULLING
+void
+Scene3D_setFarDistance(Scene3D* scene, float distance)
+{
+	scene->farDistance = (distance > 0) ? distance : 1e23;
+	scene->root.needsUpdate = 1;
+}
+#endif
+
+#if ENABLE_S_BUFFER
+void
+Scene3D_setUsesSBuffer(Scene3D* scene, int flag)
+{
+	scene->useSBuffer = flag;
+	scene->root.needsUpdate = 1;
+}
+#endif
+
+#if ENABLE_Z_BUFFER
+int
+Scene3D_setZBufferFormat(Scene3D* scene, int bits)
+{
+	// (allocates it now, so a format that can't be had is refused here rather than when drawing.)
+	if ( !setZBufferFormat(bits) )
+		return 0;
+	
+	scene->zbufferFormat = bits;
+	return 1;
+}
+#endif
+
+#if ENABLE_SCENE_ORDERING_TABLE
+void
+Scene3D_setOrderTableSize(Scene3D* scene, int size)
+{
+	if ( size < 0 )
+		size = 0;
+	
+	if ( size == scene->orderTableSize )
+		return;
+	
+	scene->orderTableSize = size;
+	
+	if ( size == 0 )
+	{
+		m3d_free(scene->orderTable);
+		scene->orderTable = NULL;
+	}
+	else
+		scene->orderTable = m3d_realloc(scene->orderTable, size * sizeof(int));
+}
+#endif
+
 Scene3DNode*
 Scene3D_getRootNode(Scene3D* scene)
 {
 	return &scene->root;
 }
 
+// the node's entry in the scene's flattened list, or -1 if it isn't in this scene.
+static int
+Scene3D_getFlatIndex(Scene3D* scene, Scene3DNode* node)
+{
+	Scene3D_flattenNodes(scene);
+	
+	int index = node->flatIndex;
+	
+	if ( index < 0 || index >= scene->nFlatNodes || scene->flatNodes[index].node != node )
+		return -1;
+	
+	return index;
+}
+
 #if SORT_3D_INSTANCES_BY_Z
 static int
-getInstancesAtNode(Scene3D* scene, Scene3DNode* node, int count)
+getInstancesAtNode(Scene3D* scene, Scene3DNode* node)
 {
-	if ( !node->isVisible )
-		return count;
+	int start = Scene3D_getFlatIndex(scene, node);
+	
+	if ( start < 0 )
+		return 0;
 	
-	InstanceHeader* instance = node->instances;
+	FlatNode3D* flatNodes = scene->flatNodes;
 	InstanceHeader** instances = scene->instancelist;
+	int count = 0;
+	int i = start;
 	
-	while ( instance != NULL )
+	while ( i < flatNodes[start].end )
 	{
-		// check if shape is outside camera view: apply camera transform to shape center
+		node = flatNodes[i].node;
+		
+		if ( !node->isVisible )
+		{
+			i = flatNodes[i].end;
+			continue;
+		}
+		
+		#if ENABLE_FRUSTUM_CULLING
+		if ( node->isCulled )
+		{
+			i = flatNodes[i].end;
+			continue;
+		}
+		#endif
 		
-		if ( count + 1 > scene->instancelistsize )
+		for ( int j = 0; j < node->nInstance; ++j )
 		{
-			#define SHAPELIST_INCREMENT 0x20
-			scene->instancelistsize += SHAPELIST_INCREMENT;
-			scene->instancelist = m3d_realloc(scene->instancelist, scene->instancelistsize * sizeof(ShapeInstance*));
-			instances = scene->instancelist;
+			InstanceHeader* instance = &node->instances[j].header;
+			
+			// check if shape is outside camera view: apply camera transform to shape center
+			
+			if ( count + 1 > scene->instancelistsize )
+			{
+				#define SHAPELIST_INCREMENT 0x20
+				int oldsize = scene->instancelistsize;
+				scene->instancelistsize += SHAPELIST_INCREMENT;
+				scene->instancelist = FrameArena_grow(&scene->arena, scene->instancelist,
+					oldsize * sizeof(InstanceHeader*), scene->instancelistsize * sizeof(InstanceHeader*));
+				instances = scene->instancelist;
+			}
+			
+			instances[count++] = instance;
 		}
 		
-		instances[count++] = instance;
-		instance = instance->next;
+		++i;
 	}
-	
-	for ( int i = 0; i < node->nChildren; ++i )
-		count = getInstancesAtNode(scene, node->childNodes[i], count);
 
 	return count;
 }
@@ -1134,48 +1760,32 @@ Scene3D_setCamera(Scene3D* scene, Point3D origin, Point3D lookAt, float scale, V
 	scene->root.needsUpdate = 1;
 }
 
-// assumption: caller has already verified that no vertex falls below CLIP_EPSILON in z.
-static FORCEINLINE inline void
-drawShapeFace(Scene3D* scene, ShapeInstance* shape, FaceInstance* face, uint8_t* bitmap, int rowstride
-	#if ENABLE_TEXTURES
-	, FaceTexture* ft
-	#else
-	, void* UNUSED
-	#endif
-)
+// notes the rows a draw call touched
+static inline void
+markRows(Scene3D* scene, LCDRowRange rows)
 {
-	float x1 = face->p1->x;
-	float y1 = face->p1->y;
-	float x2 = face->p2->x;
-	float y2 = face->p2->y;
-	float x3 = face->p3->x;
-	float y3 = face->p3->y;
-	
-	// quick bounds check
-	
-	if ( (x1 < VIEWPORT_LEFT && x2 < VIEWPORT_LEFT && x3 < VIEWPORT_LEFT && (face->p4 == NULL || face->p4->x < VIEWPORT_LEFT)) ||
-		 (x1 >= VIEWPORT_RIGHT && x2 >= VIEWPORT_RIGHT && x3 >= VIEWPORT_RIGHT && (face->p4 == NULL || face->p4->x >= VIEWPORT_RIGHT)) ||
-		 (y1 < VIEWPORT_TOP && y2 < VIEWPORT_TOP && y3 < VIEWPORT_TOP && (face->p4 == NULL || face->p4->y < VIEWPORT_TOP)) ||
-		 (y1 >= VIEWPORT_BOTTOM && y2 >= VIEWPORT_BOTTOM && y3 >= VIEWPORT_BOTTOM && (face->p4 == NULL || face->p4->y >= VIEWPORT_BOTTOM)) )
-		return;
+	scene->drawnRows = rowRangeUnion(scene->drawnRows, rows);
+}
 
-	if ( shape->prototype->isClosed && !face->isDoubleSided )
-	{
-		// only render front side of faces
+LCDRowRange
+Scene3D_getUpdatedRows(Scene3D* scene)
+{
+	return rowRangeUnion(scene->drawnRows, scene->lastDrawnRows);
+}
 
-		float d;
-		
-		if ( scene->hasPerspective ) // use winding order
-			d = (x2 - x1) * (y3 - y1) - (y2 - y1) * (x3 - x1);
-		else // use direction of normal
-			d = face->normal.dz;
-		
-		if ( (d >= 0) ^ (shape->inverted ? 1 : 0) )
-			return;
-	}
-	
-	// lighting
-	
+#if ENABLE_Z_BUFFER
+// true if the instance is drawn with the z buffer. (if there isn't one, it's drawn without.)
+static inline int
+usesZBuffer(Scene3D* scene, InstanceHeader* instance)
+{
+	return instance->useZBuffer && scene->hasZBuffer;
+}
+#endif
+
+// how brightly lit the face is, from 0 to 1
+static inline float
+getFaceLighting(Scene3D* scene, ShapeInstance* shape, FaceInstance* face)
+{
 	float c = face->colorBias + shape->colorBias;
 	float v;
 	
@@ -1198,7 +1808,13 @@ drawShapeFace(Scene3D* scene, ShapeInstance* shape, FaceInstance* face, uint8_t*
 	
 	// cheap gamma adjust
 	// v = v * v;
+	
+	return v;
+}
 
+static inline uint8_t*
+getLightingPattern(ShapeInstance* shape, float v)
+{
 	int vi = (int)((LIGHTING_PATTERN_COUNT - 0.01f) * v);
 
 	if ( vi > (LIGHTING_PATTERN_COUNT - 1) )
@@ -1206,16 +1822,64 @@ drawShapeFace(Scene3D* scene, ShapeInstance* shape, FaceInstance* face, uint8_t*
 	else if ( vi < 0 )
 		vi = 0;
 
-	uint8_t* pattern = (uint8_t*)&
+	return (uint8_t*)&
 	#if ENABLE_CUSTOM_PATTERNS
 	(*shape->prototype->pattern)
 	#else
 	patterns
 	#endif
 	[vi];
+}
+
+// assumption: caller has already verified that no vertex falls below CLIP_EPSILON in z.
+static FORCEINLINE inline void
+drawShapeFace(Scene3D* scene, ShapeInstance* shape, FaceInstance* face, uint8_t* bitmap, int rowstride)
+{
+	float x1 = face->p1->x;
+	float y1 = face->p1->y;
+	float x2 = face->p2->x;
+	float y2 = face->p2->y;
+	float x3 = face->p3->x;
+	float y3 = face->p3->y;
+	
+	// quick bounds check
+	
+	if ( (x1 < VIEWPORT_LEFT && x2 < VIEWPORT_LEFT && x3 < VIEWPORT_LEFT && (face->p4 == NULL || face->p4->x < VIEWPORT_LEFT)) ||
+		 (x1 >= VIEWPORT_RIGHT && x2 >= VIEWPORT_RIGHT && x3 >= VIEWPORT_RIGHT && (face->p4 == NULL || face->p4->x >= VIEWPORT_RIGHT)) ||
+		 (y1 < VIEWPORT_TOP && y2 < VIEWPORT_TOP && y3 < VIEWPORT_TOP && (face->p4 == NULL || face->p4->y < VIEWPORT_TOP)) ||
+		 (y1 >= VIEWPORT_BOTTOM && y2 >= VIEWPORT_BOTTOM && y3 >= VIEWPORT_BOTTOM && (face->p4 == NULL || face->p4->y >= VIEWPORT_BOTTOM)) )
+	{
+		RENDER_STAT_ADD(facesOffscreen, 1);
+		return;
+	}
+
+	if ( shape->prototype->isClosed && !face->isDoubleSided )
+	{
+		// only render front side of faces
+
+		float d;
+		
+		if ( scene->hasPerspective ) // use winding order
+			d = (x2 - x1) * (y3 - y1) - (y2 - y1) * (x3 - x1);
+		else // use direction of normal
+			d = face->normal.dz;
+		
+		if ( (d >= 0) ^ (shape->inverted ? 1 : 0) )
+		{
+			RENDER_STAT_ADD(facesBackfaceCulled, 1);
+			return;
+		}
+	}
+	
+	// lighting
+	
+	float v = getFaceLighting(scene, shape, face);
+	uint8_t* pattern = getLightingPattern(shape, v);
 	
 	#if ENABLE_TEXTURES
-	if (!ft && shape->prototype->texmap && shape->prototype->texture)
+	FaceTexture* ft = NULL;
+	
+	if (shape->prototype->texmap && shape->prototype->texture)
 	{
 		ft = &shape->prototype->texmap[face->org_face];
 	}
@@ -1224,12 +1888,12 @@ drawShapeFace(Scene3D* scene, ShapeInstance* shape, FaceInstance* face, uint8_t*
 	if ( face->p4 != NULL )
 	{
 #if ENABLE_Z_BUFFER
-		if ( shape->header.useZBuffer )
+		if ( usesZBuffer(scene, &shape->header) )
 		{
 			#if ENABLE_TEXTURES
 			if ( ft && ft->texture_enabled && shape->prototype->texture )
 			{
-				fillQuad_zt(bitmap, rowstride, face->p1, face->p2, face->p3, face->p4,
+				markRows(scene, fillQuad_zt(bitmap, rowstride, face->p1, face->p2, face->p3, face->p4,
 					shape->prototype->texture, ft->t1, ft->t2, ft->t3, ft->t4
 					#if ENABLE_CUSTOM_PATTERNS
 					, shape->prototype->pattern
@@ -1243,11 +1907,11 @@ drawShapeFace(Scene3D* scene, ShapeInstance* shape, FaceInstance* face, uint8_t*
 					#if TEXTURE_PERSPECTIVE_MAPPING
 					, 1
 					#endif
-				);
+				));
 			}
 			else
 			#endif
-			fillQuad_zbuf(bitmap, rowstride, face->p1, face->p2, face->p3, face->p4, pattern);
+			markRows(scene, fillQuad_zbuf(bitmap, rowstride, face->p1, face->p2, face->p3, face->p4, pattern));
 		}
 		else
 #endif
@@ -1255,7 +1919,7 @@ drawShapeFace(Scene3D* scene, ShapeInstance* shape, FaceInstance* face, uint8_t*
 			#if ENABLE_TEXTURES
 			if ( ft && ft->texture_enabled && shape->prototype->texture )
 			{
-				fillQuad_t(bitmap, rowstride, face->p1, face->p2, face->p3, face->p4,
+				markRows(scene, fillQuad_t(bitmap, rowstride, face->p1, face->p2, face->p3, face->p4,
 					shape->prototype->texture, ft->t1, ft->t2, ft->t3, ft->t4
 					#if ENABLE_CUSTOM_PATTERNS
 					, shape->prototype->pattern
@@ -1269,22 +1933,22 @@ drawShapeFace(Scene3D* scene, ShapeInstance* shape, FaceInstance* face, uint8_t*
 					#if TEXTURE_PERSPECTIVE_MAPPING
 					, 1
 					#endif
-				);
+				));
 			}
 			else
 			#endif
-			fillQuad(bitmap, rowstride, face->p1, face->p2, face->p3, face->p4, pattern);
+			markRows(scene, fillQuad(bitmap, rowstride, face->p1, face->p2, face->p3, face->p4, pattern));
 		}
 	}
 	else
 	{
 #if ENABLE_Z_BUFFER
-		if ( shape->header.useZBuffer )
+		if ( usesZBuffer(scene, &shape->header) )
 		{
 			#if ENABLE_TEXTURES
 			if ( ft && ft->texture_enabled && shape->prototype->texture )
 			{
-				fillTriangle_zt(bitmap, rowstride, face->p1, face->p2, face->p3,
+				markRows(scene, fillTriangle_zt(bitmap, rowstride, face->p1, face->p2, face->p3,
 					shape->prototype->texture, ft->t1, ft->t2, ft->t3
 					#if ENABLE_CUSTOM_PATTERNS
 					, shape->prototype->pattern
@@ -1298,11 +1962,11 @@ drawShapeFace(Scene3D* scene, ShapeInstance* shape, FaceInstance* face, uint8_t*
 					#if TEXTURE_PERSPECTIVE_MAPPING
 					, 1
 					#endif
-				);
+				));
 			}
 			else
 			#endif
-			fillTriangle_zbuf(bitmap, rowstride, face->p1, face->p2, face->p3, pattern);
+			markRows(scene, fillTriangle_zbuf(bitmap, rowstride, face->p1, face->p2, face->p3, pattern));
 		}
 		else
 #endif
@@ -1310,7 +1974,7 @@ drawShapeFace(Scene3D* scene, ShapeInstance* shape, FaceInstance* face, uint8_t*
 			#if ENABLE_TEXTURES
 			if ( ft && ft->texture_enabled && shape->prototype->texture )
 			{
-				fillTriangle_t(bitmap, rowstride, face->p1, face->p2, face->p3,
+				markRows(scene, fillTriangle_t(bitmap, rowstride, face->p1, face->p2, face->p3,
 					shape->prototype->texture, ft->t1, ft->t2, ft->t3
 					#if ENABLE_CUSTOM_PATTERNS
 					, shape->prototype->pattern
@@ -1324,11 +1988,11 @@ drawShapeFace(Scene3D* scene, ShapeInstance* shape, FaceInstance* face, uint8_t*
 					#if TEXTURE_PERSPECTIVE_MAPPING
 					, 1
 					#endif
-				);
+				));
 			}
 			else
 			#endif
-			fillTriangle(bitmap, rowstride, face->p1, face->p2, face->p3, pattern);
+			markRows(scene, fillTriangle(bitmap, rowstride, face->p1, face->p2, face->p3, pattern));
 		}
 	}
 }
@@ -1372,80 +2036,233 @@ drawWireframeFace(Scene3D* scene, ShapeInstance* shape, FaceInstance* face, uint
 			return;
 	}
 
-	// XXX - can avoid 1/2 the drawing if we're doing the entire shape (kRenderWireframeBack is set)
-	// and the shape is closed: skip lines where y1 > y2
+	// XXX - can avoid 1/2 the drawing if we're doing the entire shape (kRenderWireframeBack is set)
+	// and the shape is closed: skip lines where y1 > y2
+	
+	// TODO: render clipped lines also.
+		
+#if ENABLE_Z_BUFFER
+	if ( usesZBuffer(scene, &shape->header) )
+	{
+		markRows(scene, drawLine_zbuf(bitmap, rowstride, face->p1, face->p2, 1, color));
+		markRows(scene, drawLine_zbuf(bitmap, rowstride, face->p2, face->p3, 1, color));
+
+		if ( face->p4 != NULL )
+		{
+			markRows(scene, drawLine_zbuf(bitmap, rowstride, face->p3, face->p4, 1, color));
+			markRows(scene, drawLine_zbuf(bitmap, rowstride, face->p4, face->p1, 1, color));
+		}
+		else
+			markRows(scene, drawLine_zbuf(bitmap, rowstride, face->p3, face->p1, 1, color));
+	}
+	else
+	{
+#endif
+		markRows(scene, drawLine(bitmap, rowstride, face->p1, face->p2, 1, color));
+		markRows(scene, drawLine(bitmap, rowstride, face->p2, face->p3, 1, color));
+		
+		if ( face->p4 != NULL )
+		{
+			markRows(scene, drawLine(bitmap, rowstride, face->p3, face->p4, 1, color));
+			markRows(scene, drawLine(bitmap, rowstride, face->p4, face->p1, 1, color));
+		}
+		else
+			markRows(scene, drawLine(bitmap, rowstride, face->p3, face->p1, 1, color));
+#if ENABLE_Z_BUFFER
+	}
+#endif
+}
+
+#if FACE_CLIPPING
+// with perspective, clipped polygons are on the screen, so use their winding order; otherwise the normal.
+static inline int
+clippedFaceIsFront(Scene3D* scene, ShapeInstance* shape, ClippedFace3D* clip)
+{
+	float d = 0;
+	
+	if ( scene->hasPerspective )
+	{
+		for ( int i = 0; i < clip->nPoints; ++i )
+		{
+			Point3D* p = &clip->points[i];
+			Point3D* q = &clip->points[(i + 1) % clip->nPoints];
+			d += p->x * q->y - q->x * p->y;
+		}
+	}
+	else
+		d = clip->src->normal.dz;
+	
+	return !((d >= 0) ^ (shape->inverted ? 1 : 0));
+}
+
+static inline void drawClippedFace(Scene3D* scene, ShapeInstance* shape, ClippedFace3D* clip, uint8_t* bitmap, int rowstride)
+{
+	FaceInstance* face = clip->src;
+	Point3D* points = clip->points;
+	
+	if ( shape->prototype->isClosed && !face->isDoubleSided && !clippedFaceIsFront(scene, shape, clip) )
+	{
+		RENDER_STAT_ADD(facesBackfaceCulled, 1);
+		return;
+	}
+	
+	float v = getFaceLighting(scene, shape, face);
+	uint8_t* pattern = getLightingPattern(shape, v);
+	
+	#if ENABLE_TEXTURES
+	if ( clip->texture_enabled && shape->prototype->texture )
+	{
+		#if ENABLE_Z_BUFFER
+		if ( usesZBuffer(scene, &shape->header) )
+			markRows(scene, fillPolygon_zt(bitmap, rowstride, points, clip->nPoints, shape->prototype->texture, clip->tex
+				#if ENABLE_CUSTOM_PATTERNS
+				, shape->prototype->pattern
+				#endif
+				#if ENABLE_POLYGON_SCANLINING
+				, &shape->prototype->scanline
+				#endif
+				#if ENABLE_TEXTURES_GREYSCALE
+				, v, clip->lighting
+				#endif
+				#if TEXTURE_PERSPECTIVE_MAPPING
+				, 1
+				#endif
+			));
+		else
+		#endif
+			markRows(scene, fillPolygon_t(bitmap, rowstride, points, clip->nPoints, shape->prototype->texture, clip->tex
+				#if ENABLE_CUSTOM_PATTERNS
+				, shape->prototype->pattern
+				#endif
+				#if ENABLE_POLYGON_SCANLINING
+				, &shape->prototype->scanline
+				#endif
+				#if ENABLE_TEXTURES_GREYSCALE
+				, v, clip->lighting
+				#endif
+				#if TEXTURE_PERSPECTIVE_MAPPING
+				, 1
+				#endif
+			));
+		
+		return;
+	}
+	#endif
+	
+	#if ENABLE_Z_BUFFER
+	if ( usesZBuffer(scene, &shape->header) )
+		markRows(scene, fillPolygon_zbuf(bitmap, rowstride, points, clip->nPoints, pattern));
+	else
+	#endif
+		markRows(scene, fillPolygon(bitmap, rowstride, points, clip->nPoints, pattern));
+}
+
+static inline void drawClippedWireframeFace(Scene3D* scene, ShapeInstance* shape, ClippedFace3D* clip, uint8_t* bitmap, int rowstride)
+{
+	uint8_t* color = patterns[32];
 	
-	// TODO: render clipped lines also.
-		
-#if ENABLE_Z_BUFFER
-	if ( shape->header.useZBuffer )
+	if ( (shape->renderStyle & kRenderWireframeBack) == 0 && !clippedFaceIsFront(scene, shape, clip) )
+		return;
+	
+	for ( int i = 0; i < clip->nPoints; ++i )
 	{
-		drawLine_zbuf(bitmap, rowstride, face->p1, face->p2, 1, color);
-		drawLine_zbuf(bitmap, rowstride, face->p2, face->p3, 1, color);
-
-		if ( face->p4 != NULL )
-		{
-			drawLine_zbuf(bitmap, rowstride, face->p3, face->p4, 1, color);
-			drawLine_zbuf(bitmap, rowstride, face->p4, face->p1, 1, color);
-		}
+		Point3D* p = &clip->points[i];
+		Point3D* q = &clip->points[(i + 1) % clip->nPoints];
+		
+		#if ENABLE_Z_BUFFER
+		if ( usesZBuffer(scene, &shape->header) )
+			markRows(scene, drawLine_zbuf(bitmap, rowstride, p, q, 1, color));
 		else
-			drawLine_zbuf(bitmap, rowstride, face->p3, face->p1, 1, color);
+		#endif
+			markRows(scene, drawLine(bitmap, rowstride, p, q, 1, color));
 	}
-	else
-	{
+}
 #endif
-		drawLine(bitmap, rowstride, face->p1, face->p2, 1, color);
-		drawLine(bitmap, rowstride, face->p2, face->p3, 1, color);
+
+#if ENABLE_BSP
+static void
+drawBSPNodeFaces(Scene3D* scene, ShapeInstance* shape, BSPNode3D* node, uint8_t* bitmap, int rowstride)
+{
+	for ( int f = node->face; f < node->face + node->nFaces; ++f )
+	{
+		FaceInstance* face = &shape->faces[f];
 		
-		if ( face->p4 != NULL )
+		if ( face_is_backface(face) || (face->outcodes & OUTCODE_REJECTED) )
+			continue;
+		
+		if ( !face_is_clipped(face) )
 		{
-			drawLine(bitmap, rowstride, face->p3, face->p4, 1, color);
-			drawLine(bitmap, rowstride, face->p4, face->p1, 1, color);
+			drawShapeFace(scene, shape, face, bitmap, rowstride);
 		}
-		else
-			drawLine(bitmap, rowstride, face->p3, face->p1, 1, color);
-#if ENABLE_Z_BUFFER
+		#if FACE_CLIPPING
+		else if ( face->clipIndex >= 0 )
+		{
+			// its clipped polygon is stored separately
+			drawClippedFace(scene, shape, &shape->clip[face->clipIndex], bitmap, rowstride);
+		}
+		#endif
 	}
-#endif
 }
 
-#if FACE_CLIPPING
-static inline void drawClippedFace(Scene3D* scene, ShapeInstance* shape, ClippedFace3D* clip, uint8_t* bitmap, int rowstride)
+// draws the faces back to front by walking the BSP tree, farther side of each plane first.
+static void
+drawBSPShape(Scene3D* scene, ShapeInstance* shape, uint8_t* bitmap, int rowstride)
 {
-	// create a fictitious face instance for each clipped face, and render that.
-	FaceInstance f;
-	memcpy(&f, clip->src, sizeof(FaceInstance));
-	f.p1 = &clip->p2;
-	f.p2 = &clip->p3;
-	f.p3 = &clip->p4;
-	f.p4 = clip->p1;
+	BSPNode3D* nodes = shape->prototype->bsp;
+	int* stack = shape->bspStack;
+	int n = 0;
 	
-	drawShapeFace(scene, shape, &f, bitmap, rowstride,
-	#if ENABLE_TEXTURES
-		&clip->tex
-	#else
-		NULL
-	#endif
-	);
-}
-
-static inline void drawClippedWireframeFace(Scene3D* scene, ShapeInstance* shape, ClippedFace3D* clip, uint8_t* bitmap, int rowstride)
-{
-	// create a fictitious face instance for each clipped face, and render that.
-	FaceInstance f;
-	memcpy(&f, clip->src, sizeof(FaceInstance));
-	f.p1 = &clip->p2;
-	f.p2 = &clip->p3;
-	f.p3 = &clip->p4;
-	f.p4 = clip->p1;
+	// entries are node indices, or ~index for a node whose own faces are to be drawn next.
+	stack[n++] = 0;
 	
-	drawWireframeFace(scene, shape, &f, bitmap, rowstride);
+	while ( n > 0 )
+	{
+		int idx = stack[--n];
+		
+		if ( idx < 0 )
+		{
+			drawBSPNodeFaces(scene, shape, &nodes[~idx], bitmap, rowstride);
+			continue;
+		}
+		
+		BSPNode3D* node = &nodes[idx];
+		float side = Vector3DDot(node->normal, shape->eye) + node->d * shape->eyeW;
+		int near = (side >= 0) ? node->front : node->back;
+		int far = (side >= 0) ? node->back : node->front;
+		
+		#if ENABLE_S_BUFFER
+		if ( scene->useSBuffer )
+		{
+			// front to back instead
+			int tmp = near;
+			near = far;
+			far = tmp;
+		}
+		#endif
+		
+		// (popped in reverse order)
+		if ( near >= 0 )
+			stack[n++] = near;
+		
+		stack[n++] = ~idx;
+		
+		if ( far >= 0 )
+			stack[n++] = far;
+	}
 }
 #endif
 
 static inline void
 drawFilledShape(Scene3D* scene, ShapeInstance* shape, uint8_t* bitmap, int rowstride)
 {
+#if ENABLE_BSP
+	if ( shape->bspStack != NULL )
+	{
+		drawBSPShape(scene, shape, bitmap, rowstride);
+		return;
+	}
+#endif
+
 #if ENABLE_ORDERING_TABLE
 	if ( shape->orderTableSize > 0 )
 	{
@@ -1455,9 +2272,9 @@ drawFilledShape(Scene3D* scene, ShapeInstance* shape, uint8_t* bitmap, int rowst
 			
 			while ( face != NULL )
 			{
-				if (!face_clips_epsilon(face))
+				if (!face_is_clipped(face))
 				{
-					drawShapeFace(scene, shape, face, bitmap, rowstride, NULL);
+					drawShapeFace(scene, shape, face, bitmap, rowstride);
 				}
 				face = face->next;
 			}
@@ -1467,9 +2284,9 @@ drawFilledShape(Scene3D* scene, ShapeInstance* shape, uint8_t* bitmap, int rowst
 #endif
 	for ( int f = 0; f < shape->nFaces; ++f )
 	{
-		if (!face_clips_epsilon(&shape->faces[f]))
+		if (!face_is_backface(&shape->faces[f]) && !face_is_clipped(&shape->faces[f]))
 		{
-			drawShapeFace(scene, shape, &shape->faces[f], bitmap, rowstride, NULL);
+			drawShapeFace(scene, shape, &shape->faces[f], bitmap, rowstride);
 		}
 	}
 		
@@ -1493,9 +2310,8 @@ drawWireframe(Scene3D* scene, ShapeInstance* shape, uint8_t* bitmap, int rowstri
 	{
 		FaceInstance* face = &shape->faces[f];
 		
-		// If any vertex is behind the camera, skip it
-		
-		if ( face->p1->z <= 0 || face->p2->z <= 0 || face->p3->z <= 0 || (face->p4 != NULL && face->p4->x <= 0) )
+		// clipped faces are drawn from the clip list below
+		if ( face_is_backface(face) || face_is_clipped(face) )
 			continue;
 		
 		drawWireframeFace(scene, shape, face, bitmap, rowstride);
@@ -1541,19 +2357,26 @@ drawImposter(Scene3D* scene, ImposterInstance* imposter, uint8_t* bitmap, int ro
 	bl.z += imposter->prototype->z4;
 	
 	#if ENABLE_TEXTURES
+	// the frame's rectangle on the texture
+	Imposter3D* proto = imposter->prototype;
+	float u1 = (float)(imposter->frame % proto->frameColumns) / proto->frameColumns;
+	float v1 = (float)(imposter->frame / proto->frameColumns) / proto->frameRows;
+	float u2 = u1 + 1.0f / proto->frameColumns;
+	float v2 = v1 + 1.0f / proto->frameRows;
+	
 	Point2D t1, t2, t3, t4;
-	t1.x = 0; t1.y = 0;
-	t2.x = 1; t2.y = 0;
-	t3.x = 1; t3.y = 1;
-	t4.x = 0; t4.y = 1;
+	t1.x = u1; t1.y = v1;
+	t2.x = u2; t2.y = v1;
+	t3.x = u2; t3.y = v2;
+	t4.x = u1; t4.y = v2;
 	#endif
 	
 	#if ENABLE_Z_BUFFER
-	if ( imposter->header.useZBuffer )
+	if ( usesZBuffer(scene, &imposter->header) )
 	{
 		#if ENABLE_TEXTURES
 		if (imposter->prototype->bitmap)
-			fillQuad_zt(bitmap, rowstride, &tl, &tr, &br, &bl, imposter->prototype->bitmap, t1, t2, t3, t4
+			markRows(scene, fillQuad_zt(bitmap, rowstride, &tl, &tr, &br, &bl, imposter->prototype->bitmap, t1, t2, t3, t4
 			#if ENABLE_CUSTOM_PATTERNS
 			, patterns
 			#endif
@@ -1567,10 +2390,10 @@ drawImposter(Scene3D* scene, ImposterInstance* imposter, uint8_t* bitmap, int ro
 			#if TEXTURE_PERSPECTIVE_MAPPING
 			, 0
 			#endif
-			);
+			));
 		else
 		#endif
-			fillQuad_zbuf(bitmap, rowstride, &tl, &tr, &br, &bl, pattern);
+			markRows(scene, fillQuad_zbuf(bitmap, rowstride, &tl, &tr, &br, &bl, pattern));
 	}
 	else
 	#endif
@@ -1578,7 +2401,7 @@ drawImposter(Scene3D* scene, ImposterInstance* imposter, uint8_t* bitmap, int ro
 		
 		#if ENABLE_TEXTURES
 		if (imposter->prototype->bitmap)
-			fillQuad_t(bitmap, rowstride, &tl, &tr, &br, &bl, imposter->prototype->bitmap, t1, t2, t3, t4
+			markRows(scene, fillQuad_t(bitmap, rowstride, &tl, &tr, &br, &bl, imposter->prototype->bitmap, t1, t2, t3, t4
 			#if ENABLE_CUSTOM_PATTERNS
 			, patterns
 			#endif
@@ -1592,21 +2415,34 @@ drawImposter(Scene3D* scene, ImposterInstance* imposter, uint8_t* bitmap, int ro
 			#if TEXTURE_PERSPECTIVE_MAPPING
 			, 0
 			#endif
-			);
+			));
 		else
 		#endif
-		fillQuad(bitmap, rowstride, &tl, &tr, &br, &bl, pattern);
+		markRows(scene, fillQuad(bitmap, rowstride, &tl, &tr, &br, &bl, pattern));
 	}
 }
 
 static void drawInstance(Scene3D* scene, InstanceHeader* instance, uint8_t* bitmap, int rowstride)
 {
+	#if ENABLE_FRUSTUM_CULLING
+	if ( instance->isCulled )
+		return;
+	#endif
+	
 	switch (instance->type)
 	{
 	case kInstanceTypeShape: {
 			ShapeInstance* shape = (ShapeInstance*)instance;
 			RenderStyle style = shape->renderStyle;
 			
+			#if ENABLE_SHAPE_IMPOSTERS
+			if ( shape->isImposter )
+			{
+				drawInstance(scene, &shape->imposter.header, bitmap, rowstride);
+				break;
+			}
+			#endif
+			
 			if ( style & kRenderFilled )
 				drawFilledShape(scene, shape, bitmap, rowstride);
 			
@@ -1630,13 +2466,24 @@ static int compareZ(const void* a, const void* b)
 	return shapea->center.z < shapeb->center.z;
 }
 
+void
+Scene3D_beginFrame(Scene3D* scene)
+{
+#if ENABLE_RENDER_STATS
+	resetRenderStats();
+#endif
+
+	scene->lastDrawnRows = scene->drawnRows;
+	scene->drawnRows = (LCDRowRange){ 0, 0 };
+}
+
 void
 Scene3D_drawNode(Scene3D* scene, Scene3DNode* node, uint8_t* bitmap, int rowstride)
 {
 	#if SORT_3D_INSTANCES_BY_Z
-	// recursively get all descendent instances of this node.
+	// get all descendent instances of this node.
 	// order shapes by z
-	int count = getInstancesAtNode(scene, node, 0);
+	int count = getInstancesAtNode(scene, node);
 	
 	// and draw back to front
 	if ( count > 1 )
@@ -1658,17 +2505,33 @@ Scene3D_drawNode(Scene3D* scene, Scene3DNode* node, uint8_t* bitmap, int rowstri
 	}
 	#else
 	// we don't really care about the draw order now.
+	int start = Scene3D_getFlatIndex(scene, node);
 	
-	// draw children nodes recursively
-	for ( int i = 0; i < node->nChildren; ++i )
-	{
-		Scene3D_drawNode(scene, node->childNodes[i], bitmap, rowstride);
-	}
+	if ( start < 0 )
+		return;
+	
+	FlatNode3D* flatNodes = scene->flatNodes;
+	int i = start;
 	
-	// draw instances in this node
-	for ( InstanceHeader* instance = node->instances; instance; instance = instance->next )
+	while ( i < flatNodes[start].end )
 	{
-		drawInstance(scene, instance, bitmap, rowstride);
+		node = flatNodes[i].node;
+		
+		#if ENABLE_FRUSTUM_CULLING
+		if ( node->isCulled )
+		{
+			i = flatNodes[i].end;
+			continue;
+		}
+		#endif
+		
+		// draw instances in this node
+		for ( int j = 0; j < node->nInstance; ++j )
+		{
+			drawInstance(scene, &node->instances[j].header, bitmap, rowstride);
+		}
+		
+		++i;
 	}
 	#endif
 }
@@ -1682,8 +2545,172 @@ static int compareZFace(const void* _a, const void* _b)
 	return a->comparison < b->comparison;
 }
 
-static void Scene3D_drawSortedFaces(Scene3D* scene, uint8_t* bitmap, int rowstride)
+#if FACE_SORT_COHERENT
+// where the slot hint for this entry is kept.
+static inline int* SortedFace_getSlot(SortedFace* sf)
+{
+	if (sf->instance->type == kInstanceTypeImposter)
+		return &((ImposterInstance*)(void*)sf->instance)->sortSlot;
+	
+	ShapeInstance* shape = (ShapeInstance*)(void*)sf->instance;
+	
+	if (sf->face == SORTEDFACE_SHAPE)
+		return &shape->sortSlot;
+	
+	if (sf->face & 0x80000000)
+		// a clipped face shares its slot with the face it was clipped from
+		return &shape->clip[sf->face & ~0x80000000].src->sortSlot;
+	
+	return &shape->faces[sf->face].sortSlot;
+}
+
+// puts faces back in the order they had last frame, then insertion-sorts them.
+// Returns 0 if this would take too many moves, in which case the list still needs sorting.
+static int Scene3D_sortFacesCoherent(Scene3D* scene)
+{
+	int n = scene->sortedfacelistc;
+	int prev = scene->prevsortedfacelistc;
+	int* slots = scene->sortslots = FrameArena_alloc(&scene->arena, prev * sizeof(int));
+	SortedFace* list = scene->sortedfacelist;
+	SortedFace* out = scene->sortedfacescratch;
+	
+	for ( int i = 0; i < prev; ++i )
+		slots[i] = -1;
+	
+	// faces from last frame claim their old slots. New faces (or any whose
+	// slot was already claimed) are put aside at the end of the output.
+	int nextra = 0;
+	
+	for ( int i = 0; i < n; ++i )
+	{
+		int s = *SortedFace_getSlot(&list[i]);
+		
+		if ( s >= 0 && s < prev && slots[s] < 0 )
+			slots[s] = i;
+		else
+			out[n - ++nextra] = list[i];
+	}
+	
+	int j = 0;
+	
+	for ( int s = 0; s < prev; ++s )
+	{
+		if ( slots[s] >= 0 )
+			out[j++] = list[slots[s]];
+	}
+	
+	scene->sortedfacelist = out;
+	scene->sortedfacescratch = list;
+	
+	// insertion sort, back to front
+	long moves = 0;
+	long maxmoves = (long)n * FACE_SORT_COHERENT_MAX_MOVES;
+	
+	for ( int i = 1; i < n; ++i )
+	{
+		SortedFace f = out[i];
+		int k = i;
+		
+		while ( k > 0 && out[k - 1].comparison < f.comparison )
+		{
+			out[k] = out[k - 1];
+			--k;
+		}
+		
+		out[k] = f;
+		moves += i - k;
+		
+		if ( moves > maxmoves )
+			return 0;
+	}
+	
+	return 1;
+}
+#endif
+
+#if ENABLE_SCENE_ORDERING_TABLE
+// orders the face list back to front by hashing faces into orderTableSize buckets
+// spanning this frame's zmin to zmax. Faces in the same bucket keep the order they were added in.
+static void Scene3D_binFaces(Scene3D* scene)
+{
+	int n = scene->sortedfacelistc;
+	int size = scene->orderTableSize;
+	int* table = scene->orderTable;
+	SortedFace* list = scene->sortedfacelist;
+	SortedFace* out = scene->sortedfacescratch;
+	
+	float zmin = list[0].comparison;
+	float zmax = zmin;
+	
+	for ( int i = 1; i < n; ++i )
+	{
+		float z = list[i].comparison;
+		
+		if ( z < zmin ) zmin = z;
+		if ( z > zmax ) zmax = z;
+	}
+	
+	// bucket 0 is the farthest.
+	float scale = size / (zmax - zmin + 0.0001f);
+	
+	#define BUCKET(f) MIN((int)((zmax - (f).comparison) * scale), size - 1)
+	
+	memset(table, 0, size * sizeof(int));
+	
+	for ( int i = 0; i < n; ++i )
+		++table[BUCKET(list[i])];
+	
+	int sum = 0;
+	
+	for ( int b = 0; b < size; ++b )
+	{
+		int count = table[b];
+		table[b] = sum;
+		sum += count;
+	}
+	
+	for ( int i = 0; i < n; ++i )
+		out[table[BUCKET(list[i])]++] = list[i];
+	
+	#undef BUCKET
+	
+	scene->sortedfacelist = out;
+	scene->sortedfacescratch = list;
+}
+#endif
+
+static void Scene3D_sortFaces(Scene3D* scene)
 {
+	RENDER_STAT_ADD(facesSorted, scene->sortedfacelistc);
+	
+	#if FACE_RADIX_SORT || FACE_SORT_COHERENT || ENABLE_SCENE_ORDERING_TABLE
+	scene->sortedfacescratch = FrameArena_alloc(&scene->arena, scene->sortedfacelistc * sizeof(SortedFace));
+	#endif
+	
+	#if ENABLE_SCENE_ORDERING_TABLE
+	if (scene->sortedfacelistc > 1 && scene->orderTableSize > 0)
+	{
+		Scene3D_binFaces(scene);
+	}
+	else
+	#endif
+	#if FACE_SORT_COHERENT
+	if (scene->sortedfacelistc > 1 && Scene3D_sortFacesCoherent(scene))
+	{
+		// already sorted
+	}
+	else
+	#endif
+	#if FACE_RADIX_SORT
+	if (scene->sortedfacelistc >= FACE_RADIX_SORT_MIN)
+	{
+		// back to front, so the key is inverted. (faces at equal depth keep the order they were added in.)
+		#define KEY(f) (~radix_key_float((f).comparison))
+		RADIXSORT(SortedFace, scene->sortedfacelistc, scene->sortedfacelist, scene->sortedfacescratch, KEY);
+		#undef KEY
+	}
+	else
+	#endif
 	if (scene->sortedfacelistc > 1)
 	{
 		SortedFace tmp;
@@ -1703,68 +2730,213 @@ static void Scene3D_drawSortedFaces(Scene3D* scene, uint8_t* bitmap, int rowstri
 		#endif
 	}
 	
-	// By construction, we know that everything in this list does not fall below CLIP_EPSILON in z,
-	// so it is safe to call draw*Face functions directly on each face.
-	for ( int i = 0; i < scene->sortedfacelistc; ++i )
+	#if FACE_SORT_COHERENT
+	// remember this order for next frame
+	for (int i = 0; i < scene->sortedfacelistc; ++i)
+	{
+		*SortedFace_getSlot(&scene->sortedfacelist[i]) = i;
+	}
+	scene->prevsortedfacelistc = scene->sortedfacelistc;
+	#endif
+}
+
+// draws one entry of the sorted face list. fillBeforeWire is kRenderFilled if a face's fill is
+// drawn before its outline (back to front), or 0 if after (front to back, in S-buffer mode).
+static void
+drawSortedFace(Scene3D* scene, SortedFace* face, RenderStyle fillBeforeWire, uint8_t* bitmap, int rowstride)
+{
+	if (face->instance->type == kInstanceTypeShape)
 	{
-		SortedFace* face = &scene->sortedfacelist[i];
-		if (face->instance->type == kInstanceTypeShape)
+		ShapeInstance* shape = (ShapeInstance*)(void*)face->instance;
+		
+		RenderStyle style = shape->renderStyle;
+		RenderStyle fillFirst = style & fillBeforeWire;
+		RenderStyle fillLast = style & kRenderFilled & ~fillBeforeWire;
+		
+		if (face->face == SORTEDFACE_SHAPE)
 		{
-			ShapeInstance* shape = (ShapeInstance*)(void*)face->instance;
+			if ( fillFirst )
+				drawFilledShape(scene, shape, bitmap, rowstride);
 			
-			RenderStyle style = shape->renderStyle;
+			if ( style & kRenderWireframe )
+				drawWireframe(scene, shape, bitmap, rowstride);
 			
-			if (face->face & 0x80000000)
-			{
-				// clipped face
-				int fidx = face->face & ~0x80000000;
-				
-				if ( style & kRenderFilled )
-					drawClippedFace(scene, shape, &shape->clip[fidx], bitmap, rowstride);
-					
-				if ( style & kRenderWireframe )
-					drawClippedWireframeFace(scene, shape, &shape->clip[fidx], bitmap, rowstride);
-			}
-			else
-			{
-				int fidx = face->face;
-				
-				if ( style & kRenderFilled )
-					drawShapeFace(scene, shape, &shape->faces[fidx], bitmap, rowstride, NULL);
+			if ( fillLast )
+				drawFilledShape(scene, shape, bitmap, rowstride);
+		}
+		else if (face->face & 0x80000000)
+		{
+			// clipped face
+			int fidx = face->face & ~0x80000000;
+			
+			if ( fillFirst )
+				drawClippedFace(scene, shape, &shape->clip[fidx], bitmap, rowstride);
 				
-				if ( style & kRenderWireframe )
-					drawWireframeFace(scene, shape, &shape->faces[fidx], bitmap, rowstride);
-			}
+			if ( style & kRenderWireframe )
+				drawClippedWireframeFace(scene, shape, &shape->clip[fidx], bitmap, rowstride);
+			
+			if ( fillLast )
+				drawClippedFace(scene, shape, &shape->clip[fidx], bitmap, rowstride);
 		}
-		else if (face->instance->type == kInstanceTypeImposter)
+		else
+		{
+			int fidx = face->face;
+			
+			if ( fillFirst )
+				drawShapeFace(scene, shape, &shape->faces[fidx], bitmap, rowstride);
+			
+			if ( style & kRenderWireframe )
+				drawWireframeFace(scene, shape, &shape->faces[fidx], bitmap, rowstride);
+			
+			if ( fillLast )
+				drawShapeFace(scene, shape, &shape->faces[fidx], bitmap, rowstride);
+		}
+	}
+	else if (face->instance->type == kInstanceTypeImposter)
+	{
+		drawImposter(scene, (ImposterInstance*)face->instance, bitmap, rowstride);
+	}
+}
+
+#if ENABLE_S_BUFFER && ENABLE_TEXTURES && ENABLE_TEXTURES_MASK
+static int
+textureHasMask(Texture* texture)
+{
+	int width, height, rowbytes, hasmask, fmt;
+	uint8_t* data;
+	
+	Texture_getData(texture, &width, &height, &rowbytes, &hasmask, &fmt, &data);
+	return hasmask;
+}
+
+// true if the entry is drawn with a masked texture. What's behind it shows through the
+// holes, so it can't hide anything in the S-buffer.
+static int
+sortedFaceIsMasked(SortedFace* face)
+{
+	if (face->instance->type == kInstanceTypeImposter)
+	{
+		Texture* texture = ((ImposterInstance*)face->instance)->prototype->bitmap;
+		return texture != NULL && textureHasMask(texture);
+	}
+	
+	ShapeInstance* shape = (ShapeInstance*)(void*)face->instance;
+	Shape3D* proto = shape->prototype;
+	
+	if ( proto->texture == NULL || proto->texmap == NULL || !textureHasMask(proto->texture) )
+		return 0;
+	
+	if (face->face == SORTEDFACE_SHAPE)
+		return 1;
+	
+	FaceInstance* f = (face->face & 0x80000000) ? shape->clip[face->face & ~0x80000000].src : &shape->faces[face->face];
+	return proto->texmap[f->org_face].texture_enabled;
+}
+#endif
+
+static void Scene3D_drawSortedFaces(Scene3D* scene, uint8_t* bitmap, int rowstride)
+{
+	Scene3D_sortFaces(scene);
+	
+	// By construction, we know that everything in this list does not fall below CLIP_EPSILON in z,
+	// so it is safe to call draw*Face functions directly on each face.
+	
+	// The list is sorted back to front.
+	int n = scene->sortedfacelistc;
+	
+#if ENABLE_S_BUFFER
+	if ( scene->useSBuffer )
+	{
+		// In S-buffer mode we walk it front to back instead, and draw each face's outline before
+		// its fill, since whatever is drawn first stays on top. That only works up to the nearest
+		// masked face: from there on it's drawn back to front, clipped to what's in front of it.
+		int masked = -1;
+		
+	#if ENABLE_TEXTURES && ENABLE_TEXTURES_MASK
+		for ( int i = n - 1; i >= 0 && masked < 0; --i )
 		{
-			drawImposter(scene, (ImposterInstance*)face->instance, bitmap, rowstride);
+			if ( sortedFaceIsMasked(&scene->sortedfacelist[i]) )
+				masked = i;
 		}
+	#endif
+		
+		for ( int i = n - 1; i > masked; --i )
+			drawSortedFace(scene, &scene->sortedfacelist[i], 0, bitmap, rowstride);
+		
+		if ( masked < 0 )
+			return;
+		
+		setSBufferFrozen(1);
+		n = masked + 1;
 	}
+#endif
+	
+	for ( int i = 0; i < n; ++i )
+		drawSortedFace(scene, &scene->sortedfacelist[i], kRenderFilled, bitmap, rowstride);
+	
+#if ENABLE_S_BUFFER
+	setSBufferFrozen(0);
+#endif
 }
 #endif
 
 void
 Scene3D_draw(Scene3D* scene, uint8_t* bitmap, int rowstride)
 {
+	Scene3D_beginFrame(scene);
+
 #if ENABLE_Z_BUFFER
 	scene->zmin = 1e23;
 #endif
 
+	// nothing from last frame is needed anymore.
+	FrameArena_reset(&scene->arena);
+
+#if SORT_3D_INSTANCES_BY_Z
+	scene->instancelist = NULL;
+	scene->instancelistsize = 0;
+#endif
+
 #if SORT_3D_FACES_BY_Z
+	// make room for as many faces as last frame, so the list usually doesn't have to grow.
+	scene->sortedfacelistsize = scene->sortedfacelistc + FACELIST_INCREMENT;
+	scene->sortedfacelist = FrameArena_alloc(&scene->arena, scene->sortedfacelistsize * sizeof(SortedFace));
 	scene->sortedfacelistc = 0;
 #endif
 
-	Scene3D_updateNode(scene, &scene->root, scene->camera, 0, kRenderFilled, 0);
+#if ENABLE_FRUSTUM_CULLING
+	Scene3D_updateFrustum(scene);
+#endif
+
+	Scene3D_updateNodes(scene);
 	
 #if ENABLE_Z_BUFFER
-	resetZBuffer();
+	// the z buffer is shared, so it only needs switching if another scene left it in a different
+	// format. If it can't be, the one there is kept and this scene goes on using it.
+	if ( getZBufferFormat() != scene->zbufferFormat && !setZBufferFormat(scene->zbufferFormat) )
+	{
+		pd->system->logToConsole("mini3d: couldn't switch the z buffer to %d bits", scene->zbufferFormat);
+		scene->zbufferFormat = getZBufferFormat();
+	}
+	
+	scene->hasZBuffer = resetZBuffer();
 #endif
 	resetZScale(CLIP_EPSILON);
 	
+#if ENABLE_S_BUFFER
+	setSBufferEnabled(scene->useSBuffer);
+	
+	if ( scene->useSBuffer )
+		resetSBuffer();
+#endif
+	
 #if SORT_3D_FACES_BY_Z
 	Scene3D_drawSortedFaces(scene, bitmap, rowstride);
 #else
 	Scene3D_drawNode(scene, &scene->root, bitmap, rowstride);
 #endif
+
+#if ENABLE_S_BUFFER
+	setSBufferEnabled(0);
+#endif
 }
\ No newline at end of file
@@ -13,6 +13,7 @@
 #include "3dmath.h"
 #include "shape.h"
 #include "imposter.h"
+#include "render.h"
 
 struct FaceInstance
 {
@@ -29,8 +30,18 @@ struct FaceInstance
 #endif
 #if ENABLE_ORDERING_TABLE
 	struct FaceInstance* next;
+#endif
+	uint8_t outcodes; // its points' outcodes or'd together, or OUTCODE_REJECTED if it's out of view (see scene.c)
+#if FACE_CLIPPING
+	int clipIndex; // if it's clipped, its polygon in the shape's clip list, or -1 if nothing's left of it
 #endif
 	int isDoubleSided : 1;
+#if ENABLE_EARLY_BACKFACE_CULLING
+	int isBackface : 1; // faces away from the camera; its points may not have been transformed
+#endif
+#if SORT_3D_FACES_BY_Z && FACE_SORT_COHERENT
+	int sortSlot; // index in last frame's sorted face list (just a hint; -1 if none)
+#endif
 };
 typedef struct FaceInstance FaceInstance;
 
@@ -43,22 +54,25 @@ typedef enum
 	kRenderWireframeWhite	= (1<<3) // 0 = black, 1 = white
 } RenderStyle;
 
+// a face, or what's left of it, after clipping at the near plane and the guard band.
+// (at most one point more than it started with for each plane, with room for a bent quad.)
+#define CLIP_MAX_POINTS 12
+
 typedef struct
 {
-	// CONFUSINGLY, these points are misnamed!
-	// FIXME: rename these p2->p1, p3->p2, p4->p3, p1->p4.
-	Point3D p2;
-	Point3D p3;
-	Point3D p4;
-	Point3D* p1;
+	int nPoints;
+	Point3D points[CLIP_MAX_POINTS]; // projected
 	FaceInstance* src;
 	#if ENABLE_TEXTURES
-	FaceTexture tex;
+	Point2D tex[CLIP_MAX_POINTS];
+	int texture_enabled : 1;
+	#if ENABLE_TEXTURES_GREYSCALE
+	float lighting;
+	#endif
 	#endif
 } ClippedFace3D;
 
 #define CLIP_RESIZE 0x10
-#define MAXCLIP_CAPACITY 0x60
 
 typedef enum
 {
@@ -71,21 +85,51 @@ typedef struct InstanceHeader
 	InstanceType type;
 	Point3D center;
 	Matrix3D transform;
-	struct InstanceHeader* next;
 	#if ENABLE_Z_BUFFER
 		int useZBuffer : 1;
 	#endif
+	#if ENABLE_FRUSTUM_CULLING
+		int isCulled : 1; // outside the view as of the last update; not drawn
+	#endif
 } InstanceHeader;
 
+typedef struct ImposterInstance
+{
+	InstanceHeader header; // (superclass -- must be the first member)
+	Imposter3D* prototype;
+	
+	// bounding points
+	Point3D tl;
+	Point3D br;
+	
+#if ENABLE_TEXTURES
+	int frame; // of the prototype's texture, chosen by the direction it's seen from
+#endif
+#if ENABLE_SHAPE_IMPOSTERS
+	float scale; // of the prototype's rectangle
+#endif
+	
+#if SORT_3D_FACES_BY_Z && FACE_SORT_COHERENT
+	int sortSlot; // as in FaceInstance
+#endif
+} ImposterInstance;
+
 struct ShapeInstance
 {
 	InstanceHeader header; // (superclass -- must be the first member)
 	Shape3D* prototype; // pointer to original shape
+	int prototypeVersion; // the prototype's version when this was set up from it
+#if ENABLE_LOD
+	Shape3D* lodBase; // the shape that was added; prototype is this or one of its levels of detail
+#endif
 
 	// cached values from node tree update
 	int nPoints;
+	int pointCapacity;
 	Point3D* points;
+	uint8_t* outcodes; // for each point, the planes of the view it's outside of
 	int nFaces;
+	int faceCapacity;
 	FaceInstance* faces;
 	// clipped faces are stored separately
 	int nClip;
@@ -94,41 +138,68 @@ struct ShapeInstance
 	float colorBias;
 	RenderStyle renderStyle;
 	int inverted : 1; // transformation flipped it across a plane, so we need to reverse backface check
+#if ENABLE_EARLY_BACKFACE_CULLING
+	uint8_t* pointVisible; // nonzero for each point used by a face which is not a backface
+#endif
 #if ENABLE_ORDERING_TABLE
 	size_t orderTableSize;
 	FaceInstance** orderTable;
 #endif
+#if ENABLE_BSP
+	// the camera in object space, as a homogeneous point (w = 0 if no perspective)
+	Vector3D eye;
+	float eyeW;
+	int* bspStack; // for traversing the prototype's BSP tree
+#endif
+#if SORT_3D_FACES_BY_Z && FACE_SORT_COHERENT
+	int sortSlot; // as in FaceInstance, for a shape sorted as a whole
+#endif
+#if ENABLE_SHAPE_IMPOSTERS
+	// drawn instead of the shape when isImposter is set (see Shape3D_setImposter)
+	ImposterInstance imposter;
+	int isImposter : 1;
+#endif
 };
 
 typedef struct ShapeInstance ShapeInstance;
 typedef struct Scene3DNode Scene3DNode;
 
-typedef struct ImposterInstance
+// a node stores its instances by value in one array, so each slot must fit any type.
+// (adding an instance to a node may move the node's other instances.)
+typedef union
 {
-	InstanceHeader header; // (superclass -- must be the first member)
-	Imposter3D* prototype;
-	
-	// bounding points
-	Point3D tl;
-	Point3D br;
-} ImposterInstance;
+	InstanceHeader header;
+	ShapeInstance shape;
+	ImposterInstance imposter;
+} Scene3DInstance;
 
 struct Scene3DNode
 {
 	Matrix3D transform;
 	Scene3DNode* parentNode;
 	int nChildren;
+	int childCapacity;
 	Scene3DNode** childNodes;
 	int nInstance;
-	InstanceHeader* instances;
+	int instanceCapacity;
+	Scene3DInstance* instances;
 	float colorBias;
 	RenderStyle renderStyle;
 	int isVisible:1;
 	int needsUpdate:1;
+	int flatIndex; // position in the scene's flattened node list
 #if ENABLE_Z_BUFFER
 	int useZBuffer:1;
 	float zmin;
 #endif
+#if ENABLE_FRUSTUM_CULLING
+	// encloses this node's instances and (visible) descendents, in the node's local space
+	// (i.e. before applying this node's transform). Negative radius means unbounded.
+	Sphere3D bounds;
+	int boundsEmpty:1;
+	int needsBoundsUpdate:1;
+	int isCulled:1;
+#endif
 };
 
 void Scene3DNode_init(Scene3DNode* node);
@@ -148,6 +219,19 @@ void Scene3DNode_setVisible(Scene3DNode* node, int visible);
 void Scene3DNode_setUsesZBuffer(Scene3DNode* node, int flag);
 #endif
 
+// an entry in the scene's depth-first list of its nodes, which is rebuilt when nodes are added.
+typedef struct
+{
+	Scene3DNode* node;
+	int parent; // index of the parent's entry, or -1 for the root
+	int end; // index just past this node's last descendent
+	
+	// accumulated from the root as of the last update
+	Matrix3D xform;
+	float colorBias;
+	RenderStyle style;
+} FlatNode3D;
+
 #if SORT_3D_FACES_BY_Z
 // points to a (instance, face).
 typedef struct
@@ -160,11 +244,17 @@ typedef struct
 	// (clipped faces are stored separately from regular faces.)
 	uint32_t face;
 } SortedFace;
+
+// SortedFace.face for a shape which is drawn whole (i.e. one with a BSP tree)
+#define SORTEDFACE_SHAPE 0x7fffffff
 #endif
 
 typedef struct
 {
 	int hasPerspective : 1;
+#if ENABLE_S_BUFFER
+	int useSBuffer : 1; // draw front to back, using the S-buffer for visibility
+#endif
 	
 	Matrix3D camera;
 	Vector3D light;
@@ -178,6 +268,19 @@ typedef struct
 	
 	Scene3DNode root;
 	
+	// the node tree, flattened. (Updating and drawing walk this instead of recursing.)
+	FlatNode3D* flatNodes;
+	int nFlatNodes;
+	int flatVersion; // value of the node topology counter this was built from
+	
+	// per-frame data (the lists below) is allocated from here. It's reset by Scene3D_draw.
+	FrameArena arena;
+	
+	// rows drawn to this frame and last frame. (the display needs both: last frame's drawing
+	// has to be erased wherever this frame didn't draw over it.)
+	LCDRowRange drawnRows;
+	LCDRowRange lastDrawnRows;
+	
 #if SORT_3D_INSTANCES_BY_Z
 	// all instances from the render tree are added here and z-sorted
 	InstanceHeader** instancelist;
@@ -188,10 +291,40 @@ typedef struct
 	SortedFace* sortedfacelist;
 	int sortedfacelistsize;
 	int sortedfacelistc;
+	#if FACE_RADIX_SORT || FACE_SORT_COHERENT || ENABLE_SCENE_ORDERING_TABLE
+	// sorting scratch space, allocated when sorting. (it may swap with sortedfacelist.)
+	SortedFace* sortedfacescratch;
+	#endif
+	#if FACE_SORT_COHERENT
+	// length of last frame's list, and a table (of that length, allocated when sorting) used to restore its order.
+	int prevsortedfacelistc;
+	int* sortslots;
+	#endif
+	#if ENABLE_SCENE_ORDERING_TABLE
+	// number of depth buckets (0 to sort the face list instead), and a count for each.
+	int orderTableSize;
+	int* orderTable;
+	#endif
 #endif
 
 #if ENABLE_Z_BUFFER
 	float zmin;
+	
+	// bits per pixel of the z buffer this scene draws with: 8, 16 or 32.
+	int zbufferFormat;
+	// false if the z buffer couldn't be allocated this frame, in which case z-buffered
+	// instances are drawn without it.
+	int hasZBuffer;
+#endif
+
+#if ENABLE_FRUSTUM_CULLING
+	// objects beyond this distance from the camera are culled.
+	float farDistance;
+	
+	// inward-facing normals of the left, right, top and bottom planes of the view, in camera space.
+	// (if no perspective, these planes are axis-aligned and frustumOffset gives their distance from the origin.)
+	Vector3D frustum[4];
+	float frustumOffset[4];
 #endif
 	
 } Scene3D;
@@ -202,7 +335,34 @@ void Scene3D_setCamera(Scene3D* scene, Point3D origin, Point3D lookAt, float sca
 void Scene3D_setGlobalLight(Scene3D* scene, Vector3D light);
 Scene3DNode* Scene3D_getRootNode(Scene3D* scene);
 void Scene3D_draw(Scene3D* scene, uint8_t* buffer, int rowstride);
+// starts a frame: the rows drawn so far become last frame's, and the render stats are reset.
+// Scene3D_draw does this itself; when drawing with Scene3D_drawNode, call it once per frame first.
+void Scene3D_beginFrame(Scene3D* scene);
 void Scene3D_drawNode(Scene3D* scene, Scene3DNode* node, uint8_t* bitmap, int rowstride);
+// the rows that have changed on screen since the frame before last was drawn. (empty if none.)
+LCDRowRange Scene3D_getUpdatedRows(Scene3D* scene);
 void Scene3D_setCenter(Scene3D* scene, float x, float y);
+#if ENABLE_FRUSTUM_CULLING
+void Scene3D_setFarDistance(Scene3D* scene, float distance);
+#endif
+#if ENABLE_SCENE_ORDERING_TABLE
+void Scene3D_setOrderTableSize(Scene3D* scene, int size);
+#endif
+#if ENABLE_S_BUFFER
+void Scene3D_setUsesSBuffer(Scene3D* scene, int flag);
+#endif
+#if ENABLE_Z_BUFFER
+// 8, 16 or 32. Returns 0 (and keeps the old format) if that format isn't available.
+int Scene3D_setZBufferFormat(Scene3D* scene, int bits);
+#endif
+
+#if ENABLE_SHAPE_IMPOSTERS
+// renders shape (without perspective) from nYaw directions around up for each of nPitch elevations,
+// into the frames of a new imposter's texture (see Imposter3D_setFrames). Frames are frameSize pixels
+// square, rounded up to a power of 2 and at most the viewport height. The first frame is the view from forward.
+// Returns the imposter with a retain count of 0, or NULL if out of memory. This is slow; do it at load time.
+// (shape is added to a scene for this, so it should already be retained.)
+Imposter3D* Imposter3D_newFromShape(Shape3D* shape, int nYaw, int nPitch, int frameSize, Vector3D up, Vector3D forward);
+#endif
 
 #endif /* scene_h */
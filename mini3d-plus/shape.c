@@ -13,8 +13,12 @@
 void Shape3D_init(Shape3D* shape)
 {
 	shape->retainCount = 0;
+	shape->version = 0;
 	shape->nPoints = 0;
 	shape->points = NULL;
+	shape->pointsX = NULL;
+	shape->pointsY = NULL;
+	shape->pointsZ = NULL;
 	shape->nFaces = 0;
 	shape->faces = NULL;
 #if ENABLE_TEXTURES
@@ -31,11 +35,26 @@ void Shape3D_init(Shape3D* shape)
 	shape->center.x = 0;
 	shape->center.y = 0;
 	shape->center.z = 0;
+	shape->radius = 0;
 	shape->colorBias = 0;
 	shape->isClosed = 0;
 #if ENABLE_ORDERING_TABLE
 	shape->orderTableSize = 0;
 #endif
+#if ENABLE_BSP
+	shape->bsp = NULL;
+	shape->nBSPNodes = 0;
+	shape->bspDepth = 0;
+#endif
+#if ENABLE_LOD
+	shape->nLODs = 0;
+	shape->lods = NULL;
+	shape->lodSizes = NULL;
+#endif
+#if ENABLE_SHAPE_IMPOSTERS
+	shape->imposter = NULL;
+	shape->imposterDistance = 0;
+#endif
 }
 
 Shape3D* Shape3D_retain(Shape3D* shape)
@@ -50,7 +69,12 @@ void Shape3D_release(Shape3D* shape)
 		return;
 	
 	if ( shape->points != NULL )
+	{
 		m3d_free(shape->points);
+		m3d_free(shape->pointsX);
+		m3d_free(shape->pointsY);
+		m3d_free(shape->pointsZ);
+	}
 	
 	if ( shape->faces != NULL )
 		m3d_free(shape->faces);
@@ -67,6 +91,27 @@ void Shape3D_release(Shape3D* shape)
 	Pattern_unref(shape->pattern);
 	#endif
 	
+	#if ENABLE_BSP
+	if ( shape->bsp != NULL )
+		m3d_free(shape->bsp);
+	#endif
+	
+	#if ENABLE_LOD
+	for ( int i = 0; i < shape->nLODs; ++i )
+		Shape3D_release(shape->lods[i]);
+	
+	if ( shape->lods != NULL )
+	{
+		m3d_free(shape->lods);
+		m3d_free(shape->lodSizes);
+	}
+	#endif
+	
+	#if ENABLE_SHAPE_IMPOSTERS
+	if ( shape->imposter != NULL )
+		Imposter3D_release(shape->imposter);
+	#endif
+	
 	m3d_free(shape);
 }
 
@@ -83,8 +128,15 @@ int Shape3D_addPoint(Shape3D* shape, Point3D* p)
 	
 	shape->points = m3d_realloc(shape->points, (shape->nPoints + 1) * sizeof(Point3D));
 	
+	shape->pointsX = m3d_realloc(shape->pointsX, (shape->nPoints + 1) * sizeof(float));
+	shape->pointsY = m3d_realloc(shape->pointsY, (shape->nPoints + 1) * sizeof(float));
+	shape->pointsZ = m3d_realloc(shape->pointsZ, (shape->nPoints + 1) * sizeof(float));
+	
 	Point3D* point = &shape->points[shape->nPoints];
 	*point = *p;
+	shape->pointsX[shape->nPoints] = p->x;
+	shape->pointsY[shape->nPoints] = p->y;
+	shape->pointsZ[shape->nPoints] = p->z;
 	
 	return shape->nPoints++;
 }
@@ -119,7 +171,11 @@ size_t Shape3D_addFace(Shape3D* shape, Point3D* a, Point3D* b, Point3D* c, Point
 	face->colorBias = colorBias;
 	face->isDoubleSided = 0;
 	
+	face->normal = normal(a, b, c);
+	face->d = -Vector3DDot(face->normal, Vector3DMake(a->x, a->y, a->z));
+	
 	++shape->nFaces;
+	++shape->version;
 	
 	if ( d != NULL )
 	{
@@ -134,6 +190,17 @@ size_t Shape3D_addFace(Shape3D* shape, Point3D* a, Point3D* b, Point3D* c, Point
 		shape->center.z += (a->z + b->z + c->z) / 3 / shape->nFaces;
 	}
 	
+	// the center moves as faces are added, so the radius must be recomputed from scratch.
+	shape->radius = 0;
+	for ( int i = 0; i < shape->nPoints; ++i )
+	{
+		Vector3D v = Point3D_difference(&shape->center, &shape->points[i]);
+		float r = Vector3D_lengthSquared(&v);
+		if ( r > shape->radius )
+			shape->radius = r;
+	}
+	shape->radius = sqrtf(shape->radius);
+	
 	#if ENABLE_TEXTURES
 	if (shape->texmap)
 		Shape3D_resize_texmap_buffer(shape);
@@ -220,3 +287,37 @@ void Shape3D_setScanlining(Shape3D* shape, ScanlineFill scanlineFill)
 	shape->scanline = scanlineFill;
 }
 #endif
+
+#if ENABLE_LOD
+void Shape3D_addLOD(Shape3D* shape, Shape3D* lod, float size)
+{
+	shape->lods = m3d_realloc(shape->lods, (shape->nLODs + 1) * sizeof(Shape3D*));
+	shape->lodSizes = m3d_realloc(shape->lodSizes, (shape->nLODs + 1) * sizeof(float));
+	
+	// keep the list ordered from largest size (least simplified) to smallest
+	int i = shape->nLODs++;
+	
+	for ( ; i > 0 && shape->lodSizes[i - 1] < size; --i )
+	{
+		shape->lods[i] = shape->lods[i - 1];
+		shape->lodSizes[i] = shape->lodSizes[i - 1];
+	}
+	
+	shape->lods[i] = Shape3D_retain(lod);
+	shape->lodSizes[i] = size;
+}
+#endif
+
+#if ENABLE_SHAPE_IMPOSTERS
+void Shape3D_setImposter(Shape3D* shape, Imposter3D* imposter, float distance)
+{
+	if ( imposter != NULL )
+		Imposter3D_retain(imposter);
+	
+	if ( shape->imposter != NULL )
+		Imposter3D_release(shape->imposter);
+	
+	shape->imposter = imposter;
+	shape->imposterDistance = distance;
+}
+#endif
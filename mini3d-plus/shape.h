@@ -13,6 +13,7 @@
 #include "3dmath.h"
 #include "texture.h"
 #include "scanline.h"
+#include "imposter.h"
 
 typedef struct
 {
@@ -21,6 +22,9 @@ typedef struct
 	uint16_t p3;
 	uint16_t p4; // 0xffff if it's a tri
 	float colorBias;
+	// plane of the face in object space: dot(normal, p) + d = 0
+	Vector3D normal;
+	float d;
 	int isDoubleSided : 1;
 } Face3D;
 
@@ -45,11 +49,31 @@ typedef struct
 } FaceTexture;
 #endif
 
+#if ENABLE_BSP
 typedef struct
+{
+	// splitting plane in object space: dot(normal, p) + d = 0
+	Vector3D normal;
+	float d;
+	// faces[face] to faces[face + nFaces - 1] lie in the plane
+	int face;
+	int nFaces;
+	// child nodes on the front (positive) and back side of the plane; -1 if none
+	int front;
+	int back;
+} BSPNode3D;
+#endif
+
+typedef struct Shape3D
 {
 	int retainCount;
+	int version; // changes when the points or faces do, so instances know to set themselves up again
 	int nPoints;
 	Point3D* points;
+	// the same points again, as separate x, y and z arrays (for Matrix3D_transformPoints)
+	float* pointsX;
+	float* pointsY;
+	float* pointsZ;
 	int nFaces;
 	Face3D* faces;
 #if ENABLE_TEXTURES
@@ -64,12 +88,30 @@ typedef struct
 	ScanlineFill scanline;
 #endif
 	Point3D center; // used for z-sorting entire shapes at a time, and for collision detection
+	float radius; // distance from center to the farthest point; used for frustum culling
 	float colorBias;
 	
 	int isClosed : 1;
 #if ENABLE_ORDERING_TABLE
 	size_t orderTableSize;
 #endif
+#if ENABLE_BSP
+	// iff NULL then this shape has no BSP tree. Otherwise bsp[0] is the root.
+	BSPNode3D* bsp;
+	int nBSPNodes;
+	int bspDepth;
+#endif
+#if ENABLE_LOD
+	// simpler versions of this shape (see Shape3D_addLOD), in order of decreasing lodSizes.
+	int nLODs;
+	struct Shape3D** lods;
+	float* lodSizes;
+#endif
+#if ENABLE_SHAPE_IMPOSTERS
+	// if not NULL, instances further away than imposterDistance are drawn as this instead.
+	Imposter3D* imposter;
+	float imposterDistance;
+#endif
 } Shape3D;
 
 void Shape3D_init(Shape3D* shape);
@@ -78,6 +120,7 @@ void Shape3D_initWithPrototype(Shape3D* shape, Shape3D* proto);
 Shape3D* Shape3D_retain(Shape3D* shape);
 void Shape3D_release(Shape3D* shape);
 
+int Shape3D_addPoint(Shape3D* shape, Point3D* p);
 size_t Shape3D_addFace(Shape3D* shape, Point3D* a, Point3D* b, Point3D* c, Point3D* d, float colorBias);
 
 void Shape3D_setClosed(Shape3D* shape, int flag);
@@ -115,4 +158,27 @@ void Shape3D_setScanlining(Shape3D* shape, ScanlineFill scanlineFill);
 void Shape3D_setOrderTableSize(Shape3D* shape, size_t size);
 #endif
 
+#if ENABLE_BSP
+// sorts the faces into a BSP tree, splitting them where necessary (see bsp.c).
+// Do this after all faces have been added, and before the shape is added to a scene.
+void Shape3D_buildBSP(Shape3D* shape);
+#endif
+
+#if ENABLE_LOD
+// lod is drawn in place of this shape when its radius on screen is less than size pixels
+// (and there's no simpler level whose size it's also under). lod is retained.
+void Shape3D_addLOD(Shape3D* shape, Shape3D* lod, float size);
+
+// returns a new shape (with retain count 0) approximating this one with at most about nFaces triangles,
+// found by quadric edge collapse. Texture coordinates are kept. This is slow; it's meant for
+// load time or for baking on the host (see simplify.c).
+Shape3D* Shape3D_newSimplified(Shape3D* shape, int nFaces);
+#endif
+
+#if ENABLE_SHAPE_IMPOSTERS
+// instances of the shape whose center is more than distance in front of the camera
+// are drawn as imposter (usually one from Imposter3D_newFromShape). imposter is retained; it may be NULL.
+void Shape3D_setImposter(Shape3D* shape, Imposter3D* imposter, float distance);
+#endif
+
 #endif /* shape_h */
@@ -0,0 +1,437 @@
+//
+//  simplify.c
+//  Extension
+//
+//  Mesh simplification by quadric edge collapse (Garland & Heckbert, 1997),
+//  for making levels of detail (see Shape3D_addLOD).
+//
+//  Each point gets a quadric measuring squared distance to the planes of the faces around it.
+//  Edges are collapsed one endpoint onto the other, cheapest first, until few enough faces remain.
+//  Points are never moved, and texture coordinates of the faces which lose a point are
+//  taken from that face's own mapping at the point it's collapsed onto.
+//
+
+#include "mini3d.h"
+#include "shape.h"
+#include "qsort.h"
+
+#if ENABLE_LOD
+
+// boundary edges are held in place by a plane perpendicular to their face, with this weight
+#define BOUNDARY_WEIGHT 1000.0
+
+// a collapse may not turn a triangle further than this (cosine of the angle) from its original direction
+#define MIN_NORMAL_COS 0.25f
+
+// symmetric 4x4 matrix; the error of a point p is [p 1] Q [p 1]^T.
+// (stored as the upper triangle: 00 01 02 03 11 12 13 22 23 33)
+typedef struct
+{
+	double q[10];
+} Quadric;
+
+typedef struct
+{
+	int v[3];
+	Vector3D normal; // of the original face, so that collapses can't turn it over a little at a time
+	float colorBias;
+#if ENABLE_TEXTURES
+	Point2D uv[3];
+	int textured;
+	#if ENABLE_TEXTURES_GREYSCALE
+	float lighting;
+	#endif
+#endif
+	uint8_t isDoubleSided;
+	uint8_t alive;
+} STri;
+
+typedef struct
+{
+	double cost;
+	int from;
+	int to;
+} Collapse;
+
+static void
+quadricAddPlane(Quadric* Q, Vector3D n, double d, double w)
+{
+	double a = n.dx, b = n.dy, c = n.dz;
+	double* q = Q->q;
+
+	q[0] += w * a * a; q[1] += w * a * b; q[2] += w * a * c; q[3] += w * a * d;
+	q[4] += w * b * b; q[5] += w * b * c; q[6] += w * b * d;
+	q[7] += w * c * c; q[8] += w * c * d;
+	q[9] += w * d * d;
+}
+
+static double
+quadricError(const Quadric* A, const Quadric* B, Point3D p)
+{
+	double q[10];
+
+	for ( int i = 0; i < 10; ++i )
+		q[i] = A->q[i] + B->q[i];
+
+	double x = p.x, y = p.y, z = p.z;
+
+	return q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x
+		+ q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y
+		+ q[7] * z * z + 2 * q[8] * z
+		+ q[9];
+}
+
+static Vector3D
+triCross(Point3D* pts, int a, int b, int c)
+{
+	Vector3D u = Point3D_difference(&pts[a], &pts[b]);
+	Vector3D v = Point3D_difference(&pts[a], &pts[c]);
+	return Vector3DCross(u, v);
+}
+
+static int
+triHas(STri* t, int v)
+{
+	return t->v[0] == v || t->v[1] == v || t->v[2] == v;
+}
+
+#if ENABLE_TEXTURES
+// the texture coordinate t's mapping gives point p (projected onto t's plane).
+static Point2D
+triUVAt(STri* t, Point3D* pts, Point3D p)
+{
+	Vector3D e1 = Point3D_difference(&pts[t->v[0]], &pts[t->v[1]]);
+	Vector3D e2 = Point3D_difference(&pts[t->v[0]], &pts[t->v[2]]);
+	Vector3D ep = Point3D_difference(&pts[t->v[0]], &p);
+
+	float d11 = Vector3DDot(e1, e1);
+	float d12 = Vector3DDot(e1, e2);
+	float d22 = Vector3DDot(e2, e2);
+	float dp1 = Vector3DDot(ep, e1);
+	float dp2 = Vector3DDot(ep, e2);
+	float det = d11 * d22 - d12 * d12;
+
+	if ( det == 0 )
+		return t->uv[0];
+
+	float b1 = (d22 * dp1 - d12 * dp2) / det;
+	float b2 = (d11 * dp2 - d12 * dp1) / det;
+	float b0 = 1 - b1 - b2;
+
+	return (Point2D){
+		b0 * t->uv[0].x + b1 * t->uv[1].x + b2 * t->uv[2].x,
+		b0 * t->uv[0].y + b1 * t->uv[1].y + b2 * t->uv[2].y
+	};
+}
+#endif
+
+// lists each point's live triangles: adj[start[v]] to adj[start[v + 1] - 1]
+static void
+buildAdjacency(STri* tris, int nTris, int nPoints, int* start, int* adj)
+{
+	memset(start, 0, (nPoints + 1) * sizeof(int));
+
+	for ( int i = 0; i < nTris; ++i )
+	{
+		if ( tris[i].alive )
+		{
+			for ( int k = 0; k < 3; ++k )
+				++start[tris[i].v[k] + 1];
+		}
+	}
+
+	for ( int v = 0; v < nPoints; ++v )
+		start[v + 1] += start[v];
+
+	int* fill = m3d_malloc(nPoints * sizeof(int));
+	memcpy(fill, start, nPoints * sizeof(int));
+
+	for ( int i = 0; i < nTris; ++i )
+	{
+		if ( tris[i].alive )
+		{
+			for ( int k = 0; k < 3; ++k )
+				adj[fill[tris[i].v[k]]++] = i;
+		}
+	}
+
+	m3d_free(fill);
+}
+
+// would moving from onto to flip or flatten any triangle that survives it?
+static int
+collapseIsValid(STri* tris, Point3D* pts, int* start, int* adj, int from, int to)
+{
+	for ( int j = start[from]; j < start[from + 1]; ++j )
+	{
+		STri* t = &tris[adj[j]];
+
+		if ( !t->alive || triHas(t, to) )
+			continue;
+
+		int v[3];
+		for ( int k = 0; k < 3; ++k )
+			v[k] = (t->v[k] == from) ? to : t->v[k];
+
+		Vector3D after = triCross(pts, v[0], v[1], v[2]);
+		float len = sqrtf(Vector3DDot(after, after));
+
+		if ( len == 0 || Vector3DDot(t->normal, after) < MIN_NORMAL_COS * len )
+			return 0;
+	}
+
+	return 1;
+}
+
+Shape3D* Shape3D_newSimplified(Shape3D* shape, int nFaces)
+{
+	int nPoints = shape->nPoints;
+	Point3D* pts = shape->points;
+
+	// split quads into triangles
+	int nTris = 0;
+
+	for ( int i = 0; i < shape->nFaces; ++i )
+		nTris += (shape->faces[i].p4 != 0xffff) ? 2 : 1;
+
+	STri* tris = m3d_malloc(nTris * sizeof(STri));
+	int n = 0;
+
+	for ( int i = 0; i < shape->nFaces; ++i )
+	{
+		Face3D* f = &shape->faces[i];
+		int corners[4] = { f->p1, f->p2, f->p3, f->p4 };
+		int nsplit = (f->p4 != 0xffff) ? 2 : 1;
+
+	#if ENABLE_TEXTURES
+		FaceTexture* ft = (shape->texmap != NULL) ? &shape->texmap[i] : NULL;
+		Point2D uvs[4] = { { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 } };
+
+		if ( ft != NULL )
+		{
+			uvs[0] = ft->t1; uvs[1] = ft->t2; uvs[2] = ft->t3; uvs[3] = ft->t4;
+		}
+	#endif
+
+		for ( int s = 0; s < nsplit; ++s )
+		{
+			// (0, 1, 2), then (0, 2, 3)
+			int idx[3] = { 0, 1 + s, 2 + s };
+			STri* t = &tris[n++];
+
+			for ( int k = 0; k < 3; ++k )
+			{
+				t->v[k] = corners[idx[k]];
+			#if ENABLE_TEXTURES
+				t->uv[k] = uvs[idx[k]];
+			#endif
+			}
+
+			t->normal = Vector3D_normalize(triCross(pts, t->v[0], t->v[1], t->v[2]));
+			t->colorBias = f->colorBias;
+			t->isDoubleSided = f->isDoubleSided ? 1 : 0;
+			t->alive = 1;
+		#if ENABLE_TEXTURES
+			t->textured = (ft != NULL) && ft->texture_enabled;
+			#if ENABLE_TEXTURES_GREYSCALE
+			t->lighting = (ft != NULL) ? ft->lighting : 0;
+			#endif
+		#endif
+		}
+	}
+
+	// point quadrics from the planes of their triangles (area weighted)
+	Quadric* Q = m3d_calloc(nPoints, sizeof(Quadric));
+	int* start = m3d_malloc((nPoints + 1) * sizeof(int));
+	int* adj = m3d_malloc(3 * nTris * sizeof(int));
+
+	buildAdjacency(tris, nTris, nPoints, start, adj);
+
+	for ( int i = 0; i < nTris; ++i )
+	{
+		STri* t = &tris[i];
+		Vector3D c = triCross(pts, t->v[0], t->v[1], t->v[2]);
+		float area = sqrtf(Vector3DDot(c, c));
+
+		if ( area == 0 )
+			continue;
+
+		Vector3D nrm = Vector3DMake(c.dx / area, c.dy / area, c.dz / area);
+		Point3D* p0 = &pts[t->v[0]];
+		double d = -(nrm.dx * p0->x + nrm.dy * p0->y + nrm.dz * p0->z);
+
+		for ( int k = 0; k < 3; ++k )
+			quadricAddPlane(&Q[t->v[k]], nrm, d, area);
+
+		// an edge no other triangle shares is on the boundary
+		for ( int k = 0; k < 3; ++k )
+		{
+			int a = t->v[k];
+			int b = t->v[(k + 1) % 3];
+			int shared = 0;
+
+			for ( int j = start[a]; j < start[a + 1] && !shared; ++j )
+				shared = (adj[j] != i) && triHas(&tris[adj[j]], b);
+
+			if ( shared )
+				continue;
+
+			Vector3D e = Point3D_difference(&pts[a], &pts[b]);
+			Vector3D bn = Vector3DCross(e, nrm);
+			float len = sqrtf(Vector3DDot(bn, bn));
+
+			if ( len == 0 )
+				continue;
+
+			bn = Vector3DMake(bn.dx / len, bn.dy / len, bn.dz / len);
+			double bd = -(bn.dx * pts[a].x + bn.dy * pts[a].y + bn.dz * pts[a].z);
+
+			quadricAddPlane(&Q[a], bn, bd, BOUNDARY_WEIGHT * len);
+			quadricAddPlane(&Q[b], bn, bd, BOUNDARY_WEIGHT * len);
+		}
+	}
+
+	// collapse edges in passes. Within a pass, each point is touched at most once, so the adjacency stays valid.
+	int alive = nTris;
+	Collapse* collapses = m3d_malloc(3 * nTris * sizeof(Collapse));
+	uint8_t* dirty = m3d_malloc(nPoints);
+
+	while ( alive > nFaces )
+	{
+		buildAdjacency(tris, nTris, nPoints, start, adj);
+		memset(dirty, 0, nPoints);
+
+		int nc = 0;
+
+		for ( int i = 0; i < nTris; ++i )
+		{
+			STri* t = &tris[i];
+
+			if ( !t->alive )
+				continue;
+
+			for ( int k = 0; k < 3; ++k )
+			{
+				int a = t->v[k];
+				int b = t->v[(k + 1) % 3];
+				double ab = quadricError(&Q[a], &Q[b], pts[b]);
+				double ba = quadricError(&Q[a], &Q[b], pts[a]);
+
+				collapses[nc++] = (ab <= ba) ? (Collapse){ ab, a, b } : (Collapse){ ba, b, a };
+			}
+		}
+
+		Collapse tmp;
+		#define LESS(a, b) collapses[a].cost < collapses[b].cost
+		#define SWAP(a, b) tmp = collapses[a], collapses[a] = collapses[b], collapses[b] = tmp
+		QSORT(nc, LESS, SWAP);
+		#undef LESS
+		#undef SWAP
+
+		int progress = 0;
+
+		for ( int c = 0; c < nc && alive > nFaces; ++c )
+		{
+			int from = collapses[c].from;
+			int to = collapses[c].to;
+
+			if ( dirty[from] || dirty[to] )
+				continue;
+
+			if ( !collapseIsValid(tris, pts, start, adj, from, to) )
+				continue;
+
+			for ( int j = start[from]; j < start[from + 1]; ++j )
+			{
+				STri* t = &tris[adj[j]];
+
+				if ( !t->alive )
+					continue;
+
+				if ( triHas(t, to) )
+				{
+					t->alive = 0;
+					--alive;
+					continue;
+				}
+
+				for ( int k = 0; k < 3; ++k )
+				{
+					if ( t->v[k] != from )
+						continue;
+
+				#if ENABLE_TEXTURES
+					t->uv[k] = triUVAt(t, pts, pts[to]);
+				#endif
+					t->v[k] = to;
+				}
+			}
+
+			for ( int i = 0; i < 10; ++i )
+				Q[to].q[i] += Q[from].q[i];
+
+			dirty[from] = dirty[to] = 1;
+			progress = 1;
+		}
+
+		if ( !progress )
+			break;
+	}
+
+	// build the new shape from what's left
+	Shape3D* out = m3d_malloc(sizeof(Shape3D));
+	Shape3D_init(out);
+
+	for ( int i = 0; i < nTris; ++i )
+	{
+		STri* t = &tris[i];
+
+		if ( !t->alive )
+			continue;
+
+		Point3D a = pts[t->v[0]], b = pts[t->v[1]], c = pts[t->v[2]];
+		size_t face = Shape3D_addFace(out, &a, &b, &c, NULL, t->colorBias);
+
+		if ( t->isDoubleSided )
+			Shape3D_setFaceDoubleSided(out, face, 1);
+
+	#if ENABLE_TEXTURES
+		if ( shape->texmap != NULL )
+		{
+			Shape3D_setFaceTextureMap(out, face, t->uv[0], t->uv[1], t->uv[2], t->uv[0]);
+			out->texmap[face].texture_enabled = t->textured;
+
+			#if ENABLE_TEXTURES_GREYSCALE
+			out->texmap[face].lighting = t->lighting;
+			#endif
+		}
+	#endif
+	}
+
+	out->colorBias = shape->colorBias;
+	out->isClosed = shape->isClosed;
+
+#if ENABLE_TEXTURES
+	Shape3D_setTexture(out, shape->texture);
+#endif
+#if ENABLE_CUSTOM_PATTERNS
+	Shape3D_setPattern(out, shape->pattern);
+#endif
+#if ENABLE_POLYGON_SCANLINING
+	out->scanline = shape->scanline;
+#endif
+#if ENABLE_ORDERING_TABLE
+	out->orderTableSize = shape->orderTableSize;
+#endif
+
+	m3d_free(dirty);
+	m3d_free(collapses);
+	m3d_free(adj);
+	m3d_free(start);
+	m3d_free(Q);
+	m3d_free(tris);
+
+	return out;
+}
+
+#endif
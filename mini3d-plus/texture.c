@@ -217,7 +217,7 @@ Texture* Texture_loadFromPath(const char* path, int greyscale, const char** oute
                 return NULL;
             }
             *(uint32_t*)t = 1;
-            *(LCDBitmap**)(t + sizeof(uint32_t)) = bitmap;
+            memcpy(t + sizeof(uint32_t), &bitmap, sizeof(bitmap));
             return t + sizeof(uint32_t);
         }
         else
@@ -261,7 +261,7 @@ Texture* Texture_fromLCDBitmap(LCDBitmap* bitmap)
         return NULL;
     }
     *(uint32_t*)t = 1;
-    *(LCDBitmap**)(t + sizeof(uint32_t)) = bitmap;
+    memcpy(t + sizeof(uint32_t), &bitmap, sizeof(bitmap));
     return t + sizeof(uint32_t);
 }
 
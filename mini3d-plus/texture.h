@@ -12,6 +12,24 @@
 // in both cases, subtract 4 bytes to get a refcounter.
 typedef void Texture;
 
+// getBitmapData() gives the address of the mask (or NULL), not a flag.
+static inline void
+Texture_getBitmapData(LCDBitmap* bitmap, int* width, int* height, int* rowbytes, int* hasmask, uint8_t** data)
+{
+    uint8_t* mask = NULL;
+    pd->graphics->getBitmapData(bitmap, width, height, rowbytes, &mask, data);
+    if (hasmask) *hasmask = (mask != NULL);
+}
+
+// the LCDBitmap* follows the 4-byte refcount, so it's only 4-aligned where pointers are 8 bytes.
+static inline LCDBitmap*
+Texture_loadLCDBitmapPointer(void* p)
+{
+    LCDBitmap* bitmap;
+    memcpy(&bitmap, p, sizeof(bitmap));
+    return bitmap;
+}
+
 #if ENABLE_TEXTURES_GREYSCALE
 
 typedef struct
@@ -43,7 +61,7 @@ static inline LCDBitmap*
 Texture_getLCDBitmap(Texture* t)
 {
     // (~1 is actually not necessary)
-    return *(LCDBitmap**)((uintptr_t)t & ~1);
+    return Texture_loadLCDBitmapPointer((void*)((uintptr_t)t & ~1));
 }
 
 static inline GreyBitmap*
@@ -58,7 +76,7 @@ Texture_getData(Texture* t, int* width, int* height, int* rowbytes, int* hasmask
 {
     if (Texture_isLCDBitmap(t))
     {
-        pd->graphics->getBitmapData(Texture_getLCDBitmap(t), width, height, rowbytes, (uint8_t**)hasmask, data);
+        Texture_getBitmapData(Texture_getLCDBitmap(t), width, height, rowbytes, hasmask, data);
         if (fmt) *fmt = 0;
     }
     else
@@ -88,13 +106,13 @@ Texture_isGreyBitmap(Texture* t)
 static inline LCDBitmap*
 Texture_getLCDBitmap(Texture* t)
 {
-    return *(LCDBitmap**)t;
+    return Texture_loadLCDBitmapPointer(t);
 }
 
 static inline void
 Texture_getData(Texture* t, int* width, int* height, int* rowbytes, int* hasmask, int* fmt, uint8_t** data)
 {
-    pd->graphics->getBitmapData(Texture_getLCDBitmap(t), width, height, rowbytes, hasmask, data);
+    Texture_getBitmapData(Texture_getLCDBitmap(t), width, height, rowbytes, hasmask, data);
     if (fmt) *fmt = 0;
 }
 #endif
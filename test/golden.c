@@ -0,0 +1,321 @@
+//
+//  golden.c
+//  mini3d-plus tests
+//
+//  Draws the demo scenes (bench/scenes.c) at fixed frames and compares each frame with a
+//  reference image in test/golden. A frame passes if at most --tolerance pixels differ; for
+//  each one that doesn't, the differing pixels are reported and the frame and a diff image
+//  (differing pixels in black) are written to --out, so breakage from changes to the
+//  rasterizer, clipping or projective mapping shows up instead of going unnoticed.
+//
+//  Each pose is also drawn in the runtime modes below: with the S-buffer, which has to match
+//  the same references (except in z-buffered builds), and with the scene ordering table (and
+//  in z-buffered builds, each z buffer format), which have references of their own.
+//
+//  The references are for the default mini3d.h. Other configurations draw differently, so
+//  give them their own --refs directory and make it with --update.
+//
+//  Build and run (from the repository root):
+//      make -C host test
+//  or
+//      make -C host && host/build/golden_test
+//
+//  Options:
+//      --update          write the references instead of comparing with them
+//      --refs DIR        where the references are (default test/golden)
+//      --out DIR         where failing frames and diffs go (default test/golden-out)
+//      --tolerance N     differing pixels allowed per frame (default 16)
+//      --scene NAME      only this scene (may be repeated)
+//      --assets DIR      where track.json etc. are (default Source/assets)
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "pd_host.h"
+#include "mini3d.h"
+#include "scenes.h"
+
+// frames compared for each scene, chosen to cover clipping against the screen edges and
+// near plane, overlapping and intersecting faces, wireframes and textures at an angle.
+static const struct
+{
+	const char* scene;
+	int frames[4];
+} poses[] = {
+	{ "kart", { 0, 45, 120, 200 } },
+	{ "knot", { 0, 75, 150, 300 } },
+	{ "icosahedra", { 0, 40, 80, 160 } },
+	{ "ztest", { 0, 40, 120, 200 } },
+};
+
+#define POSE_COUNT (int)(sizeof(poses) / sizeof(poses[0]))
+#define FRAMES_PER_POSE (int)(sizeof(poses[0].frames) / sizeof(poses[0].frames[0]))
+
+// runtime settings every pose is drawn with. A mode with a suffix has its own references,
+// <scene>-<frame><suffix>.pbm; one without must match the default mode's.
+static const struct
+{
+	const char* name;
+	const char* suffix;
+	int sbuffer;
+	int orderTable;
+	int zbits;
+} modes[] = {
+	{ NULL, "", 0, 0, 0 },
+#if ENABLE_S_BUFFER && ENABLE_Z_BUFFER
+	// (the S-buffer turns the z buffer off, so intersecting faces draw differently)
+	{ "sbuffer", "-sb", 1, 0, 0 },
+#elif ENABLE_S_BUFFER
+	{ "sbuffer", "", 1, 0, 0 },
+#endif
+#if ENABLE_SCENE_ORDERING_TABLE
+	{ "order-table", "-ot256", 0, 256, 0 },
+#endif
+#if ENABLE_Z_BUFFER && Z_BUFFER_ALL_FORMATS
+	{ "zbuffer-16", "-z16", 0, 0, 16 },
+	{ "zbuffer-32", "-z32", 0, 0, 32 },
+#endif
+};
+
+#define MODE_COUNT (int)(sizeof(modes) / sizeof(modes[0]))
+
+static uint8_t frame[LCD_ROWS * LCD_ROWSIZE];
+static uint8_t reference[LCD_ROWS * LCD_ROWSIZE];
+static uint8_t diff[LCD_ROWS * LCD_ROWSIZE];
+
+static const char* refDir = "test/golden";
+static const char* outDir = "test/golden-out";
+
+static int makeDir(const char* path)
+{
+	if ( mkdir(path, 0777) != 0 && errno != EEXIST )
+	{
+		perror(path);
+		return -1;
+	}
+
+	return 0;
+}
+
+// compares frame with reference, filling in diff, and returns the number of differing pixels.
+static int compareFrames(int* minx, int* miny, int* maxx, int* maxy)
+{
+	int count = 0;
+
+	*minx = LCD_COLUMNS;
+	*miny = LCD_ROWS;
+	*maxx = *maxy = -1;
+
+	for ( int y = 0; y < LCD_ROWS; ++y )
+	{
+		for ( int i = 0; i < LCD_COLUMNS / 8; ++i )
+		{
+			uint8_t d = frame[y * LCD_ROWSIZE + i] ^ reference[y * LCD_ROWSIZE + i];
+
+			// white background, black where they differ
+			diff[y * LCD_ROWSIZE + i] = ~d;
+
+			if ( d == 0 )
+				continue;
+
+			count += __builtin_popcount(d);
+
+			for ( int b = 0; b < 8; ++b )
+			{
+				if ( d & (0x80 >> b) )
+				{
+					int x = i * 8 + b;
+					if ( x < *minx ) *minx = x;
+					if ( x > *maxx ) *maxx = x;
+					if ( y < *miny ) *miny = y;
+					if ( y > *maxy ) *maxy = y;
+				}
+			}
+		}
+	}
+
+	return count;
+}
+
+// checks (or with update, writes) one frame against refName.pbm. name is what it's reported
+// as, and what the frame and diff are written as if it fails. Returns 0 if it passed.
+static int checkFrame(const char* name, const char* refName, int update, int tolerance)
+{
+	char path[512];
+	snprintf(path, sizeof(path), "%s/%s.pbm", refDir, refName);
+
+	if ( update )
+	{
+		if ( pdhost_writePBM(path, frame, LCD_ROWSIZE, LCD_COLUMNS, LCD_ROWS) != 0 )
+		{
+			perror(path);
+			return -1;
+		}
+
+		printf("wrote %s\n", path);
+		return 0;
+	}
+
+	if ( pdhost_readPBM(path, reference, LCD_ROWSIZE, LCD_COLUMNS, LCD_ROWS) != 0 )
+	{
+		printf("FAIL %s: can't read %s (run with --update to make it)\n", name, path);
+		return -1;
+	}
+
+	int minx, miny, maxx, maxy;
+	int count = compareFrames(&minx, &miny, &maxx, &maxy);
+
+	if ( count <= tolerance )
+	{
+		if ( count > 0 )
+			printf("ok   %s (%d pixels differ, within tolerance)\n", name, count);
+		else
+			printf("ok   %s\n", name);
+
+		return 0;
+	}
+
+	printf("FAIL %s: %d pixels differ, in x %d-%d, y %d-%d\n", name, count, minx, maxx, miny, maxy);
+
+	if ( makeDir(outDir) == 0 )
+	{
+		snprintf(path, sizeof(path), "%s/%s.pbm", outDir, name);
+		pdhost_writePBM(path, frame, LCD_ROWSIZE, LCD_COLUMNS, LCD_ROWS);
+
+		snprintf(path, sizeof(path), "%s/%s.diff.pbm", outDir, name);
+		pdhost_writePBM(path, diff, LCD_ROWSIZE, LCD_COLUMNS, LCD_ROWS);
+
+		printf("     frame and diff written to %s/%s.pbm and %s.diff.pbm\n", outDir, name, name);
+	}
+
+	return -1;
+}
+
+int main(int argc, char** argv)
+{
+	int update = 0;
+	int tolerance = 16;
+	int* selected = calloc(benchSceneCount, sizeof(int));
+	int anySelected = 0;
+
+	for ( int i = 1; i < argc; ++i )
+	{
+		if ( strcmp(argv[i], "--update") == 0 )
+			update = 1;
+		else if ( strcmp(argv[i], "--refs") == 0 && i + 1 < argc )
+			refDir = argv[++i];
+		else if ( strcmp(argv[i], "--out") == 0 && i + 1 < argc )
+			outDir = argv[++i];
+		else if ( strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc )
+			tolerance = atoi(argv[++i]);
+		else if ( strcmp(argv[i], "--assets") == 0 && i + 1 < argc )
+			benchAssetDir = argv[++i];
+		else if ( strcmp(argv[i], "--scene") == 0 && i + 1 < argc )
+		{
+			const char* name = argv[++i];
+			int s = 0;
+
+			while ( s < benchSceneCount && strcmp(benchScenes[s].name, name) != 0 )
+				++s;
+
+			if ( s == benchSceneCount )
+			{
+				fprintf(stderr, "no scene called %s\n", name);
+				return 1;
+			}
+
+			selected[s] = anySelected = 1;
+		}
+		else
+		{
+			fprintf(stderr, "usage: %s [--update] [--refs DIR] [--out DIR] [--tolerance N] [--scene NAME]... [--assets DIR]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if ( update && makeDir(refDir) != 0 )
+		return 1;
+
+	pdhost_init();
+
+	int failures = 0;
+	int checked = 0;
+
+	for ( int s = 0; s < benchSceneCount; ++s )
+	{
+		if ( anySelected && !selected[s] )
+			continue;
+
+		int p = 0;
+
+		while ( p < POSE_COUNT && strcmp(poses[p].scene, benchScenes[s].name) != 0 )
+			++p;
+
+		if ( p == POSE_COUNT )
+			continue;
+
+		for ( int m = 0; m < MODE_COUNT; ++m )
+		{
+			// (a mode without references of its own has nothing to write)
+			if ( update && m > 0 && modes[m].suffix[0] == '\0' )
+				continue;
+
+			BenchScene b = { .name = benchScenes[s].name };
+			Scene3D_init(&b.scene);
+			benchScenes[s].init(&b);
+
+			#if ENABLE_S_BUFFER
+			Scene3D_setUsesSBuffer(&b.scene, modes[m].sbuffer);
+			#endif
+			#if ENABLE_SCENE_ORDERING_TABLE
+			Scene3D_setOrderTableSize(&b.scene, modes[m].orderTable);
+			#endif
+			#if ENABLE_Z_BUFFER
+			if ( modes[m].zbits != 0 )
+				Scene3D_setZBufferFormat(&b.scene, modes[m].zbits);
+			#endif
+
+			// scenes move incrementally, so every frame up to the last pose is updated
+			int last = poses[p].frames[FRAMES_PER_POSE - 1];
+			int next = 0;
+
+			for ( int i = 0; i <= last; ++i )
+			{
+				b.update(&b, i);
+
+				if ( i != poses[p].frames[next] )
+					continue;
+
+				char refName[64];
+				snprintf(refName, sizeof(refName), "%s-%03d%s", b.name, i, modes[m].suffix);
+
+				char name[96];
+				if ( modes[m].name != NULL )
+					snprintf(name, sizeof(name), "%s-%03d+%s", b.name, i, modes[m].name);
+				else
+					snprintf(name, sizeof(name), "%s", refName);
+
+				benchDrawFrame(&b.scene, frame, LCD_ROWSIZE);
+
+				if ( checkFrame(name, refName, update, tolerance) != 0 )
+					++failures;
+
+				++checked;
+				++next;
+			}
+
+			Scene3D_deinit(&b.scene);
+		}
+	}
+
+	free(selected);
+
+	if ( !update )
+		printf("%d of %d frames passed\n", checked - failures, checked);
+
+	return failures ? 1 : 0;
+}